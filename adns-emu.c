@@ -0,0 +1,554 @@
+/*
+ * adns-emu.c
+ *
+ * ADNS-3080 register emulator used as SPI transport
+ *
+ * The emulator interprets the byte stream of every SPI_IOC_MESSAGE the
+ * way the sensor does: chip select is asserted for the message and
+ * released after transfers with cs_change set, the first byte after
+ * assertion is an address (bit 7 set = write), read data is presented
+ * on the following byte. The motion burst (0x50) and pixel burst (0x40)
+ * registers stream until chip select is released.
+ *
+ * Time is modelled from the transfer length, clock and delay_usecs of
+ * every transfer, so register timing (tSRAD) can be checked and the
+ * bus time of an access pattern can be measured without hardware.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <linux/spi/spidev.h>
+
+#include "adns-emu.h"
+#include "scene.h"
+
+#define EMU_MAX			8
+
+#define REG_PRODUCT_ID		0x00
+#define REG_REVISION_ID		0x01
+#define REG_MOTION			0x02
+#define REG_DELTA_X			0x03
+#define REG_DELTA_Y			0x04
+#define REG_SQUAL			0x05
+#define REG_PIXEL_SUM		0x06
+#define REG_MAXIMUM_PIXEL	0x07
+#define REG_CONFIG			0x0a
+#define REG_EXT_CONFIG		0x0b
+#define REG_SHUTTER_LOWER	0x0e
+#define REG_SHUTTER_UPPER	0x0f
+#define REG_FP_LOWER		0x10
+#define REG_FP_UPPER		0x11
+#define REG_MOTION_CLEAR	0x12
+#define REG_FRAME_CAPTURE	0x13
+#define REG_FP_MAX_LOWER	0x19
+#define REG_FP_MAX_UPPER	0x1a
+#define REG_FP_MIN_LOWER	0x1b
+#define REG_FP_MIN_UPPER	0x1c
+#define REG_SHUTTER_MAX_LOWER	0x1d
+#define REG_SHUTTER_MAX_UPPER	0x1e
+#define REG_INV_PRODUCT_ID	0x3f
+#define REG_PIXEL_BURST		0x40
+#define REG_MOTION_BURST	0x50
+
+#define EXT_FIXED_FR		0x01
+#define EXT_NAGC			0x02
+#define EXT_BUSY			0x80
+
+#define T_SRAD_NS			50000	// address to read data
+#define T_SRAD_MOT_NS		75000	// address to motion burst data
+
+#define FP_ABS_MIN			0x0e7e	// fastest frame period of the sensor
+#define AUTO_SHUTTER		3000	// exposure the AGC settles on
+#define FRAME_PIXELS		(SCENE_FRAME_SIZE * SCENE_FRAME_SIZE)
+
+enum {
+	ST_ADDR,
+	ST_WDATA,
+	ST_MOTION_BURST,
+	ST_PIXEL_BURST
+};
+
+typedef struct {
+	int fd;
+	int realtime;
+	uint64_t t_base;		// CLOCK_MONOTONIC at open
+	uint64_t now;			// emulator time
+	uint64_t t_update;		// time the sensor state is valid for
+	scene_t scene;
+	uint8_t reg[0x80];
+
+	// motion accumulator of the sensor
+	int32_t acc_x;
+	int32_t acc_y;
+	uint8_t ovf;
+	uint8_t latched;
+
+	// active bounds, written values become active after busy
+	uint16_t fp_max;
+	uint16_t fp_min;
+	uint16_t shutter_max;
+	uint8_t busy;
+	uint64_t busy_until;
+	uint16_t shutter;
+	uint16_t frame_period;
+
+	// current frame and its statistics
+	uint64_t t_frame;
+	uint8_t frame_valid;
+	uint8_t frame[FRAME_PIXELS];
+	uint8_t squal;
+	uint8_t pixel_sum;
+	uint8_t maximum_pixel;
+	uint8_t capture[FRAME_PIXELS];
+	uint8_t capture_valid;
+	uint64_t t_capture;		// capture available in the pixel burst
+
+	// serial port state
+	int state;
+	uint8_t addr;
+	uint8_t shift;
+	uint8_t pending;
+	uint8_t pending_val;
+	uint64_t t_ready;
+	int burst_idx;
+	uint8_t burst[7];
+
+	adns_emu_stats_t stats;
+} adns_emu_t;
+
+static adns_emu_t *emu_tab[EMU_MAX];
+
+static int32_t default_speed_x = 100;
+static int32_t default_speed_y = 0;
+static uint32_t default_seed = 0x3080;
+
+static uint64_t monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static adns_emu_t *emu_lookup(int fd) {
+	int i;
+	for (i = 0; i < EMU_MAX; i++) {
+		if (emu_tab[i] && (emu_tab[i]->fd == fd)) return emu_tab[i];
+	}
+	return NULL;
+}
+
+static uint64_t frame_ns(const adns_emu_t *e) {
+	// frame period is given in 24 MHz clock cycles
+	return (uint64_t)e->frame_period * 1000 / 24;
+}
+
+static void emu_exposure(adns_emu_t *e) {
+	uint8_t ext = e->reg[REG_EXT_CONFIG];
+
+	if (ext & EXT_NAGC) e->shutter = e->shutter_max;
+	else e->shutter = (AUTO_SHUTTER < e->shutter_max) ? AUTO_SHUTTER : e->shutter_max;
+
+	if (ext & EXT_FIXED_FR) {
+		e->frame_period = e->fp_max;
+	} else {
+		uint32_t fp = e->shutter + FP_ABS_MIN;
+		if (fp < e->fp_min) fp = e->fp_min;
+		if (fp > e->fp_max) fp = e->fp_max;
+		e->frame_period = fp;
+	}
+	if (e->frame_period < FP_ABS_MIN) e->frame_period = FP_ABS_MIN;
+}
+
+static void emu_render(adns_emu_t *e) {
+	int i;
+	uint32_t sum = 0;
+	uint32_t features = 0;
+	uint8_t max = 0;
+
+	scene_render(&e->scene, e->frame);
+	for (i = 0; i < FRAME_PIXELS; i++) {
+		uint8_t p = e->frame[i];
+		sum += p;
+		if (p > max) max = p;
+		if (((i % SCENE_FRAME_SIZE) < SCENE_FRAME_SIZE - 1) && (i < FRAME_PIXELS - SCENE_FRAME_SIZE)) {
+			int dx = abs((int)p - e->frame[i + 1]);
+			int dy = abs((int)p - e->frame[i + SCENE_FRAME_SIZE]);
+			if (dx + dy >= 16) features++;
+		}
+	}
+	e->pixel_sum = sum >> 8;
+	e->maximum_pixel = max;
+	e->squal = (features / 4 > 169) ? 169 : features / 4;
+	e->frame_valid = 1;
+	e->t_frame = e->now;
+}
+
+static void emu_update(adns_emu_t *e) {
+	if (e->now > e->t_update) {
+		int64_t x0 = e->scene.x;
+		int64_t y0 = e->scene.y;
+		// 400 cpi is one count per pixel, high resolution four
+		int cpp = (e->reg[REG_CONFIG] & 0x10) ? 4 : 1;
+
+		scene_advance(&e->scene, e->now - e->t_update);
+		e->acc_x += ((e->scene.x * cpp) >> SCENE_Q) - ((x0 * cpp) >> SCENE_Q);
+		e->acc_y += ((e->scene.y * cpp) >> SCENE_Q) - ((y0 * cpp) >> SCENE_Q);
+
+		// the accumulator saturates, counts beyond are lost
+		if (e->acc_x > 127) { e->acc_x = 127; e->ovf = 1; }
+		if (e->acc_x < -128) { e->acc_x = -128; e->ovf = 1; }
+		if (e->acc_y > 127) { e->acc_y = 127; e->ovf = 1; }
+		if (e->acc_y < -128) { e->acc_y = -128; e->ovf = 1; }
+
+		e->t_update = e->now;
+	}
+
+	if (e->busy && (e->now >= e->busy_until)) {
+		e->fp_max = (e->reg[REG_FP_MAX_UPPER] << 8) | e->reg[REG_FP_MAX_LOWER];
+		e->fp_min = (e->reg[REG_FP_MIN_UPPER] << 8) | e->reg[REG_FP_MIN_LOWER];
+		e->shutter_max = (e->reg[REG_SHUTTER_MAX_UPPER] << 8) | e->reg[REG_SHUTTER_MAX_LOWER];
+		e->busy = 0;
+	}
+	emu_exposure(e);
+}
+
+// frame statistics are only computed when a register needs them
+static void emu_frame(adns_emu_t *e) {
+	if (!e->frame_valid || (e->now - e->t_frame >= frame_ns(e))) emu_render(e);
+}
+
+static uint8_t emu_motion_val(const adns_emu_t *e) {
+	uint8_t val = 0;
+	if (e->acc_x || e->acc_y) val |= 0x80;
+	if (e->ovf) val |= 0x10;
+	if (e->reg[REG_CONFIG] & 0x10) val |= 0x01;
+	return val;
+}
+
+static void emu_latch(adns_emu_t *e) {
+	e->reg[REG_MOTION] = emu_motion_val(e);
+	e->reg[REG_DELTA_X] = (uint8_t)(int8_t)e->acc_x;
+	e->reg[REG_DELTA_Y] = (uint8_t)(int8_t)e->acc_y;
+	e->acc_x = 0;
+	e->acc_y = 0;
+	e->ovf = 0;
+	e->latched = 1;
+}
+
+static uint8_t emu_read(adns_emu_t *e, uint8_t addr) {
+	emu_update(e);
+
+	switch (addr) {
+	case REG_MOTION:
+		emu_latch(e);
+		return e->reg[REG_MOTION];
+	case REG_DELTA_X:
+		if (!e->latched) emu_latch(e);
+		return e->reg[REG_DELTA_X];
+	case REG_DELTA_Y:
+		if (!e->latched) emu_latch(e);
+		e->latched = 0;
+		return e->reg[REG_DELTA_Y];
+	case REG_SQUAL:
+		emu_frame(e);
+		return e->squal;
+	case REG_PIXEL_SUM:
+		emu_frame(e);
+		return e->pixel_sum;
+	case REG_MAXIMUM_PIXEL:
+		emu_frame(e);
+		return e->maximum_pixel;
+	case REG_EXT_CONFIG:
+		return e->reg[REG_EXT_CONFIG] | (e->busy ? EXT_BUSY : 0);
+	case REG_SHUTTER_LOWER:
+		return e->shutter;
+	case REG_SHUTTER_UPPER:
+		return e->shutter >> 8;
+	case REG_FP_LOWER:
+		return e->frame_period;
+	case REG_FP_UPPER:
+		return e->frame_period >> 8;
+	default:
+		return e->reg[addr & 0x7f];
+	}
+}
+
+static void emu_write(adns_emu_t *e, uint8_t addr, uint8_t val) {
+	emu_update(e);
+
+	switch (addr) {
+	case REG_MOTION_CLEAR:
+		e->acc_x = 0;
+		e->acc_y = 0;
+		e->ovf = 0;
+		break;
+	case REG_FRAME_CAPTURE:
+		if (val == 0x83) {
+			emu_frame(e);
+			memcpy(e->capture, e->frame, FRAME_PIXELS);
+			e->capture_valid = 1;
+			// the sensor needs 10us + 3 frame periods to store the frame
+			e->t_capture = e->now + 10000 + 3 * frame_ns(e);
+		}
+		break;
+	case REG_EXT_CONFIG:
+		e->reg[addr] = val & 0x07;
+		emu_exposure(e);
+		break;
+	case REG_FP_MAX_LOWER:
+	case REG_FP_MAX_UPPER:
+	case REG_FP_MIN_LOWER:
+	case REG_FP_MIN_UPPER:
+	case REG_SHUTTER_MAX_LOWER:
+	case REG_SHUTTER_MAX_UPPER:
+		if (e->busy) {
+			// writes while busy are ignored by the sensor
+			e->stats.violations++;
+			break;
+		}
+		e->reg[addr] = val;
+		if (addr == REG_FP_MAX_UPPER) {
+			// new bounds become active after the running frame(s)
+			e->busy = 1;
+			e->busy_until = e->now + 2 * frame_ns(e);
+		}
+		break;
+	case REG_PRODUCT_ID:
+	case REG_REVISION_ID:
+	case REG_INV_PRODUCT_ID:
+		// read only
+		break;
+	default:
+		e->reg[addr & 0x7f] = val;
+	}
+}
+
+static void emu_cs_release(adns_emu_t *e) {
+	e->state = ST_ADDR;
+	e->pending = 0;
+}
+
+static uint8_t emu_byte(adns_emu_t *e, uint8_t mosi, uint64_t byte_ns) {
+	uint8_t miso = 0;
+
+	switch (e->state) {
+	case ST_ADDR:
+		if (e->pending) {
+			// data shifts out while the next address shifts in
+			if (e->now >= e->t_ready) e->shift = e->pending_val;
+			else e->stats.violations++;
+			miso = e->shift;
+			e->pending = 0;
+		}
+		if (mosi & 0x80) {
+			e->addr = mosi & 0x7f;
+			e->state = ST_WDATA;
+		} else if (mosi == REG_MOTION_BURST) {
+			emu_update(e);
+			emu_frame(e);
+			e->burst[0] = emu_motion_val(e);
+			e->burst[1] = (uint8_t)(int8_t)e->acc_x;
+			e->burst[2] = (uint8_t)(int8_t)e->acc_y;
+			e->burst[3] = e->squal;
+			e->burst[4] = e->shutter >> 8;
+			e->burst[5] = e->shutter;
+			e->burst[6] = e->maximum_pixel;
+			e->acc_x = 0;
+			e->acc_y = 0;
+			e->ovf = 0;
+			e->burst_idx = 0;
+			e->t_ready = e->now + byte_ns + T_SRAD_MOT_NS;
+			e->state = ST_MOTION_BURST;
+		} else if (mosi == REG_PIXEL_BURST) {
+			e->burst_idx = 0;
+			e->t_ready = e->now + byte_ns + T_SRAD_NS;
+			e->state = ST_PIXEL_BURST;
+		} else {
+			e->pending_val = emu_read(e, mosi);
+			e->pending = 1;
+			e->t_ready = e->now + byte_ns + T_SRAD_NS;
+		}
+		break;
+	case ST_WDATA:
+		emu_write(e, e->addr, mosi);
+		e->state = ST_ADDR;
+		break;
+	case ST_MOTION_BURST:
+		if ((e->burst_idx == 0) && (e->now < e->t_ready)) e->stats.violations++;
+		miso = (e->burst_idx < sizeof(e->burst)) ? e->burst[e->burst_idx] : 0;
+		e->burst_idx++;
+		break;
+	case ST_PIXEL_BURST:
+		if ((e->burst_idx == 0) && ((e->now < e->t_ready) || (e->now < e->t_capture))) {
+			e->stats.violations++;
+			e->capture_valid = 0;
+		}
+		if (e->capture_valid && (e->burst_idx < FRAME_PIXELS)) {
+			// bit 6 marks valid data, bit 7 the first pixel of a frame
+			miso = 0x40 | e->capture[e->burst_idx];
+			if (e->burst_idx == 0) miso |= 0x80;
+		}
+		e->burst_idx++;
+		if (e->burst_idx == FRAME_PIXELS) e->capture_valid = 0;
+		break;
+	}
+	return miso;
+}
+
+static int emu_message(int fd, struct spi_ioc_transfer *tr, unsigned int n) {
+	adns_emu_t *e = emu_lookup(fd);
+	unsigned int i, k;
+	int total = 0;
+
+	if (e == NULL) return -1;
+
+	if (e->realtime) {
+		uint64_t t = monotonic_ns() - e->t_base;
+		if (t > e->now) e->now = t;
+	}
+	e->stats.messages++;
+
+	for (i = 0; i < n; i++) {
+		const uint8_t *tx = (const uint8_t *)(unsigned long)tr[i].tx_buf;
+		uint8_t *rx = (uint8_t *)(unsigned long)tr[i].rx_buf;
+		uint32_t hz = tr[i].speed_hz ? tr[i].speed_hz : 500000;
+		uint64_t byte_ns = 8000000000ULL / hz;
+
+		for (k = 0; k < tr[i].len; k++) {
+			uint8_t miso = emu_byte(e, tx ? tx[k] : 0, byte_ns);
+			if (rx) rx[k] = miso;
+			e->now += byte_ns;
+		}
+		e->now += (uint64_t)tr[i].delay_usecs * 1000;
+		e->stats.bus_ns += tr[i].len * byte_ns + (uint64_t)tr[i].delay_usecs * 1000;
+		e->stats.bytes += tr[i].len;
+		e->stats.transfers++;
+		total += tr[i].len;
+
+		if (tr[i].cs_change && (i < n - 1)) emu_cs_release(e);
+	}
+	emu_cs_release(e);
+
+	if (e->realtime) {
+		// like spidev, return when the transfer and its delays are over
+		uint64_t t = e->t_base + e->now;
+		struct timespec ts = { t / 1000000000ULL, t % 1000000000ULL };
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+	}
+
+	return total;
+}
+
+static int emu_open(const char *device, uint8_t *mode, uint8_t *bits, uint32_t *speed) {
+	int i;
+	adns_emu_t *e;
+
+	for (i = 0; i < EMU_MAX; i++) {
+		if (emu_tab[i] == NULL) break;
+	}
+	if (i == EMU_MAX) return -1;
+
+	e = calloc(1, sizeof(*e));
+	if (e == NULL) return -1;
+
+	// a real descriptor keeps close() in the callers valid
+	e->fd = open("/dev/null", O_RDWR);
+	if (e->fd < 0) {
+		free(e);
+		return -1;
+	}
+
+	e->realtime = 1;
+	e->t_base = monotonic_ns();
+	scene_init(&e->scene, default_seed);
+	scene_set_speed(&e->scene, default_speed_x, default_speed_y);
+
+	e->reg[REG_PRODUCT_ID] = 0x17;
+	e->reg[REG_REVISION_ID] = 0x01;
+	e->reg[REG_INV_PRODUCT_ID] = 0xe8;
+	e->reg[REG_CONFIG] = 0x09;
+	e->fp_max = 0x5dc0;
+	e->fp_min = 0x0fa0;
+	e->shutter_max = 0x4e20;
+	e->reg[REG_FP_MAX_LOWER] = e->fp_max;
+	e->reg[REG_FP_MAX_UPPER] = e->fp_max >> 8;
+	e->reg[REG_FP_MIN_LOWER] = e->fp_min;
+	e->reg[REG_FP_MIN_UPPER] = e->fp_min >> 8;
+	e->reg[REG_SHUTTER_MAX_LOWER] = e->shutter_max;
+	e->reg[REG_SHUTTER_MAX_UPPER] = e->shutter_max >> 8;
+	emu_exposure(e);
+
+	emu_tab[i] = e;
+	return e->fd;
+}
+
+static void emu_close(int fd) {
+	int i;
+	for (i = 0; i < EMU_MAX; i++) {
+		if (emu_tab[i] && (emu_tab[i]->fd == fd)) {
+			close(emu_tab[i]->fd);
+			free(emu_tab[i]);
+			emu_tab[i] = NULL;
+		}
+	}
+}
+
+const spi_transport_t spi_transport_emu = {
+	.name = "emu",
+	.open = emu_open,
+	.message = emu_message,
+	.close = emu_close,
+};
+
+void ADNS_emu_defaults(int32_t speed_x, int32_t speed_y, uint32_t seed) {
+	default_speed_x = speed_x;
+	default_speed_y = speed_y;
+	default_seed = seed;
+}
+
+int ADNS_emu_set_speed(int fd, int32_t speed_x, int32_t speed_y) {
+	adns_emu_t *e = emu_lookup(fd);
+	if (e == NULL) return -1;
+
+	// motion up to now happened with the old speed
+	emu_update(e);
+	scene_set_speed(&e->scene, speed_x, speed_y);
+	return 0;
+}
+
+int ADNS_emu_set_realtime(int fd, int realtime) {
+	adns_emu_t *e = emu_lookup(fd);
+	if (e == NULL) return -1;
+
+	e->realtime = realtime;
+	if (realtime) e->t_base = monotonic_ns() - e->now;
+	return 0;
+}
+
+int ADNS_emu_advance(int fd, uint64_t ns) {
+	adns_emu_t *e = emu_lookup(fd);
+	if (e == NULL) return -1;
+
+	e->now += ns;
+	return 0;
+}
+
+int ADNS_emu_get_stats(int fd, adns_emu_stats_t *stats) {
+	adns_emu_t *e = emu_lookup(fd);
+	if (e == NULL) return -1;
+
+	*stats = e->stats;
+	return 0;
+}
+
+int ADNS_emu_reset_stats(int fd) {
+	adns_emu_t *e = emu_lookup(fd);
+	if (e == NULL) return -1;
+
+	memset(&e->stats, 0, sizeof(e->stats));
+	return 0;
+}
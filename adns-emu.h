@@ -0,0 +1,32 @@
+/*
+ * adns-emu.h
+ *
+ * in-process emulation of the ADNS-3080 SPI register map
+ */
+
+#ifndef ADNS_EMU_H_
+#define ADNS_EMU_H_
+#include <stdint.h>
+
+#include "spi-transport.h"
+
+typedef struct {
+	uint64_t messages;		// SPI_IOC_MESSAGE calls
+	uint64_t transfers;		// spi_ioc_transfer entries
+	uint64_t bytes;			// bytes on the wire
+	uint64_t bus_ns;		// modelled wire time incl. transfer delays
+	uint64_t violations;	// timing or protocol violations seen
+} adns_emu_stats_t;
+
+// defaults applied to every emulated sensor opened afterwards
+void ADNS_emu_defaults(int32_t speed_x, int32_t speed_y, uint32_t seed);
+
+int ADNS_emu_set_speed(int fd, int32_t speed_x, int32_t speed_y);
+// realtime != 0: emulator time follows CLOCK_MONOTONIC (default)
+// realtime == 0: emulator time only advances by modelled bus time
+int ADNS_emu_set_realtime(int fd, int realtime);
+int ADNS_emu_advance(int fd, uint64_t ns);
+int ADNS_emu_get_stats(int fd, adns_emu_stats_t *stats);
+int ADNS_emu_reset_stats(int fd);
+
+#endif /* ADNS_EMU_H_ */
@@ -20,16 +20,23 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <time.h>
 #include <linux/types.h>
 #include <linux/spi/spidev.h>
 
 #include "adns.h"
+#include "adns-emu.h"
+#include "latency.h"
+#include "spi-transport.h"
+#include "trace.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
 static void pabort(const char *s)
 {
 	perror(s);
+	// what led up to it
+	trace_dump(stderr);
 	abort();
 }
 
@@ -39,10 +46,31 @@ static const char *device = "/dev/spidev0.0";
 static uint8_t mode = SPI_CPHA | SPI_CPOL;
 static uint32_t speed = 500000;
 static uint8_t verbose = 0;
+static const spi_transport_t *transport = &spi_transport_spidev;
+static int32_t emu_speed_x = 100;
+static int32_t emu_speed_y = 0;
+static uint32_t emu_seed = 0x3080;
+static adns_read_mode_t read_mode = ADNS_READ_PLANNED;
 
 adns3080_t adns;
 
-int SPI_read_byte(int fd, uint8_t addr, uint8_t *value) {
+int SPI_message(int fd, struct spi_ioc_transfer *tr, unsigned int n) {
+	return transport->message(fd, tr, n);
+}
+
+static int SPI_transfer(adns_t *s, struct spi_ioc_transfer *tr, unsigned int n) {
+	return s->transport->message(s->fd, tr, n);
+}
+
+const spi_transport_t *SPI_get_transport(void) {
+	return transport;
+}
+
+void SPI_set_transport(const spi_transport_t *t) {
+	transport = t;
+}
+
+static int SPI_read_byte(adns_t *s, uint8_t addr, uint8_t *value) {
 	int n = 1;
 	struct spi_ioc_transfer tr[2] = {{0},};
     
@@ -52,30 +80,29 @@ int SPI_read_byte(int fd, uint8_t addr, uint8_t *value) {
 	tr[0].tx_buf = (unsigned long)tx;
 	tr[0].rx_buf = (unsigned long)NULL;
 	tr[0].len = n;
-	tr[0].delay_usecs = delay;
-	tr[0].speed_hz = speed;
-	tr[0].bits_per_word = bits;
+	tr[0].delay_usecs = s->delay;
+	tr[0].speed_hz = s->speed;
+	tr[0].bits_per_word = s->bits;
 
 	tr[1].tx_buf = (unsigned long)NULL;
 	tr[1].rx_buf = (unsigned long)rx;
 	tr[1].len = n;
-	tr[1].delay_usecs = delay;
-	tr[1].speed_hz = speed;
-	tr[1].bits_per_word = bits;
+	tr[1].delay_usecs = s->delay;
+	tr[1].speed_hz = s->speed;
+	tr[1].bits_per_word = s->bits;
 
 	int ret;
-	ret = ioctl(fd, SPI_IOC_MESSAGE(2), &tr);
+	uint64_t t_lat = lat_start();
+	ret = SPI_transfer(s, tr, 2);
+	lat_end(LAT_REG_READ, t_lat);
 	if (ret < 1) pabort("can't send spi message");
 
 	*value = rx[0];
-	
-	if (verbose > 1) {
-		printf("spi read byte at address: %.2x = %.2x\n", addr, rx[0]);	
-	}
+	TRACE(TRACE_DEBUG, TRACE_SPI_READ, addr, rx[0], 0, 0);
 	return ret;
 }
 
-int SPI_write_byte(int fd, uint8_t addr, uint8_t value) {
+static int SPI_write_byte(adns_t *s, uint8_t addr, uint8_t value) {
 	// write
 	struct spi_ioc_transfer tr[1] = {{0},};
     
@@ -84,21 +111,146 @@ int SPI_write_byte(int fd, uint8_t addr, uint8_t value) {
 	tr[0].tx_buf = (unsigned long)tx;
 	tr[0].rx_buf = (unsigned long)NULL;
 	tr[0].len = 2;
-	tr[0].delay_usecs = delay;
-	tr[0].speed_hz = speed;
-	tr[0].bits_per_word = bits;
+	tr[0].delay_usecs = s->delay;
+	tr[0].speed_hz = s->speed;
+	tr[0].bits_per_word = s->bits;
 
 	int ret;
-	ret = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
+	uint64_t t_lat = lat_start();
+	ret = SPI_transfer(s, tr, 1);
+	lat_end(LAT_REG_WRITE, t_lat);
 	if (ret < 1) pabort("can't send spi message");
 
-	if (verbose > 1) {
-		printf("spi write byte %.2x to address %.2x\n", value, addr);	
+	TRACE(TRACE_DEBUG, TRACE_SPI_WRITE, addr, value, 0, 0);
+	return ret;
+}
+
+static void decode_motion_burst(adns_t *s, const uint8_t *rx) {
+	s->adns.motion_val		= rx[0];
+	s->adns.delta_X    	= (int8_t)rx[1];
+	s->adns.delta_Y    	= (int8_t)rx[2];
+	s->adns.squal		= 4*rx[3];
+	s->adns.shutter		= (rx[4] << 8) | rx[5];
+	s->adns.maximum_pixel	= rx[6];
+}
+
+/*
+ * register transaction planner
+ *
+ * Collects register accesses and sends them as one SPI_IOC_MESSAGE.
+ * Every access gets its own chip select frame (cs_change) and the
+ * delays the sensor needs after it, accesses run in the order they
+ * were added.
+ */
+void adns_plan_init(const adns_t *s, adns_plan_t *p) {
+	p->n = 0;
+	p->ops = 0;
+	p->speed = s->speed;
+	p->bits = s->bits;
+	p->delay = s->delay;
+}
+
+static struct spi_ioc_transfer *plan_transfer(adns_plan_t *p) {
+	struct spi_ioc_transfer *t = &p->tr[p->n++];
+
+	memset(t, 0, sizeof(*t));
+	t->speed_hz = p->speed;
+	t->bits_per_word = p->bits;
+	return t;
+}
+
+int ADNS_plan_read(adns_plan_t *p, uint8_t addr, uint8_t *value) {
+	return ADNS_plan_burst(p, addr, value, 1);
+}
+
+int ADNS_plan_burst(adns_plan_t *p, uint8_t addr, uint8_t *buf, int len) {
+	struct spi_ioc_transfer *t;
+
+	if (p->ops >= ADNS_PLAN_MAX) return -1;
+	p->tx[p->ops][0] = addr & 0x7f;
+
+	// address, then wait tSRAD before the data is clocked out
+	t = plan_transfer(p);
+	t->tx_buf = (unsigned long)p->tx[p->ops];
+	t->len = 1;
+	t->delay_usecs = p->delay;
+
+	t = plan_transfer(p);
+	t->rx_buf = (unsigned long)buf;
+	t->len = len;
+	t->delay_usecs = (len > 1) ? ADNS_T_BEXIT : ADNS_T_SRR;
+	t->cs_change = 1;
+
+	p->ops++;
+	return 0;
+}
+
+/*
+ * pipelined read of several registers in one chip select frame
+ *
+ * One full-duplex byte per transfer: while the address of register k is
+ * clocked out the value of register k-1 arrives, so n registers take
+ * n+1 bytes instead of 2n. Every byte is followed by tSRAD, which the
+ * legacy read_ADNS() in adns-connect.c did not wait and therefore got
+ * its data shifted by one access.
+ */
+int ADNS_plan_pipeline(adns_plan_t *p, const uint8_t *addr, uint8_t *value, int n) {
+	struct spi_ioc_transfer *t;
+	int k;
+
+	if ((n < 1) || (p->ops + n + 1 > ADNS_PLAN_MAX)) return -1;
+
+	for (k = 0; k <= n; k++) {
+		// the trailing dummy address reads the product id, no side effects
+		p->tx[p->ops][0] = (k < n) ? (addr[k] & 0x7f) : 0x00;
+
+		t = plan_transfer(p);
+		t->tx_buf = (unsigned long)p->tx[p->ops];
+		t->rx_buf = (k > 0) ? (unsigned long)&value[k - 1] : 0;
+		t->len = 1;
+		t->delay_usecs = (k < n) ? p->delay : ADNS_T_SRR;
+		p->ops++;
 	}
+	t->cs_change = 1;
+
+	return 0;
+}
+
+int ADNS_plan_write(adns_plan_t *p, uint8_t addr, uint8_t value) {
+	struct spi_ioc_transfer *t;
+
+	if (p->ops >= ADNS_PLAN_MAX) return -1;
+	p->tx[p->ops][0] = 0x80 | addr;
+	p->tx[p->ops][1] = value;
+
+	t = plan_transfer(p);
+	t->tx_buf = (unsigned long)p->tx[p->ops];
+	t->len = 2;
+	t->delay_usecs = ADNS_T_SWW;
+	t->cs_change = 1;
+
+	p->ops++;
+	return 0;
+}
+
+int adns_plan_exec(adns_t *s, adns_plan_t *p) {
+	int ret;
+
+	if (p->n == 0) return 0;
+
+	// cs_change on the last transfer would keep the sensor selected
+	p->tr[p->n - 1].cs_change = 0;
+
+	uint64_t t_lat = lat_start();
+	ret = SPI_transfer(s, p->tr, p->n);
+	lat_end(LAT_REG_PLAN, t_lat);
+	if (ret < 1) pabort("can't send spi message");
+
+	TRACE(TRACE_DEBUG, TRACE_PLAN, p->ops, p->n, ret, 0);
 	return ret;
 }
 
-int ADNS_read_motion_burst(int fd) {
+int adns_read_motion_burst(adns_t *s) {
 	struct spi_ioc_transfer tr[2] = {{0},};
 	uint8_t addr = 0x50;
     
@@ -108,317 +260,445 @@ int ADNS_read_motion_burst(int fd) {
 	tr[0].tx_buf = (unsigned long)tx;
 	tr[0].rx_buf = (unsigned long)NULL;
 	tr[0].len = 1;
-	tr[0].delay_usecs = delay;
-	tr[0].speed_hz = speed;
-	tr[0].bits_per_word = bits;
+	tr[0].delay_usecs = s->delay;
+	tr[0].speed_hz = s->speed;
+	tr[0].bits_per_word = s->bits;
 
 	tr[1].tx_buf = (unsigned long)NULL;
 	tr[1].rx_buf = (unsigned long)rx;
 	tr[1].len = 7;
-	tr[1].delay_usecs = delay;
-	tr[1].speed_hz = speed;
-	tr[1].bits_per_word = bits;
+	tr[1].delay_usecs = s->delay;
+	tr[1].speed_hz = s->speed;
+	tr[1].bits_per_word = s->bits;
 
 	int ret;
-	ret = ioctl(fd, SPI_IOC_MESSAGE(2), &tr);
+	uint64_t t_lat = lat_start();
+	ret = SPI_transfer(s, tr, 2);
+	lat_end(LAT_MOTION_BURST, t_lat);
 	if (ret < 1) pabort("can't send spi message");
 
-	adns.motion_val		= rx[0];
-	adns.delta_X    	= (int8_t)rx[1];
-	adns.delta_Y    	= (int8_t)rx[2];
-	adns.squal		= 4*rx[3];
-	adns.shutter		= (rx[4] << 8) | rx[5];
-	adns.maximum_pixel	= rx[6];
-
-	if (verbose) {
-		printf("spi read motion burst from address %.2x\n", addr);
-		if (verbose > 1) {
-			int i;
-			printf("\treceived:");
-			for (i = 0; i < tr[1].len; i++) {
-				if (!(i % 8)) printf("\n\t\t");
-				printf("%.2x ", rx[i]);
-			}
-			printf("\n");
-		}
-		printf("\tmotion MOT %d\n", adns.motion.MOT);
-		printf("\tmotion OVF %d\n", adns.motion.OVF);
-		printf("\tmotion RES %d\n", adns.motion.RES);
-		printf("\tdelta_x %d\n", adns.delta_X);
-		printf("\tdelta_y %d\n", adns.delta_Y);
-		printf("\tSQUAL %d\n", adns.squal);
-		printf("\tmaximum_pixel %d\n", adns.maximum_pixel);
-		printf("\tshutter %d\n", adns.shutter);
-	}
+	decode_motion_burst(s, rx);
+	TRACE(TRACE_INFO, TRACE_MOTION, s->adns.motion_val | (s->adns.maximum_pixel << 8), s->adns.delta_X, s->adns.delta_Y,
+		s->adns.squal | (s->adns.shutter << 16));
 	return ret;
 }
 
-int ADNS_read_frame_burst(int fd, uint8_t * frame) {
+int adns_read_frame_burst(adns_t *s, uint8_t * frame) {
 	int ret;
-	if (verbose) printf("get adns raw values\n");
 
 	// read frame period
 	uint8_t _valLower;
 	uint8_t _valUpper;
-	ret = SPI_read_byte(fd, 0x11, &_valUpper);
+	ret = SPI_read_byte(s, 0x11, &_valUpper);
 	if (ret < 1) return ret;
-	ret = SPI_read_byte(fd, 0x10, &_valLower);
+	ret = SPI_read_byte(s, 0x10, &_valLower);
 	if (ret < 1) return ret;
-	adns.frame_period 	= (_valUpper << 8) | _valLower;
+	s->adns.frame_period 	= (_valUpper << 8) | _valLower;
+
+	return adns_capture_frame(s, frame, NULL);
+}
+
+/*
+ * trigger a frame capture and read it with the pixel burst
+ *
+ * Waits for the capture based on s->adns.frame_period, which has to be
+ * current. Returns the number of pixels (ADNS_FRAME_PIXELS), 0 if the
+ * burst did not start with a frame. st may be NULL.
+ */
+int adns_capture_frame(adns_t *s, uint8_t *frame, pixel_stats_t *st) {
+	pixel_stats_t own;
+	int ret;
 
 	// write frame capture register
-	ret = SPI_write_byte(fd, 0x80 | 0x13, 0x83);
+	ret = SPI_write_byte(s, 0x80 | 0x13, 0x83);
 	if (ret < 1) return ret;
 	
-	// wait 10us + 3 frame periods
-	usleep(3 * adns.frame_period);
+	// wait 10us + 3 frame periods, the period is counted in 24 MHz clocks
+	usleep(10 + (3 * s->adns.frame_period + 23) / 24);
 
 	// read pixel dump register
 	struct spi_ioc_transfer tr[2] = {{0},};
 	uint8_t addr = 0x40;
     
    	uint8_t tx[1] = {addr};
-	uint8_t rx[1024] = {};
+	uint8_t rx[ADNS_FRAME_PIXELS] = {};
 
 	tr[0].tx_buf = (unsigned long)tx;
 	tr[0].rx_buf = (unsigned long)NULL;
 	tr[0].len = 1;
-	tr[0].delay_usecs = delay;
-	tr[0].speed_hz = speed;
-	tr[0].bits_per_word = bits;
+	tr[0].delay_usecs = s->delay;
+	tr[0].speed_hz = s->speed;
+	tr[0].bits_per_word = s->bits;
 
+	// the burst ends with the frame, no need to clock more
 	tr[1].tx_buf = (unsigned long)NULL;
 	tr[1].rx_buf = (unsigned long)rx;
-	tr[1].len = 1024;
-	tr[1].delay_usecs = delay;
-	tr[1].speed_hz = speed;
-	tr[1].bits_per_word = bits;
-
-	ret = ioctl(fd, SPI_IOC_MESSAGE(2), &tr);
+	tr[1].len = ADNS_FRAME_PIXELS;
+	tr[1].delay_usecs = ADNS_T_BEXIT;
+	tr[1].speed_hz = s->speed;
+	tr[1].bits_per_word = s->bits;
+
+	uint64_t t_lat = lat_start();
+	ret = SPI_transfer(s, tr, 2);
+	lat_end(LAT_FRAME_BURST, t_lat);
 	if (ret < 1) pabort("can't send spi message");
 
-	if (verbose) printf("\tread %d bytes\n", ret-1);
-	
-	// release and copy 6bit pixel values 
-	int l=0;
-	for (l = 0; l < 900; l++) {
-		frame[l] = rx[l] & ((1<<6)-1);
-	}
+	// release and copy 6bit pixel values, the first one starts the frame
+	if (st == NULL) st = &own;
+	pixel_frame(rx, frame, ADNS_FRAME_PIXELS, st, NULL);
+	TRACE(TRACE_INFO, TRACE_FRAME, ret - 1, st->sof, st->min | (st->max << 8), st->sum);
+	if (st->sof != 0) return 0;
 	
-	if (verbose > 1) {
-		int i;
-		printf("\treceived:");
-		for (i = 0; i < tr[1].len; i++) {
-			if (!(i % 8)) printf("\n\t\t");
-				printf("%.2X ", rx[i]);
-		}
-		printf("\n");
-	}
-	
-	return ret;
+	return ADNS_FRAME_PIXELS;
 }
 
-int ADNS_read_all(int fd) {
+int adns_read_all(adns_t *s) {
 	int ret;
-        
-	if (verbose) printf("read all essential adns values\n");
-	
-	// read motion, delta_X, delta_Y, squal, shutter, maximum_pixel
-	ret = ADNS_read_motion_burst(fd);
-	if (ret < 1) return ret;
 
 	// read frame period
 	uint8_t _valLower;
 	uint8_t _valUpper;
-	ret = SPI_read_byte(fd, 0x11, &_valUpper);
-	if (ret < 1) return ret;
-	ret = SPI_read_byte(fd, 0x10, &_valLower);
-	if (ret < 1) return ret;
-	adns.frame_period 	= (_valUpper << 8) | _valLower;
 
-	// read product id
-	ret = SPI_read_byte(fd, 0x00, &(adns.product_ID));
-	if (ret < 1) return ret;
-	
-	// read revision
-	ret = SPI_read_byte(fd, 0x01, &(adns.revision));
-	if (ret < 1) return ret;
-	
-	// read pixel_sum
-	ret = SPI_read_byte(fd, 0x06, &(adns.pixel_sum));
-	if (ret < 1) return ret;
-	
-	// read inv_product_ID
-	ret = SPI_read_byte(fd, 0x3f, &(adns.inv_product_ID));
-	if (ret < 1) return ret;
-	
-	if (verbose > 1) {
-		printf("\n");
-		printf("product_ID 0x%x\n", adns.product_ID);
-		printf("inverse product_ID 0x%x\n", adns.inv_product_ID);
-		printf("revision_ID 0x%x\n", adns.revision);
-		printf("pixel_sum %d\n", adns.pixel_sum);
-		printf("frame_period %d - %f Hz\n", adns.frame_period, 24E6/adns.frame_period);
+	if (s->read_mode == ADNS_READ_PIPELINED) {
+		adns_plan_t plan;
+		uint8_t rx[7];
+		uint8_t val[6];
+		static const uint8_t addr[6] = {0x11, 0x10, 0x00, 0x01, 0x06, 0x3f};
+
+		adns_plan_init(s, &plan);
+		ADNS_plan_burst(&plan, 0x50, rx, sizeof(rx));
+		ADNS_plan_pipeline(&plan, addr, val, 6);
+		ret = adns_plan_exec(s, &plan);
+		if (ret < 1) return ret;
+
+		decode_motion_burst(s, rx);
+		s->adns.frame_period 	= (val[0] << 8) | val[1];
+		s->adns.product_ID		= val[2];
+		s->adns.revision		= val[3];
+		s->adns.pixel_sum		= val[4];
+		s->adns.inv_product_ID	= val[5];
+	} else if (s->read_mode == ADNS_READ_PLANNED) {
+		adns_plan_t plan;
+		uint8_t rx[7];
+
+		adns_plan_init(s, &plan);
+		ADNS_plan_burst(&plan, 0x50, rx, sizeof(rx));
+		ADNS_plan_read(&plan, 0x11, &_valUpper);
+		ADNS_plan_read(&plan, 0x10, &_valLower);
+		ADNS_plan_read(&plan, 0x00, &(s->adns.product_ID));
+		ADNS_plan_read(&plan, 0x01, &(s->adns.revision));
+		ADNS_plan_read(&plan, 0x06, &(s->adns.pixel_sum));
+		ADNS_plan_read(&plan, 0x3f, &(s->adns.inv_product_ID));
+		ret = adns_plan_exec(s, &plan);
+		if (ret < 1) return ret;
+
+		decode_motion_burst(s, rx);
+		s->adns.frame_period 	= (_valUpper << 8) | _valLower;
+	} else {
+		// read motion, delta_X, delta_Y, squal, shutter, maximum_pixel
+		ret = adns_read_motion_burst(s);
+		if (ret < 1) return ret;
+
+		ret = SPI_read_byte(s, 0x11, &_valUpper);
+		if (ret < 1) return ret;
+		ret = SPI_read_byte(s, 0x10, &_valLower);
+		if (ret < 1) return ret;
+		s->adns.frame_period 	= (_valUpper << 8) | _valLower;
+
+		// read product id
+		ret = SPI_read_byte(s, 0x00, &(s->adns.product_ID));
+		if (ret < 1) return ret;
+		
+		// read revision
+		ret = SPI_read_byte(s, 0x01, &(s->adns.revision));
+		if (ret < 1) return ret;
+		
+		// read pixel_sum
+		ret = SPI_read_byte(s, 0x06, &(s->adns.pixel_sum));
+		if (ret < 1) return ret;
+		
+		// read inv_product_ID
+		ret = SPI_read_byte(s, 0x3f, &(s->adns.inv_product_ID));
+		if (ret < 1) return ret;
 	}
 	
+	TRACE(TRACE_INFO, TRACE_REGISTERS, s->adns.product_ID | (s->adns.inv_product_ID << 8) | (s->adns.revision << 16),
+		s->adns.pixel_sum, s->adns.frame_period, 0);
+
 	return ret;
 }
 
-int ADNS_get_FPS_bounds(int fd) {
+// n registers in one message as far as the read mode allows
+static int read_registers(adns_t *s, const uint8_t *addr, uint8_t *val, int n) {
+	adns_plan_t plan;
+	int ret = 0, i;
+
+	if (s->read_mode == ADNS_READ_PIPELINED) {
+		adns_plan_init(s, &plan);
+		ADNS_plan_pipeline(&plan, addr, val, n);
+		return adns_plan_exec(s, &plan);
+	} else if (s->read_mode == ADNS_READ_PLANNED) {
+		adns_plan_init(s, &plan);
+		for (i = 0; i < n; i++) ADNS_plan_read(&plan, addr[i], &val[i]);
+		return adns_plan_exec(s, &plan);
+	}
+	for (i = 0; i < n; i++) {
+		ret = SPI_read_byte(s, addr[i], &val[i]);
+		if (ret < 1) return ret;
+	}
+	return ret;
+}
+
+int adns_get_FPS_bounds(adns_t *s) {
 	int ret;
 
-	if (verbose) printf("get frame period and shutter bounds\n");
+	// upper and lower bytes of frame period max, min and shutter max
+	uint8_t val[6];
+	static const uint8_t addr[6] = {0x1a, 0x19, 0x1c, 0x1b, 0x1e, 0x1d};
 
-	// read frame period max
-	uint8_t _valLower;
-	uint8_t _valUpper;
-	ret = SPI_read_byte(fd, 0x1a, &_valUpper);
-	if (ret < 1) return ret;
-	ret = SPI_read_byte(fd, 0x19, &_valLower);
+	ret = read_registers(s, addr, val, 6);
 	if (ret < 1) return ret;
-	adns.frame_period_max = (_valUpper << 8) | _valLower;
+	s->adns.frame_period_max = (val[0] << 8) | val[1];
+	s->adns.frame_period_min = (val[2] << 8) | val[3];
+	s->adns.shutter_max = (val[4] << 8) | val[5];
         
-	// read frame period min
-	ret = SPI_read_byte(fd, 0x1c, &_valUpper);
+	TRACE(TRACE_INFO, TRACE_FPS_BOUNDS, s->adns.frame_period_max, s->adns.frame_period_min, s->adns.shutter_max, 0);
+
+	return ret;
+}
+
+int adns_write_FPS_bounds(adns_t *s) {
+	int ret;
+
+	uint8_t fpmaxbl	= s->adns.frame_period_max;
+	uint8_t fpmaxbu	= s->adns.frame_period_max >> 8;
+	uint8_t fpminbl	= s->adns.frame_period_min;
+	uint8_t fpminbu = s->adns.frame_period_min >> 8;
+	uint8_t smaxbl 	= s->adns.shutter_max;
+	uint8_t smaxbu 	= s->adns.shutter_max >> 8;
+
+	if (s->read_mode != ADNS_READ_SINGLE) {
+		adns_plan_t plan;
+
+		adns_plan_init(s, &plan);
+		// disable automatic shutter mode, enable fixed frame rate
+		ADNS_plan_write(&plan, 0x0b, 0x03);
+		ADNS_plan_write(&plan, 0x1b, fpminbl);
+		ADNS_plan_write(&plan, 0x1c, fpminbu);
+		ADNS_plan_write(&plan, 0x1d, smaxbl);
+		ADNS_plan_write(&plan, 0x1e, smaxbu);
+		// frame period max upper byte activates the bounds, keep it last
+		ADNS_plan_write(&plan, 0x19, fpmaxbl);
+		ADNS_plan_write(&plan, 0x1a, fpmaxbu);
+		return adns_plan_exec(s, &plan);
+	}
+
+	// disable automatic shutter mode
+	// enable fixed frame rate
+	adns_set_ext_conf(s, 0x03);
+
+	// set frame period min
+	ret = SPI_write_byte(s, 0x80 | 0x1b, fpminbl);
 	if (ret < 1) return ret;
-	ret = SPI_read_byte(fd, 0x1b, &_valLower);
+	ret = SPI_write_byte(s, 0x80 | 0x1c, fpminbu);
 	if (ret < 1) return ret;
-	adns.frame_period_min = (_valUpper << 8) | _valLower;
-        
-	// read shutter max
-	ret = SPI_read_byte(fd, 0x1e, &_valUpper);
+
+	// set shutter max
+	ret = SPI_write_byte(s, 0x80 | 0x1d, smaxbl);
 	if (ret < 1) return ret;
-	ret = SPI_read_byte(fd, 0x1d, &_valLower);
+	ret = SPI_write_byte(s, 0x80 | 0x1e, smaxbu);
 	if (ret < 1) return ret;
-	adns.shutter_max = (_valUpper << 8) | _valLower;
-        
-	if (verbose) {
-		printf("\tframe_period_max %d\n", adns.frame_period_max);
-		printf("\tframe_period_min %d\n", adns.frame_period_min);
-		printf("\tshutter_max %d\n", adns.shutter_max);
-	}
-	
-	return ret;
-}
 
-int ADNS_set_FPS_bounds(int fd, int shutter) {
-	int ret;
-        
-	if (verbose) printf("set frame period bounds for max shutter of %d\n", shutter);
-
-	adns.shutter_max	= shutter;
-	adns.frame_period_min	= 0x0e7e;
-	adns.frame_period_max	= adns.frame_period_min	+ shutter;
-
-	uint8_t fpmaxbl	= adns.frame_period_max;
-	uint8_t fpmaxbu	= adns.frame_period_max >> 8;
-	uint8_t fpminbl	= adns.frame_period_min;
-	uint8_t fpminbu = adns.frame_period_min >> 8;
-	uint8_t smaxbl 	= adns.shutter_max;
-	uint8_t smaxbu 	= adns.shutter_max >> 8;
-
-	int unsuccessful_change_count = 0;
-	do {
-		// wait for sensor to be ready
-		int busy_count = 0;
-		int _verbose = verbose;
-		verbose = 0;
-		do {
-			ADNS_get_ext_conf(fd);
-			busy_count++;
-//			usleep(100000);
-		} while (adns.ext_config.busy && (busy_count < 1000));
-		verbose = _verbose;
-
-		if (adns.ext_config.busy) {
-			printf("\twarning: sensor busy!\n");
-		}
+	// set frame period maximum
+	// - needs to be the last of the 3 registers to be written to
+	// - write activates all new values of the 3 registers
+	ret = SPI_write_byte(s, 0x80 | 0x19, fpmaxbl);
+	if (ret < 1) return ret;
+//	usleep(100000);
+	ret = SPI_write_byte(s, 0x80 | 0x1a, fpmaxbu);
 
-		// disable automatic shutter mode
-		// enable fixed frame rate
-		ADNS_set_ext_conf(fd, 0x03);
+	return ret;
+}
 
-		// set frame period min
-		ret = SPI_write_byte(fd, 0x80 | 0x1b, fpminbl);
-		if (ret < 1) return ret;
-		ret = SPI_write_byte(fd, 0x80 | 0x1c, fpminbu);
-		if (ret < 1) return ret;
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-		// set shutter max
-		ret = SPI_write_byte(fd, 0x80 | 0x1d, smaxbl);
-		if (ret < 1) return ret;
-		ret = SPI_write_byte(fd, 0x80 | 0x1e, smaxbu);
+/*
+ * write the bounds in adns and wait until the sensor runs with them
+ *
+ * The sensor ignores bound writes while busy and takes the new bounds
+ * over after the running frames, so all waits are frame periods at the
+ * period read from the sensor. One batched readback checks that the
+ * write landed (bound registers), that the sensor is done (busy) and
+ * that it exposes with the new bound (shutter, fixed in this mode).
+ * Returns > 0 when verified, 0 if the sensor did not take the bounds.
+ */
+int adns_apply_FPS_bounds(adns_t *s, adns_apply_t *a) {
+	// ext_config, frame period, bounds as in ADNS_get_FPS_bounds, shutter; upper bytes first
+	static const uint8_t addr[11] = {0x0b, 0x11, 0x10, 0x1a, 0x19, 0x1c, 0x1b, 0x1e, 0x1d, 0x0f, 0x0e};
+	uint16_t fp_max = s->adns.frame_period_max, fp_min = s->adns.frame_period_min, shutter_max = s->adns.shutter_max;
+	adns_apply_t own = {0};
+	uint64_t t0 = now_ns();
+	uint8_t val[11];
+	uint16_t period;
+	int ret, busy;
+
+	if (a == NULL) a = &own;
+	memset(a, 0, sizeof(*a));
+
+	while (a->writes < ADNS_APPLY_WRITES) {
+		// bounds written while busy would be lost
+		do {
+			ret = read_registers(s, addr, val, 5);
+			if (ret < 1) return ret;
+			busy = val[0] & 0x80;
+			if (busy) usleep(ADNS_FRAME_US((val[1] << 8) | val[2]));
+		} while (busy && (++a->polls < ADNS_APPLY_POLLS));
+		// the write fixes the frame rate, at the bound still active
+		period = (val[3] << 8) | val[4];
+
+		s->adns.frame_period_max = fp_max;
+		s->adns.frame_period_min = fp_min;
+		s->adns.shutter_max = shutter_max;
+		ret = adns_write_FPS_bounds(s);
 		if (ret < 1) return ret;
+		a->writes++;
+
+		// taken over after the running frame and the one started meanwhile
+		usleep(2 * ADNS_FRAME_US(period));
+		while (a->reads < ADNS_APPLY_READS) {
+			ret = read_registers(s, addr, val, 11);
+			if (ret < 1) return ret;
+			a->reads++;
+
+			s->adns.ext_config_val = val[0];
+			s->adns.frame_period = (val[1] << 8) | val[2];
+			s->adns.shutter = (val[9] << 8) | val[10];
+			if ((((val[3] << 8) | val[4]) != fp_max) || (((val[5] << 8) | val[6]) != fp_min)
+					|| (((val[7] << 8) | val[8]) != shutter_max)) {
+				// ignored, write again
+				break;
+			}
+			if (!s->adns.ext_config.busy && (s->adns.shutter == shutter_max)) {
+				a->t_us = (now_ns() - t0) / 1000;
+				return ret;
+			}
+			usleep(ADNS_FRAME_US(s->adns.frame_period));
+		}
+		if (a->reads >= ADNS_APPLY_READS) break;
+	}
+	a->t_us = (now_ns() - t0) / 1000;
+	return 0;
+}
 
-		// set frame period maximum
-		// - needs to be the last of the 3 registers to be written to
-		// - write activates all new values of the 3 registers
-		ret = SPI_write_byte(fd, 0x80 | 0x19, fpmaxbl);
-		if (ret < 1) return ret;
-//		usleep(100000);
-		ret = SPI_write_byte(fd, 0x80 | 0x1a, fpmaxbu);
-		if (ret < 1) return ret;
+int adns_set_FPS_bounds(adns_t *s, int shutter, adns_apply_t *a) {
+	adns_apply_t own;
+	int ret, ext;
 
-		// sensor needs some time to implement the new settings
-		usleep(100000);
+	if (a == NULL) a = &own;
 
-		// check for new settings to be active
-		ADNS_read_motion_burst(fd);
-	
-		unsuccessful_change_count++;
+	s->adns.shutter_max	= shutter;
+	s->adns.frame_period_min	= 0x0e7e;
+	s->adns.frame_period_max	= s->adns.frame_period_min	+ shutter;
 
-	} while ((adns.shutter_max != adns.shutter) && (unsuccessful_change_count < 100));
-	printf("needed %d try(s) to implement new setting\n", unsuccessful_change_count);
+	ret = adns_apply_FPS_bounds(s, a);
+	TRACE(TRACE_INFO, TRACE_FPS_SET, shutter, a->writes, a->reads, a->t_us);
+	if (ret < 0) return ret;
+	if (ret == 0) printf("\twarning: can't implement new setting!\n");
 
 	// enable automatic shutter mode
 	// disable fixed frame rate
-	ADNS_set_ext_conf(fd, 0x00);
+	ext = adns_set_ext_conf(s, 0x00);
+	return ret ? ext : 0;
+}
 
-	if (adns.shutter_max != adns.shutter) {
-		printf("\twarning: can't implement new setting!\n");
-	}
+int adns_get_ext_conf(adns_t *s) {
+	int ret;
 
+	ret = SPI_read_byte(s, 0x0b, &(s->adns.ext_config_val));
+	if (ret < 1) return ret;
+
+	TRACE(TRACE_DEBUG, TRACE_EXT_CONF, s->adns.ext_config_val, 0, 0, 0);
 	return ret;
 }
 
-int ADNS_get_ext_conf(int fd) {
+int adns_set_ext_conf(adns_t *s, uint8_t config) {
 	int ret;
+	
+	TRACE(TRACE_INFO, TRACE_SET_EXT_CONF, config, 0, 0, 0);
 
-	if (verbose) printf("get extended configuration\n");
+	ret = SPI_write_byte(s, 0x80 | 0x0b, config);
 
-	ret = SPI_read_byte(fd, 0x0b, &(adns.ext_config_val));
-	if (ret < 1) return ret;
-        
-	if (verbose) {
-		printf("\tbusy %d\n", adns.ext_config.busy);
-		printf("\tNPU %d\n", adns.ext_config.Serial_NPU);
-		printf("\tNAGC %d\n", adns.ext_config.NAGC);
-		printf("\tfixed FR %d\n", adns.ext_config.Fixed_FR);
-	}
-	
 	return ret;
 }
 
-int ADNS_set_ext_conf(int fd, uint8_t config) {
+int adns_set_conf(adns_t *s, uint8_t config) {
 	int ret;
 	
-	if (verbose) printf("set extended configuration byte: %.2x\n", config);
+	TRACE(TRACE_INFO, TRACE_SET_CONF, config, 0, 0, 0);
 
-	ret = SPI_write_byte(fd, 0x80 | 0x0b, config);
+	ret = SPI_write_byte(s, 0x80 | 0x0a, config);
 
 	return ret;
 }
 
-int ADNS_set_conf(int fd, uint8_t config) {
-	int ret;
-	
-	if (verbose) printf("set configuration byte: %.2x\n", config);
+/*
+ * the fd API of the single sensor: settings of the command line,
+ * registers in the global adns
+ */
+static adns_t legacy;
+
+static void defaults(adns_t *s) {
+	s->transport = transport;
+	s->device = device;
+	s->mode = mode;
+	s->bits = bits;
+	s->speed = speed;
+	s->delay = delay;
+	s->read_mode = read_mode;
+}
 
-	ret = SPI_write_byte(fd, 0x80 | 0x0a, config);
+static adns_t *enter(int fd) {
+	defaults(&legacy);
+	legacy.fd = fd;
+	legacy.adns = adns;
+	return &legacy;
+}
 
+static int leave(int ret) {
+	adns = legacy.adns;
 	return ret;
 }
 
+int ADNS_read_motion_burst(int fd) { return leave(adns_read_motion_burst(enter(fd))); }
+int ADNS_read_frame_burst(int fd, uint8_t *frame) { return leave(adns_read_frame_burst(enter(fd), frame)); }
+int ADNS_capture_frame(int fd, uint8_t *frame, pixel_stats_t *st) {
+	return leave(adns_capture_frame(enter(fd), frame, st));
+}
+int ADNS_read_all(int fd) { return leave(adns_read_all(enter(fd))); }
+int ADNS_get_FPS_bounds(int fd) { return leave(adns_get_FPS_bounds(enter(fd))); }
+int ADNS_set_FPS_bounds(int fd, int shutter, adns_apply_t *a) {
+	return leave(adns_set_FPS_bounds(enter(fd), shutter, a));
+}
+int ADNS_apply_FPS_bounds(int fd, adns_apply_t *a) { return leave(adns_apply_FPS_bounds(enter(fd), a)); }
+int ADNS_write_FPS_bounds(int fd) { return leave(adns_write_FPS_bounds(enter(fd))); }
+int ADNS_get_ext_conf(int fd) { return leave(adns_get_ext_conf(enter(fd))); }
+int ADNS_set_ext_conf(int fd, uint8_t config) { return leave(adns_set_ext_conf(enter(fd), config)); }
+int ADNS_set_conf(int fd, uint8_t config) { return leave(adns_set_conf(enter(fd), config)); }
+void ADNS_plan_init(adns_plan_t *p) { adns_plan_init(enter(-1), p); }
+int ADNS_plan_exec(int fd, adns_plan_t *p) { return leave(adns_plan_exec(enter(fd), p)); }
+
+void ADNS_set_read_mode(adns_read_mode_t m) {
+	read_mode = m;
+}
+
+adns_read_mode_t ADNS_get_read_mode(void) {
+	return read_mode;
+}
+
 static void parse_opts(int argc, char *argv[])
 {
 	// reset getopt
@@ -442,11 +722,15 @@ static void parse_opts(int argc, char *argv[])
 			{ "3wire",   0, 0, '3' },
 			{ "no-cs",   0, 0, 'N' },
 			{ "ready",   0, 0, 'R' },
+			{ "emulate", 0, 0, 'E' },
+			{ "emu-speed", 1, 0, 0x100 },
+			{ "emu-seed",  1, 0, 0x101 },
+			{ "read-mode", 1, 0, 0x102 },
 			{ NULL, 0, 0, 0 },
 		};
 
 		int c;
-		c = getopt_long(argc, argv, "d:b:D:s:CHlLNORvw3", lopts, NULL);
+		c = getopt_long(argc, argv, "d:b:D:s:CEHlLNORvw3", lopts, NULL);
 
 		if (c == -1)
 			break;
@@ -454,9 +738,11 @@ static void parse_opts(int argc, char *argv[])
 		switch (c) {
 		case 'w':
 			verbose = 2;
+			trace_set_level(TRACE_DEBUG);
 			break;
 		case 'v':
 			verbose = 1;
+			trace_set_level(TRACE_INFO);
 			break;
 		case 'D':
 			device = optarg;
@@ -494,60 +780,123 @@ static void parse_opts(int argc, char *argv[])
 		case 'R':
 			mode |= SPI_READY;
 			break;
+		case 'E':
+			transport = &spi_transport_emu;
+			break;
+		case 0x100: {
+			char *end;
+			emu_speed_x = strtol(optarg, &end, 0);
+			emu_speed_y = (*end == ',') ? strtol(end + 1, NULL, 0) : 0;
+			break;
+		}
+		case 0x101:
+			emu_seed = strtoul(optarg, NULL, 0);
+			break;
+		case 0x102:
+			if (strcmp(optarg, "single") == 0) read_mode = ADNS_READ_SINGLE;
+			else if (strcmp(optarg, "planned") == 0) read_mode = ADNS_READ_PLANNED;
+			else if (strcmp(optarg, "pipelined") == 0) read_mode = ADNS_READ_PIPELINED;
+			break;
 		default:;
 		}
 	}
 }
 
-int init_SPI(int* file, int argc, char *argv[]) {
+static int spidev_open(const char *device, uint8_t *mode, uint8_t *bits, uint32_t *speed) {
 	int ret;
 	int fd;
 
-	parse_opts(argc, argv); 
-
 	fd = open(device, O_RDWR);
 	if (fd < 0)
-		pabort("can't open device");
+		return fd;
 
 	/*
 	 * spi mode
 	 */
-	ret = ioctl(fd, SPI_IOC_WR_MODE, &mode);
+	ret = ioctl(fd, SPI_IOC_WR_MODE, mode);
 	if (ret == -1)
 		pabort("can't set spi mode");
 
-	ret = ioctl(fd, SPI_IOC_RD_MODE, &mode);
+	ret = ioctl(fd, SPI_IOC_RD_MODE, mode);
 	if (ret == -1)
 		pabort("can't get spi mode");
 
 	/*
 	 * bits per word
 	 */
-	ret = ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
+	ret = ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, bits);
 	if (ret == -1)
 		pabort("can't set bits per word");
 
-	ret = ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &bits);
+	ret = ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, bits);
 	if (ret == -1)
 		pabort("can't get bits per word");
 
 	/*
 	 * max speed hz
 	 */
-	ret = ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
+	ret = ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, speed);
 	if (ret == -1)
 		pabort("can't set max speed hz");
 
-	ret = ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed);
+	ret = ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, speed);
 	if (ret == -1)
 		pabort("can't get max speed hz");
 
+	return fd;
+}
+
+static int spidev_message(int fd, struct spi_ioc_transfer *tr, unsigned int n) {
+	return ioctl(fd, SPI_IOC_MESSAGE(n), tr);
+}
+
+static void spidev_close(int fd) {
+	close(fd);
+}
+
+const spi_transport_t spi_transport_spidev = {
+	.name = "spidev",
+	.open = spidev_open,
+	.message = spidev_message,
+	.close = spidev_close,
+};
+
+void adns_parse_opts(int argc, char *argv[]) {
+	parse_opts(argc, argv);
+
+	if (transport == &spi_transport_emu)
+		ADNS_emu_defaults(emu_speed_x, emu_speed_y, emu_seed);
+}
+
+int adns_open(adns_t *s, const char *dev) {
+	memset(s, 0, sizeof(*s));
+	defaults(s);
+	s->device = dev;
+	s->fd = s->transport->open(dev, &s->mode, &s->bits, &s->speed);
+	return (s->fd < 0) ? -1 : 0;
+}
+
+void adns_close(adns_t *s) {
+	s->transport->close(s->fd);
+	s->fd = -1;
+}
+
+int init_SPI(int* file, int argc, char *argv[]) {
+	int fd;
+
+	adns_parse_opts(argc, argv);
+
+	fd = transport->open(device, &mode, &bits, &speed);
+	if (fd < 0)
+		pabort("can't open device");
+
 	if (verbose > 1) {
+		printf("spi transport: %s\n", transport->name);
 		printf("spi mode: %d\n", mode);
 		printf("bits per word: %d\n", bits);
 		printf("max speed: %d Hz (%d KHz)\n", speed, speed/1000);
 	}
 	
 	*file = fd;
-	return ret;
+	return 0;
 }
@@ -4,6 +4,45 @@
 
 #ifndef ADNS_H_
 #define ADNS_H_
+#include <stdint.h>
+#include <linux/spi/spidev.h>
+
+#include "pixel.h"
+#include "spi-transport.h"
+
+// register timing in usec
+#define ADNS_T_SRR		1	// read to next access (250 ns)
+#define ADNS_T_SWW		50	// write to next access
+#define ADNS_T_BEXIT	4	// burst exit
+
+#define ADNS_PLAN_MAX	32	// register accesses per planned message
+
+#define ADNS_FRAME_PIXELS	900	// 30 x 30
+
+// frame period in 24 MHz clocks to us, rounded up
+#define ADNS_FRAME_US(period)	(((uint32_t)(period) + 23) / 24)
+
+// limits of ADNS_apply_FPS_bounds
+#define ADNS_APPLY_POLLS	16	// frames waiting for busy before a write
+#define ADNS_APPLY_WRITES	4	// writes the sensor may ignore
+#define ADNS_APPLY_READS	8	// frames waiting for the bounds to take effect
+
+typedef enum {
+	ADNS_READ_SINGLE,		// one SPI message per register
+	ADNS_READ_PLANNED,		// all registers in one SPI message
+	ADNS_READ_PIPELINED		// as planned, reads pipelined full-duplex
+} adns_read_mode_t;
+
+typedef struct {
+	struct spi_ioc_transfer tr[2 * ADNS_PLAN_MAX];
+	uint8_t tx[ADNS_PLAN_MAX][2];
+	int ops;
+	int n;
+	// of the sensor the plan is for
+	uint32_t speed;
+	uint8_t bits;
+	uint16_t delay;
+} adns_plan_t;
 
 typedef struct {
 	uint8_t product_ID;
@@ -42,15 +81,73 @@ typedef struct {
 } adns3080_t;
 extern adns3080_t adns;
 
+/*
+ * one sensor: its bus, settings and the registers of the last access,
+ * sensors on different buses can be used from different threads
+ */
+typedef struct {
+	int fd;
+	const spi_transport_t *transport;
+	const char *device;
+	uint8_t mode;
+	uint8_t bits;
+	uint16_t delay;
+	uint32_t speed;
+	adns_read_mode_t read_mode;
+	adns3080_t adns;
+} adns_t;
+
+typedef struct {
+	uint32_t t_us;			// from the first busy poll to the verified readback
+	int polls;				// busy polls before writing
+	int writes;				// > 1 if the sensor ignored a write
+	int reads;				// readbacks until active
+} adns_apply_t;
+
+// settings of new sensors from the command line, before adns_open
+void adns_parse_opts(int argc, char *argv[]);
+int adns_open(adns_t *s, const char *device);
+void adns_close(adns_t *s);
+
+int adns_read_motion_burst(adns_t *s);
+int adns_read_frame_burst(adns_t *s, uint8_t *frame);
+int adns_capture_frame(adns_t *s, uint8_t *frame, pixel_stats_t *st);
+int adns_read_all(adns_t *s);
+int adns_get_FPS_bounds(adns_t *s);
+// a may be NULL
+int adns_set_FPS_bounds(adns_t *s, int shutter, adns_apply_t *a);
+int adns_apply_FPS_bounds(adns_t *s, adns_apply_t *a);
+int adns_write_FPS_bounds(adns_t *s);
+int adns_get_ext_conf(adns_t *s);
+int adns_set_ext_conf(adns_t *s, uint8_t config);
+int adns_set_conf(adns_t *s, uint8_t config);
+void adns_plan_init(const adns_t *s, adns_plan_t *p);
+int adns_plan_exec(adns_t *s, adns_plan_t *p);
+
+// the sensor of init_SPI, registers in adns
 int ADNS_read_motion_burst(int fd);
 int ADNS_read_frame_burst(int fd, uint8_t * frame);
+int ADNS_capture_frame(int fd, uint8_t *frame, pixel_stats_t *st);
 int ADNS_read_all(int fd);
 int ADNS_get_FPS_bounds(int fd);
-int ADNS_set_FPS_bounds(int fd, int shutter);
+// a may be NULL
+int ADNS_set_FPS_bounds(int fd, int shutter, adns_apply_t *a);
+int ADNS_apply_FPS_bounds(int fd, adns_apply_t *a);
+int ADNS_write_FPS_bounds(int fd);
 int ADNS_get_ext_conf(int fd);
 int ADNS_set_ext_conf(int fd, uint8_t config);
 int ADNS_set_conf(int fd, uint8_t config);
 
+void ADNS_plan_init(adns_plan_t *p);
+int ADNS_plan_read(adns_plan_t *p, uint8_t addr, uint8_t *value);
+int ADNS_plan_burst(adns_plan_t *p, uint8_t addr, uint8_t *buf, int len);
+int ADNS_plan_pipeline(adns_plan_t *p, const uint8_t *addr, uint8_t *value, int n);
+int ADNS_plan_write(adns_plan_t *p, uint8_t addr, uint8_t value);
+int ADNS_plan_exec(int fd, adns_plan_t *p);
+
+void ADNS_set_read_mode(adns_read_mode_t m);
+adns_read_mode_t ADNS_get_read_mode(void);
+
 int init_SPI(int* file, int argc, char *argv[]);
 
 #endif /* ADNS_H_ */
@@ -0,0 +1,155 @@
+/*
+ * aux.c
+ *
+ * The i2c bus is much slower than the SPI motion read, so the servo and
+ * brightness registers are read on a thread of their own at their own
+ * rate, every read stamped at its midpoint. The acquisition thread keeps
+ * the last AUX_HISTORY of them and fills each motion sample from the aux
+ * samples around its timestamp, the nearest or both interpolated.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "aux.h"
+#include "i2c.h"
+
+// servo and bright[0..3], the brightness words are read in one burst
+static const uint8_t regs[AUX_CHANNELS] = { 0x32, 0x76, 0x78, 0x72, 0x74 };
+
+static void *aux_thread(void *arg) {
+	aux_t *a = arg;
+
+	while (atomic_load_explicit(&a->running, memory_order_acquire)) {
+		aux_sample_t *s = ring_reserve(&a->ring);
+		aux_sample_t tmp;
+		uint64_t ta, tb;
+		int i;
+
+		if (s == NULL) {
+			a->overruns++;
+			s = &tmp;
+		}
+		ta = sched_now_raw();
+		s->ok = (i2cBatchRead(&a->batch) == 0);
+		tb = sched_now_raw();
+		s->t_ns = ta + (tb - ta) / 2;
+		s->i2c_ns = tb - ta;
+		for (i = 0; i < AUX_CHANNELS; i++) s->val[i] = s->ok ? i2cBatchValue(&a->batch, i) : 0xffff;
+		if (!s->ok) a->failed++;
+		if (s != &tmp) ring_commit(&a->ring);
+
+		sched_wait(&a->sched);
+	}
+	return NULL;
+}
+
+int aux_start(aux_t *a, double rate, int mode) {
+	int i;
+
+	memset(a, 0, sizeof(*a));
+	a->rate = rate;
+	a->mode = mode;
+	a->max_wait_ns = AUX_MAX_WAIT * 1E9 / rate;
+	i2cBatchInit(&a->batch);
+	for (i = 0; i < AUX_CHANNELS; i++) i2cBatchAdd(&a->batch, regs[i], 2);
+	if (i2cBatchPlan(&a->batch) < 1) return -1;
+
+	if (sched_init(&a->sched, rate) != 0) return -1;
+	if (ring_init(&a->ring, sizeof(aux_sample_t), AUX_CAPACITY) != 0) return -1;
+	atomic_store(&a->running, 1);
+	if (pthread_create(&a->thread, NULL, aux_thread, a) != 0) {
+		ring_free(&a->ring);
+		return -1;
+	}
+	return 0;
+}
+
+void aux_stop(aux_t *a) {
+	atomic_store_explicit(&a->running, 0, memory_order_release);
+	pthread_join(a->thread, NULL);
+	ring_free(&a->ring);
+}
+
+static const aux_sample_t *hist(const aux_t *a, uint64_t k) {
+	return &a->hist[k % AUX_HISTORY];
+}
+
+// take over what the aux thread read since
+static void aux_poll(aux_t *a) {
+	uint32_t n, i;
+	void *p;
+
+	while ((n = ring_peek(&a->ring, &p)) > 0) {
+		for (i = 0; i < n; i++) a->hist[(a->received + i) % AUX_HISTORY] = ((aux_sample_t *)p)[i];
+		ring_release(&a->ring, n);
+		a->received += n;
+	}
+}
+
+static void take(sample_t *s, const aux_sample_t *x, uint64_t t_raw) {
+	s->servo = x->val[0];
+	memcpy(s->bright, &x->val[1], sizeof(s->bright));
+	s->i2c_ofs_ns = (int64_t)x->t_ns - (int64_t)t_raw;
+	s->i2c_ns = x->i2c_ns;
+}
+
+int aux_merge(aux_t *a, uint64_t t_raw, sample_t *s, int force) {
+	const aux_sample_t *before = NULL, *after = NULL;
+	uint64_t k, oldest;
+	int i;
+
+	aux_poll(a);
+	if (a->received == 0) {
+		if (!force) return 0;
+		s->servo = 0xffff;
+		memset(s->bright, 0xff, sizeof(s->bright));
+		a->merged++;
+		a->forced++;
+		return 1;
+	}
+	if ((hist(a, a->received - 1)->t_ns < t_raw) && !force) return 0;
+
+	// the newest aux sample at or before t_raw and the one after it
+	oldest = (a->received > AUX_HISTORY) ? a->received - AUX_HISTORY : 0;
+	for (k = a->received; k > oldest; k--) {
+		if (hist(a, k - 1)->t_ns <= t_raw) {
+			before = hist(a, k - 1);
+			break;
+		}
+		after = hist(a, k - 1);
+	}
+	if (after == NULL) a->forced++;
+	a->merged++;
+
+	if ((before == NULL) || (after == NULL)) {
+		take(s, before ? before : after, t_raw);
+		return 1;
+	}
+	if (!before->ok || !after->ok) {
+		take(s, before->ok ? before : after, t_raw);
+		return 1;
+	}
+
+	// the values of the nearer one, its offset and duration in either mode
+	take(s, (t_raw - before->t_ns <= after->t_ns - t_raw) ? before : after, t_raw);
+	if ((a->mode == AUX_INTERPOLATE) && (after->t_ns > before->t_ns)) {
+		double f = (double)(t_raw - before->t_ns) / (after->t_ns - before->t_ns);
+		uint16_t v[AUX_CHANNELS];
+
+		for (i = 0; i < AUX_CHANNELS; i++) v[i] = before->val[i] + f * ((int)after->val[i] - before->val[i]) + 0.5;
+		s->servo = v[0];
+		memcpy(s->bright, &v[1], sizeof(s->bright));
+	}
+	return 1;
+}
+
+void aux_report(const aux_t *a, FILE *f) {
+	fprintf(f, "\ti2c: %llu samples at %.1f Hz, %llu failed, %llu overruns, %llu merged (%s), %llu without a later sample\n",
+		(unsigned long long)a->received, a->rate, (unsigned long long)a->failed, (unsigned long long)a->overruns,
+		(unsigned long long)a->merged, (a->mode == AUX_INTERPOLATE) ? "interpolated" : "nearest",
+		(unsigned long long)a->forced);
+}
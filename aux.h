@@ -0,0 +1,68 @@
+/*
+ * aux.h
+ *
+ * i2c servo and brightness channels sampled on their own thread, merged
+ * into the motion samples by time
+ */
+
+#ifndef AUX_H_
+#define AUX_H_
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "i2c.h"
+#include "ring.h"
+#include "sample.h"
+#include "sched.h"
+
+#define AUX_RATE		50		// Hz, default of --i2c-rate
+#define AUX_CHANNELS	5		// servo, bright[0..3]
+#define AUX_CAPACITY	256		// samples between the threads
+#define AUX_HISTORY		16		// kept by the consumer to merge from
+#define AUX_MAX_WAIT	4		// aux periods a motion sample waits for a later aux sample
+
+enum {
+	AUX_NEAREST,
+	AUX_INTERPOLATE
+};
+
+typedef struct {
+	uint64_t t_ns;			// midpoint of the i2c read, CLOCK_MONOTONIC_RAW
+	uint32_t i2c_ns;
+	uint16_t val[AUX_CHANNELS];
+	uint8_t ok;
+} aux_sample_t;
+
+typedef struct {
+	ring_t ring;
+	pthread_t thread;
+	atomic_int running;
+	double rate;
+	int mode;
+	uint64_t max_wait_ns;
+
+	// producer side
+	i2c_batch_t batch;
+	sched_t sched;
+	uint64_t failed;
+	uint64_t overruns;
+
+	// consumer side
+	aux_sample_t hist[AUX_HISTORY];
+	uint64_t received;
+	uint64_t merged;
+	uint64_t forced;		// merged without a later aux sample
+} aux_t;
+
+int aux_start(aux_t *a, double rate, int mode);
+void aux_stop(aux_t *a);
+/*
+ * fills the i2c fields of s from the aux samples around t_raw, returns
+ * 0 while no aux sample at or after t_raw has arrived unless forced
+ */
+int aux_merge(aux_t *a, uint64_t t_raw, sample_t *s, int force);
+void aux_report(const aux_t *a, FILE *f);
+
+#endif /* AUX_H_ */
@@ -0,0 +1,993 @@
+/*
+ * bench.c
+ *
+ * hot path benchmarks against the emulated sensor, plus correctness
+ * checks of the kernels they time
+ *
+ * Every benchmark runs a warm up round and BENCH_ROUNDS timed rounds and
+ * reports the median, as ns/op, ops/s and heap allocations per op
+ * (malloc, calloc and realloc are wrapped at link time). For register
+ * access the wall time is host cost per operation, bus time the modelled
+ * SPI time incl. the transfer delays the sensor needs.
+ *
+ *	adns-bench				human readable
+ *	adns-bench -t			TSV results on stdout, notes on stderr
+ *	adns-bench -c base.tsv	flag results slower than a previous -t run
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "adns.h"
+#include "adns-emu.h"
+#include "aux.h"
+#include "flow.h"
+#include "framecodec.h"
+#include "i2c.h"
+#include "i2c-emu.h"
+#include "latency.h"
+#include "motion.h"
+#include "multi.h"
+#include "odometry.h"
+#include "pixel.h"
+#include "protocol.h"
+#include "recorder.h"
+#include "sample.h"
+#include "scene.h"
+#include "socket-server.h"
+#include "spi-transport.h"
+#include "trace.h"
+
+#define ITERATIONS		2000
+#define PIXEL_ITERATIONS	20000
+#define FLOW_FRAMES		1024
+#define BENCH_ROUNDS	5
+#define BENCH_TOLERANCE	1.25	// slower than the baseline by this is a regression
+#define BENCH_PORT		15999
+#define BASELINE_MAX	128
+#define MULTI_RUN_NS	300000000	// real time per multi-sensor run
+#define MOTION_RUN_NS	1000000000	// real time per sampling mode
+#define MOTION_RATE		1000		// Hz, polled and maximum event-driven
+
+typedef struct {
+	double ns;				// per op, median of the rounds
+	double allocs;			// per op, over all rounds
+} bench_result_t;
+
+typedef void (*bench_fn_t)(void);
+
+static int fd;
+static FILE *info;			// notes besides the results
+static int tsv;
+static int regressions;
+
+static struct {
+	char name[64];
+	double ns;
+} baseline[BASELINE_MAX];
+static int baselines;
+
+// allocation counting, see BENCH_LDFLAGS
+static atomic_ulong allocs;
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+	atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+	atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+	return __real_realloc(p, size);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// ops: operations done by one call of fn
+static bench_result_t measure(bench_fn_t fn, int iterations, int ops) {
+	double round[BENCH_ROUNDS];
+	bench_result_t r;
+	unsigned long a0;
+	int k, i;
+
+	for (i = 0; i < iterations; i++) fn();
+
+	a0 = atomic_load(&allocs);
+	for (k = 0; k < BENCH_ROUNDS; k++) {
+		uint64_t t0 = now_ns();
+		for (i = 0; i < iterations; i++) {
+			fn();
+			// keep the compiler from dropping the loop
+			__asm__ volatile("" : : : "memory");
+		}
+		round[k] = (double)(now_ns() - t0) / ((double)iterations * ops);
+	}
+	qsort(round, BENCH_ROUNDS, sizeof(double), cmp_double);
+	r.ns = round[BENCH_ROUNDS / 2];
+	r.allocs = (double)(atomic_load(&allocs) - a0) / ((double)BENCH_ROUNDS * iterations * ops);
+	return r;
+}
+
+static void load_baseline(const char *path) {
+	char line[256];
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	while ((baselines < BASELINE_MAX) && (fgets(line, sizeof(line), f) != NULL)) {
+		if (sscanf(line, "%63[^\t]\t%lf", baseline[baselines].name, &baseline[baselines].ns) == 2) baselines++;
+	}
+	fclose(f);
+}
+
+// extra: free form details, NULL if none
+static void report(const char *name, const bench_result_t *r, const char *extra) {
+	char change[64] = "";
+	const char *verdict = "";
+	int i;
+
+	for (i = 0; i < baselines; i++) {
+		if (strcmp(baseline[i].name, name) != 0) continue;
+		if (r->ns > baseline[i].ns * BENCH_TOLERANCE) {
+			verdict = tsv ? "\tREGRESSION" : "  REGRESSION";
+			regressions++;
+		}
+		snprintf(change, sizeof(change), "  %+6.1f%% to baseline", 100 * (r->ns / baseline[i].ns - 1));
+	}
+
+	if (tsv) {
+		printf("%s\t%.1f\t%.0f\t%.3f%s\n", name, r->ns, 1E9 / r->ns, r->allocs, verdict);
+	} else {
+		printf("%-32s %11.1f ns/op %12.0f ops/s %6.2f allocs/op%s%s%s%s\n", name, r->ns, 1E9 / r->ns, r->allocs,
+			extra ? "  " : "", extra ? extra : "", change, verdict);
+	}
+}
+
+static int write_bounds(int fd) {
+	int ret = ADNS_write_FPS_bounds(fd);
+	// let the sensor take over the bounds before the next write
+	ADNS_emu_advance(fd, 20000000);
+	return ret;
+}
+
+static int same_registers(const adns3080_t *a, const adns3080_t *b) {
+	return (a->product_ID == b->product_ID) && (a->inv_product_ID == b->inv_product_ID)
+		&& (a->revision == b->revision) && (a->frame_period == b->frame_period)
+		&& (a->frame_period_max == b->frame_period_max)
+		&& (a->frame_period_min == b->frame_period_min)
+		&& (a->shutter_max == b->shutter_max);
+}
+
+static void bench_reg(const char *name, bench_fn_t fn, int iterations) {
+	adns_emu_stats_t st;
+	bench_result_t r;
+	char extra[128];
+	int n = (BENCH_ROUNDS + 1) * iterations;
+
+	ADNS_emu_reset_stats(fd);
+	r = measure(fn, iterations, 1);
+	ADNS_emu_get_stats(fd, &st);
+
+	snprintf(extra, sizeof(extra), "%9.1f us bus/op %6.2f msg/op %7.1f bytes/op %6llu violations",
+		st.bus_ns / 1E3 / n, (double)st.messages / n, (double)st.bytes / n,
+		(unsigned long long)st.violations);
+	report(name, &r, extra);
+}
+
+static void read_all(void) { ADNS_read_all(fd); }
+static void get_bounds(void) { ADNS_get_FPS_bounds(fd); }
+static void write_bounds_op(void) { write_bounds(fd); }
+static void motion_burst(void) { ADNS_read_motion_burst(fd); }
+
+static int apply_toggle;
+static void apply_bounds(void) {
+	// between the shutter settings of testing.sh
+	if (ADNS_set_FPS_bounds(fd, (apply_toggle ^= 1) ? 9100 : 60000, NULL) < 1) {
+		fprintf(stderr, "error: frame period bounds not applied\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static uint8_t capture[ADNS_FRAME_PIXELS];
+static void capture_frame(void) { ADNS_capture_frame(fd, capture, NULL); }
+
+// the servo and brightness registers of a sample (recorder.c)
+static const uint8_t i2c_regs[5] = { 0x32, 0x76, 0x78, 0x72, 0x74 };
+static i2c_batch_t i2c_batch;
+static uint16_t i2c_val[5];
+
+static void i2c_single(void) {
+	int i;
+	for (i = 0; i < 5; i++) i2c_val[i] = i2cReadW(i2c_regs[i]);
+}
+
+static void i2c_batched(void) {
+	int i;
+	i2cBatchRead(&i2c_batch);
+	for (i = 0; i < 5; i++) i2c_val[i] = i2cBatchValue(&i2c_batch, i);
+}
+
+static void bench_i2c_op(const char *name, bench_fn_t fn) {
+	i2c_emu_stats_t st;
+	bench_result_t r;
+	char extra[128];
+	int n = (BENCH_ROUNDS + 1) * ITERATIONS;
+
+	I2C_emu_reset_stats(i2cFd());
+	r = measure(fn, ITERATIONS, 1);
+	I2C_emu_get_stats(i2cFd(), &st);
+	snprintf(extra, sizeof(extra), "%9.1f us bus/op %6.2f transfers/op %6.2f msg/op",
+		st.bus_ns / 1E3 / n, (double)st.transfers / n, (double)st.messages / n);
+	report(name, &r, extra);
+}
+
+static int bench_i2c(void) {
+	uint16_t single[5];
+	int i;
+
+	if (i2cInit(I2C_EMU_DEVICE, 0x18) != 0) return -1;
+	// deterministic: the servo stands still, time only advances with the bus
+	I2C_emu_set_realtime(i2cFd(), 0);
+	i2cWriteB(0x39, 0);
+	i2cWriteW(0x32, 1500);
+
+	i2cBatchInit(&i2c_batch);
+	for (i = 0; i < 5; i++) i2cBatchAdd(&i2c_batch, i2c_regs[i], 2);
+	// 0x32 and the contiguous brightness words 0x72-0x79
+	if (i2cBatchPlan(&i2c_batch) != 2) return -1;
+
+	i2c_single();
+	memcpy(single, i2c_val, sizeof(single));
+	i2c_batched();
+	if ((memcmp(single, i2c_val, sizeof(single)) != 0) || (single[0] != 1500)) return -1;
+
+	bench_i2c_op("i2c sample single reads", i2c_single);
+	bench_i2c_op("i2c sample batch", i2c_batched);
+	return 0;
+}
+
+static aux_t aux;
+static uint64_t aux_t_ns;
+static sample_t aux_merged;
+
+// motion at 200 Hz, i2c at 50 Hz as from the aux thread
+static void aux_step(void) {
+	aux_sample_t x = { aux_t_ns + 20000000, 1500000, { 100, 200, 300, 400, 500 }, 1 };
+	int k;
+
+	ring_push(&aux.ring, &x);
+	for (k = 0; k < 4; k++) aux_merge(&aux, aux_t_ns + k * 5000000, &aux_merged, 0);
+	aux_t_ns += 20000000;
+}
+
+static int bench_aux(void) {
+	aux_sample_t x[2] = { { 0, 1500000, { 0 }, 1 }, { 20000000, 1500000, { 200 }, 1 } };
+	bench_result_t r;
+	sample_t s;
+
+	// no thread, the bench produces the aux samples
+	if (ring_init(&aux.ring, sizeof(aux_sample_t), AUX_CAPACITY) != 0) return -1;
+	aux.mode = AUX_INTERPOLATE;
+	if (aux_merge(&aux, 5000000, &s, 0)) return -1;
+	ring_push(&aux.ring, &x[0]);
+	ring_push(&aux.ring, &x[1]);
+	if (!aux_merge(&aux, 5000000, &s, 0) || (s.servo != 50) || (s.i2c_ofs_ns != -5000000)) return -1;
+	aux.mode = AUX_NEAREST;
+	if (!aux_merge(&aux, 15000000, &s, 0) || (s.servo != 200)) return -1;
+
+	aux.mode = AUX_INTERPOLATE;
+	aux_t_ns = 40000000;
+	r = measure(aux_step, ITERATIONS * 10, 4);
+	report("i2c merge interpolated", &r, NULL);
+	ring_free(&aux.ring);
+	return 0;
+}
+
+static uint8_t frame[ADNS_FRAME_PIXELS];
+static uint8_t packed[PIXEL_PACKED_SIZE(ADNS_FRAME_PIXELS)];
+static uint8_t unpacked[ADNS_FRAME_PIXELS];
+
+static void bench_pixel(const char *name, bench_fn_t fn) {
+	bench_result_t r = measure(fn, PIXEL_ITERATIONS, 1);
+	char extra[32];
+
+	snprintf(extra, sizeof(extra), "%6.2f GB/s", ADNS_FRAME_PIXELS / r.ns);
+	report(name, &r, extra);
+}
+
+static uint8_t burst[ADNS_FRAME_PIXELS];
+static pixel_stats_t stats;
+static uint32_t hist[PIXEL_LEVELS];
+
+static void frame_scalar(void) { pixel_frame_scalar(burst, unpacked, ADNS_FRAME_PIXELS, &stats, NULL); }
+static void frame_best(void) { pixel_frame(burst, unpacked, ADNS_FRAME_PIXELS, &stats, NULL); }
+static void frame_hist_scalar(void) { pixel_frame_scalar(burst, unpacked, ADNS_FRAME_PIXELS, &stats, hist); }
+static void frame_hist_best(void) { pixel_frame(burst, unpacked, ADNS_FRAME_PIXELS, &stats, hist); }
+
+static void pack_scalar(void) { pixel_pack6_scalar(frame, packed, ADNS_FRAME_PIXELS); }
+static void pack_best(void) { pixel_pack6(frame, packed, ADNS_FRAME_PIXELS); }
+static void unpack_scalar(void) { pixel_unpack6_scalar(packed, unpacked, ADNS_FRAME_PIXELS); }
+static void unpack_best(void) { pixel_unpack6(packed, unpacked, ADNS_FRAME_PIXELS); }
+
+// the dispatched kernels have to match the scalar reference
+static int check_pixel(void) {
+	uint8_t ref[PIXEL_PACKED_SIZE(ADNS_FRAME_PIXELS)];
+	int i, n;
+
+	for (i = 0; i < ADNS_FRAME_PIXELS; i++) frame[i] = (i * 37 + (i >> 3)) & 0xff;
+	// every length the kernels may see, including the scalar tails
+	for (n = 0; n <= ADNS_FRAME_PIXELS; n += 4) {
+		memset(packed, 0, sizeof(packed));
+		pixel_pack6_scalar(frame, ref, n);
+		pixel_pack6(frame, packed, n);
+		if (memcmp(ref, packed, PIXEL_PACKED_SIZE(n)) != 0) return -1;
+		pixel_unpack6(packed, unpacked, n);
+		for (i = 0; i < n; i++) {
+			if (unpacked[i] != (frame[i] & 0x3f)) return -1;
+		}
+	}
+
+	// burst bytes with the valid bit, start of frame at varying places
+	for (n = 0; n <= ADNS_FRAME_PIXELS; n++) {
+		uint8_t ref_pixel[ADNS_FRAME_PIXELS];
+		uint32_t ref_hist[PIXEL_LEVELS];
+		pixel_stats_t ref;
+		int sof = (n * 7) % (ADNS_FRAME_PIXELS + 40);
+
+		for (i = 0; i < ADNS_FRAME_PIXELS; i++) burst[i] = 0x40 | (frame[i] & 0x3f);
+		if (sof < ADNS_FRAME_PIXELS) burst[sof] |= 0x80;
+
+		pixel_frame_scalar(burst, ref_pixel, n, &ref, ref_hist);
+		pixel_frame(burst, unpacked, n, &stats, hist);
+		if ((ref.sof != stats.sof) || (ref.sum != stats.sum) || (ref.min != stats.min) || (ref.max != stats.max)
+				|| (memcmp(ref_pixel, unpacked, n) != 0) || (memcmp(ref_hist, hist, sizeof(hist)) != 0)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static uint8_t flow_frame[FLOW_FRAMES][ADNS_FRAME_PIXELS];
+static const uint8_t *flow_ptr[FLOW_FRAMES];
+static flow_t flow_out[FLOW_FRAMES];
+static float flow_true[FLOW_FRAMES][2];
+static flow_pool_t flow_pool;
+static int flow_k;
+
+static void flow_one(void) {
+	flow_k = (flow_k % (FLOW_FRAMES - 1)) + 1;
+	flow_estimate(flow_frame[flow_k - 1], flow_frame[flow_k], &flow_out[flow_k]);
+}
+
+static void flow_batch(void) { flow_pool_run(&flow_pool, flow_ptr, FLOW_FRAMES, flow_out); }
+
+/*
+ * render a random walk over the synthetic surface and compare the flow
+ * estimates with the known displacement, then time them
+ */
+static int bench_flow(void) {
+	scene_t scene;
+	bench_result_t r;
+	double err = 0, err_max = 0;
+	uint32_t rnd = 12345;
+	char name[32];
+	int k;
+
+	scene_init(&scene, 0x3080);
+	for (k = 0; k < FLOW_FRAMES; k++) {
+		// up to +-5 pixel in 1/256 steps
+		int32_t dx, dy;
+		rnd = rnd * 1103515245 + 12345;
+		dx = (int32_t)((rnd >> 8) % 2561) - 1280;
+		rnd = rnd * 1103515245 + 12345;
+		dy = (int32_t)((rnd >> 8) % 2561) - 1280;
+
+		scene.x += dx;
+		scene.y += dy;
+		scene_render(&scene, flow_frame[k]);
+		flow_ptr[k] = flow_frame[k];
+		flow_true[k][0] = dx / 256.0f;
+		flow_true[k][1] = dy / 256.0f;
+	}
+
+	for (k = 1; k < FLOW_FRAMES; k++) {
+		flow_t f;
+		double e;
+		flow_estimate(flow_frame[k - 1], flow_frame[k], &f);
+		e = fabs(f.dx - flow_true[k][0]) + fabs(f.dy - flow_true[k][1]);
+		err += e;
+		if (e > err_max) err_max = e;
+	}
+	err /= FLOW_FRAMES - 1;
+	fprintf(info, "flow error mean %.3f, max %.3f pixel (|dx| + |dy|)\n", err, err_max);
+	if (err > 0.25) return -1;
+
+	r = measure(flow_one, FLOW_FRAMES - 1, 1);
+	report("flow pair", &r, NULL);
+
+	if (flow_pool_init(&flow_pool, sysconf(_SC_NPROCESSORS_ONLN)) != 0) return -1;
+	r = measure(flow_batch, 4, FLOW_FRAMES - 1);
+	flow_pool_free(&flow_pool);
+	// the thread count is part of the name, results only compare on the same machine
+	snprintf(name, sizeof(name), "flow pair pool %d", flow_pool.threads + 1);
+	report(name, &r, NULL);
+
+	return 0;
+}
+
+static uint8_t codec_out[FLOW_FRAMES][FRAMECODEC_MAX_SIZE];
+static int codec_len[FLOW_FRAMES];
+static framecodec_t codec;
+static uint8_t codec_pixel[ADNS_FRAME_PIXELS];
+static int codec_k;
+
+static void codec_encode(void) {
+	if (codec_k == FLOW_FRAMES) codec_k = 0;
+	framecodec_encode(&codec, flow_frame[codec_k], codec_out[codec_k]);
+	codec_k++;
+}
+
+static void codec_decode(void) {
+	// restart at a keyframe
+	if (codec_k == FLOW_FRAMES) codec_k = 0;
+	framecodec_decode(&codec, codec_out[codec_k], codec_len[codec_k], codec_pixel);
+	codec_k++;
+}
+
+/*
+ * round trip of a surface moving at the emulator's default speed and of
+ * noise, which has to fall back to packed frames, then encode and decode
+ * timing
+ */
+static int bench_codec(void) {
+	framecodec_t enc, dec;
+	scene_t scene;
+	bench_result_t r;
+	uint8_t pixel[ADNS_FRAME_PIXELS];
+	uint32_t rnd = 4711;
+	uint64_t bytes = 0;
+	int k, i;
+
+	scene_init(&scene, 0x3080);
+	scene_set_speed(&scene, 100, 50);
+	framecodec_init(&enc, FRAMECODEC_INTERVAL);
+	framecodec_init(&dec, 0);
+	for (k = 0; k < FLOW_FRAMES; k++) {
+		scene_advance(&scene, 16000000);
+		scene_render(&scene, flow_frame[k]);
+		if (k % 100 == 99) {
+			for (i = 0; i < ADNS_FRAME_PIXELS; i++) {
+				rnd = rnd * 1103515245 + 12345;
+				flow_frame[k][i] = rnd >> 24;
+			}
+		}
+		codec_len[k] = framecodec_encode(&enc, flow_frame[k], codec_out[k]);
+		bytes += codec_len[k];
+		if ((framecodec_decode(&dec, codec_out[k], codec_len[k], pixel) != 0)) return -1;
+		for (i = 0; i < ADNS_FRAME_PIXELS; i++) {
+			if (pixel[i] != (flow_frame[k][i] & 0x3f)) return -1;
+		}
+	}
+	fprintf(info, "frame codec %.1f bytes/frame (%.2f:1), %llu keyframes\n", (double)bytes / FLOW_FRAMES,
+		(double)ADNS_FRAME_PIXELS * FLOW_FRAMES / bytes, (unsigned long long)enc.keys);
+
+	// a truncated frame must not decode
+	framecodec_decode(&dec, codec_out[0], codec_len[0], pixel);
+	if (framecodec_decode(&dec, codec_out[1], codec_len[1] / 2, pixel) == 0) return -1;
+
+	// whole passes over the sequence, so the decoder always starts at the first keyframe
+	framecodec_init(&codec, FRAMECODEC_INTERVAL);
+	codec_k = 0;
+	r = measure(codec_encode, FLOW_FRAMES, 1);
+	report("frame codec encode", &r, NULL);
+
+	framecodec_init(&codec, 0);
+	codec_k = 0;
+	r = measure(codec_decode, FLOW_FRAMES, 1);
+	report("frame codec decode", &r, NULL);
+
+	return 0;
+}
+
+static odo_t odo;
+static uint64_t odo_t_ns;
+
+static void odo_step(void) {
+	odo_t_ns += 1000000;
+	odo_update(&odo, odo_t_ns, 0x90, 127, -128);
+}
+
+/*
+ * a speed ramp that saturates the delta registers halfway through, read
+ * at 100 Hz: the integrator has to recover most of the clipped counts
+ */
+static int bench_odometry(void) {
+	bench_result_t r;
+	double pos = 0, last = 0;
+	int64_t raw = 0;
+	int k;
+
+	odo_init(&odo);
+	for (k = 0; k <= 100; k++) {
+		double t = k / 100.0;
+		int64_t d;
+		int ovf = 0;
+
+		// 0 to 20000 counts/s in one second
+		pos = 10000 * t * t;
+		d = llround(pos - last);
+		last += d;
+		if (d > ODO_DELTA_MAX) {
+			d = ODO_DELTA_MAX;
+			ovf = 1;
+		}
+		raw += d;
+		odo_update(&odo, k * 10000000ULL, ovf << 4, d, 0);
+	}
+	fprintf(info, "odometry ramp: true %.0f, raw sum %lld, integrated %lld counts (%lld estimated)\n",
+		pos, (long long)raw, (long long)odo.x, (long long)odo.lost_x);
+	if (fabs(odo.x - pos) > 0.1 * fabs(raw - pos)) return -1;
+
+	odo_t_ns = k * 10000000ULL;
+	r = measure(odo_step, ITERATIONS * 10, 1);
+	report("odometry update", &r, NULL);
+	return 0;
+}
+
+static void latency_record(void) { lat_end(LAT_OPS - 1, lat_start()); }
+
+// percentiles of a uniform distribution and the cost of recording
+static int bench_latency(void) {
+	bench_result_t r;
+	int k;
+
+	// a 0 ns record stays the minimum
+	lat_reset();
+	lat_record(LAT_OPS - 1, 0);
+	lat_record(LAT_OPS - 1, 1000);
+	if (lat_percentile(LAT_OPS - 1, 0) != 0) return -1;
+
+	lat_reset();
+	for (k = 1; k <= 100000; k++) lat_record(LAT_OPS - 1, k);
+	// within a bucket, 1/8 of the value
+	if ((fabs(lat_percentile(LAT_OPS - 1, 0.5) - 50) > 50 / 8.0)
+			|| (fabs(lat_percentile(LAT_OPS - 1, 0.99) - 99) > 99 / 8.0)) {
+		return -1;
+	}
+
+	r = measure(latency_record, ITERATIONS * 10, 1);
+	report("latency start + record", &r, NULL);
+	lat_reset();
+	return 0;
+}
+
+static FILE *tsv_out;
+static sample_t tsv_sample;
+
+static void tsv_format(void) {
+	tsv_sample.t_ns += 10000000;
+	tsv_sample.pos_X += tsv_sample.delta_X;
+	sample_print(tsv_out, &tsv_sample, SAMPLE_I2C | SAMPLE_ODO | SAMPLE_TIMING);
+}
+
+// formatting of a log line with all columns, written to /dev/null
+static int bench_tsv(void) {
+	static char buf[1 << 16];
+	bench_result_t r;
+
+	tsv_out = fopen("/dev/null", "w");
+	if (tsv_out == NULL) return -1;
+	setvbuf(tsv_out, buf, _IOFBF, sizeof(buf));
+
+	tsv_sample.motion = 0x80;
+	tsv_sample.delta_X = 17;
+	tsv_sample.delta_Y = -5;
+	tsv_sample.squal = 92;
+	tsv_sample.shutter = 0x1234;
+	tsv_sample.pixel_sum = 43;
+	tsv_sample.valid = 0xffff;
+	tsv_sample.servo = 512;
+	tsv_sample.vel_X = 1700.5f;
+	tsv_sample.vel_Y = -500.25f;
+	tsv_sample.spi_ns = 105000;
+	tsv_sample.i2c_ofs_ns = 240000;
+	tsv_sample.i2c_ns = 310000;
+
+	r = measure(tsv_format, ITERATIONS * 10, 1);
+	report("sample TSV format", &r, NULL);
+	fclose(tsv_out);
+	return 0;
+}
+
+static int sock_client;
+static volatile int sock_drain;
+static uint8_t sock_msg[sizeof(proto_resp_t) + sizeof(proto_odo_t)];
+
+static void *drainer(void *arg) {
+	char buf[64 * 1024];
+
+	(void)arg;
+	while (sock_drain && (recv(sock_client, buf, sizeof(buf), 0) > 0));
+	return NULL;
+}
+
+static void sock_send(void) {
+	while (socket_server_send(0, sock_msg, sizeof(sock_msg)) != SUCCESS) socket_server_poll(1);
+}
+
+static void ignore(int client, char *val, int len) {
+	(void)client;
+	(void)val;
+	(void)len;
+}
+
+// the server reports clients on stdout, which has to stay clean with -t
+static int mute(int saved) {
+	fflush(stdout);
+	if (saved < 0) {
+		int null = open("/dev/null", O_WRONLY);
+		saved = dup(STDOUT_FILENO);
+		dup2(null, STDOUT_FILENO);
+		close(null);
+		return saved;
+	}
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	return -1;
+}
+
+/*
+ * queueing and sending an odometry response to a loopback client that
+ * reads as fast as it can, returns 1 if the port is taken
+ */
+static int bench_socket(void) {
+	struct sockaddr_in addr = { 0 };
+	bench_result_t r;
+	pthread_t t;
+	int saved = -1, k;
+
+	if (tsv) saved = mute(-1);
+	if (socket_server_init(BENCH_PORT, ignore) != SUCCESS) {
+		if (tsv) mute(saved);
+		return 1;
+	}
+	sock_client = socket(AF_INET, SOCK_STREAM, 0);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(BENCH_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((sock_client < 0) || (connect(sock_client, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+		socket_server_close();
+		if (tsv) mute(saved);
+		return -1;
+	}
+	for (k = 0; (k < 100) && (socket_server_clients() == 0); k++) socket_server_poll(10);
+	if (tsv) saved = mute(saved);
+
+	sock_drain = 1;
+	pthread_create(&t, NULL, drainer, NULL);
+	r = measure(sock_send, ITERATIONS * 10, 1);
+	report("socket send", &r, NULL);
+
+	sock_drain = 0;
+	shutdown(sock_client, SHUT_RDWR);
+	pthread_join(t, NULL);
+	close(sock_client);
+	if (tsv) saved = mute(-1);
+	socket_server_close();
+	if (tsv) mute(saved);
+	return 0;
+}
+
+static void print_usage(const char *prog)
+{
+	printf("Usage: %s [-t] [-c baseline]\n", prog);
+	puts("  -t  results as TSV on stdout: name, ns/op, ops/s, allocs/op\n"
+	     "  -c  compare with the TSV of an earlier run, fail on regressions\n");
+	exit(1);
+}
+
+static int motion_efd;
+static atomic_int motion_signalled;
+
+// a fast move of 50 ms every 250 ms, the sensor reports motion every ms
+static void *motion_mover(void *arg) {
+	uint64_t t0 = now_ns(), t;
+
+	while ((t = now_ns() - t0) < MOTION_RUN_NS) {
+		if (t % 250000000 < 50000000) {
+			motion_eventfd_signal(motion_efd);
+			atomic_fetch_add(&motion_signalled, 1);
+		}
+		usleep(1000);
+	}
+	return NULL;
+}
+
+static uint64_t thread_cpu_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * the same moves sampled on a timer and on motion events, ns/op is CPU
+ * time of the sampling thread per motion event
+ */
+static int bench_motion(void) {
+	uint8_t mode = SPI_CPHA | SPI_CPOL, bits = 8;
+	uint32_t speed = 500000;
+	recorder_conf_t conf = {0};
+	uint64_t reads[2], cpu, t0;
+	recorder_t rec;
+	motion_t m;
+	pthread_t mover;
+	bench_result_t r = {0};
+	char extra[96];
+	int k, sfd;
+
+	sfd = spi_transport_emu.open("emu", &mode, &bits, &speed);
+	if ((sfd < 0) || (motion_open(&m, &motion_source_eventfd, "", MOTION_RATE, 10) != 0)) return -1;
+	motion_efd = m.fd;
+	lat_reset();
+
+	for (k = 0; k < 2; k++) {
+		sched_t sched;
+
+		if (recorder_start(&rec, sfd, "/dev/null", &conf) != 0) return -1;
+		sched_init(&sched, MOTION_RATE);
+		atomic_store(&motion_signalled, 0);
+		pthread_create(&mover, NULL, motion_mover, NULL);
+		reads[k] = 0;
+		cpu = thread_cpu_ns();
+		t0 = now_ns();
+		while (now_ns() - t0 < MOTION_RUN_NS) {
+			if (k == 0) {
+				recorder_sample(&rec);
+				sched_wait(&sched);
+				reads[k]++;
+			} else {
+				motion_sample(&m, &rec);
+			}
+		}
+		cpu = thread_cpu_ns() - cpu;
+		pthread_join(mover, NULL);
+		recorder_stop(&rec);
+		if (k == 1) reads[k] = m.reads;
+
+		r.ns = (double)cpu / atomic_load(&motion_signalled);
+		if (k == 0) {
+			snprintf(extra, sizeof(extra), "%llu reads", (unsigned long long)reads[k]);
+		} else {
+			snprintf(extra, sizeof(extra), "%llu reads, %llu heartbeats, event to read p50 %.1f p99 %.1f us",
+				(unsigned long long)reads[k], (unsigned long long)m.heartbeats,
+				lat_percentile(LAT_MOTION_EVENT, 0.5), lat_percentile(LAT_MOTION_EVENT, 0.99));
+		}
+		report(k ? "motion event driven" : "motion polled", &r, extra);
+	}
+	motion_close(&m);
+	spi_transport_emu.close(sfd);
+	// every move read, the idle time not
+	return ((m.reads - m.heartbeats >= 4) && (reads[1] < reads[0] / 2)) ? 0 : -1;
+}
+
+static multi_t multi;
+
+/*
+ * two emulated sensors read back to back in real time, ns/op per sample
+ * of one sensor, so separate buses should keep the rate of a single one
+ */
+static int bench_multi(const char *name, const char *dev0, const char *dev1) {
+	recorder_conf_t conf = { .columns = SAMPLE_SENSOR };
+	recorder_t rec;
+	bench_result_t r = {0};
+	uint64_t t0, n;
+	char extra[64];
+
+	multi_init(&multi);
+	if ((multi_add(&multi, dev0) < 0) || (multi_add(&multi, dev1) < 0)) {
+		multi_close(&multi);
+		return -1;
+	}
+	if (recorder_start(&rec, -1, "/dev/null", &conf) != 0) {
+		multi_close(&multi);
+		return -1;
+	}
+	// faster than a motion read, every deadline is late
+	if (multi_start(&multi, 100000, &rec) != 0) {
+		recorder_stop(&rec);
+		multi_close(&multi);
+		return -1;
+	}
+	t0 = now_ns();
+	while (now_ns() - t0 < MULTI_RUN_NS) {
+		multi_merge(&multi, &rec);
+		usleep(1000);
+	}
+	multi_stop(&multi, &rec);
+	t0 = now_ns() - t0;
+	recorder_stop(&rec);
+	multi_close(&multi);
+
+	n = multi.sensor[0].samples + multi.sensor[1].samples;
+	r.ns = (double)t0 / multi.sensor[0].samples;
+	snprintf(extra, sizeof(extra), "%d bus(es), %llu merged", multi.n_buses, (unsigned long long)multi.merged);
+	report(name, &r, extra);
+	// every sample once, none left on a bus
+	return (multi.merged == n) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t mode = SPI_CPHA | SPI_CPOL;
+	uint8_t bits = 8;
+	uint32_t speed = 500000;
+	adns3080_t single, planned, pipelined;
+	int c, ret;
+
+	info = stdout;
+	while ((c = getopt(argc, argv, "c:th")) != -1) {
+		switch (c) {
+		case 't':
+			tsv = 1;
+			info = stderr;
+			break;
+		case 'c':
+			load_baseline(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	SPI_set_transport(&spi_transport_emu);
+	ADNS_emu_defaults(100, 50, 0x3080);
+	fd = spi_transport_emu.open("emu", &mode, &bits, &speed);
+	if (fd < 0) {
+		fprintf(stderr, "can't open emulated sensor\n");
+		return EXIT_FAILURE;
+	}
+	// deterministic: emulator time only advances with the bus
+	ADNS_emu_set_realtime(fd, 0);
+
+	// both strategies have to decode the same register contents
+	ADNS_set_read_mode(ADNS_READ_SINGLE);
+	ADNS_read_all(fd);
+	ADNS_get_FPS_bounds(fd);
+	single = adns;
+	ADNS_set_read_mode(ADNS_READ_PLANNED);
+	ADNS_read_all(fd);
+	ADNS_get_FPS_bounds(fd);
+	planned = adns;
+	ADNS_set_read_mode(ADNS_READ_PIPELINED);
+	ADNS_read_all(fd);
+	ADNS_get_FPS_bounds(fd);
+	pipelined = adns;
+	if (!same_registers(&single, &planned) || !same_registers(&single, &pipelined)) {
+		fprintf(stderr, "error: planned or pipelined read differs from single register read\n");
+		return EXIT_FAILURE;
+	}
+
+	ADNS_set_read_mode(ADNS_READ_SINGLE);
+	bench_reg("read_all single", read_all, ITERATIONS);
+	bench_reg("get_FPS_bounds single", get_bounds, ITERATIONS);
+	bench_reg("write_FPS_bounds single", write_bounds_op, ITERATIONS);
+
+	ADNS_set_read_mode(ADNS_READ_PLANNED);
+	bench_reg("read_all planned", read_all, ITERATIONS);
+	bench_reg("get_FPS_bounds planned", get_bounds, ITERATIONS);
+	bench_reg("write_FPS_bounds planned", write_bounds_op, ITERATIONS);
+
+	ADNS_set_read_mode(ADNS_READ_PIPELINED);
+	bench_reg("read_all pipelined", read_all, ITERATIONS);
+	bench_reg("get_FPS_bounds pipelined", get_bounds, ITERATIONS);
+
+	bench_reg("motion burst", motion_burst, ITERATIONS);
+	// diagnostics on must not change what they diagnose
+	trace_set_level(TRACE_DEBUG);
+	bench_reg("motion burst traced", motion_burst, ITERATIONS);
+	trace_set_level(TRACE_OFF);
+	// bus bound: the sensor needs a frame period before the burst, in real time
+	ADNS_emu_set_realtime(fd, 1);
+	bench_reg("frame capture", capture_frame, 4);
+	bench_reg("set_FPS_bounds", apply_bounds, 4);
+	ADNS_emu_set_realtime(fd, 0);
+
+	spi_transport_emu.close(fd);
+	if (bench_i2c() != 0) {
+		fprintf(stderr, "error: batched i2c read differs from single reads\n");
+		return EXIT_FAILURE;
+	}
+	if (bench_aux() != 0) {
+		fprintf(stderr, "error: i2c samples merged at the wrong time\n");
+		return EXIT_FAILURE;
+	}
+	// host side cost of the emulated accesses above
+	if (!tsv) lat_report(info);
+	if (bench_latency() != 0) {
+		fprintf(stderr, "error: latency percentiles are off\n");
+		return EXIT_FAILURE;
+	}
+
+	if (check_pixel() != 0) {
+		fprintf(stderr, "error: %s pixel kernels differ from scalar\n", pixel_impl());
+		return EXIT_FAILURE;
+	}
+	bench_pixel("pack6 scalar", pack_scalar);
+	bench_pixel("unpack6 scalar", unpack_scalar);
+	bench_pixel("frame stats scalar", frame_scalar);
+	bench_pixel("frame stats+hist scalar", frame_hist_scalar);
+	fprintf(info, "pixel kernels: %s\n", pixel_impl());
+	bench_pixel("pack6", pack_best);
+	bench_pixel("unpack6", unpack_best);
+	bench_pixel("frame stats", frame_best);
+	bench_pixel("frame stats+hist", frame_hist_best);
+
+	if (bench_flow() != 0) {
+		fprintf(stderr, "error: flow estimates are off\n");
+		return EXIT_FAILURE;
+	}
+	if (bench_odometry() != 0) {
+		fprintf(stderr, "error: odometry does not recover saturated counts\n");
+		return EXIT_FAILURE;
+	}
+	if (bench_codec() != 0) {
+		fprintf(stderr, "error: frame codec round trip failed\n");
+		return EXIT_FAILURE;
+	}
+	if (bench_tsv() != 0) {
+		fprintf(stderr, "error: can't open /dev/null\n");
+		return EXIT_FAILURE;
+	}
+	ret = bench_socket();
+	if (ret > 0) {
+		fprintf(info, "socket send skipped, port %d is taken\n", BENCH_PORT);
+	} else if (ret < 0) {
+		fprintf(stderr, "error: can't connect to the socket server\n");
+		return EXIT_FAILURE;
+	}
+
+	if (bench_motion() != 0) {
+		fprintf(stderr, "error: event-driven sampling missed moves or read while idle\n");
+		return EXIT_FAILURE;
+	}
+	if ((bench_multi("multi 2 sensors one bus", "emu0.0", "emu0.1") != 0)
+		|| (bench_multi("multi 2 sensors two buses", "emu0.0", "emu1.0") != 0)) {
+		fprintf(stderr, "error: multi-sensor samples lost in the merge\n");
+		return EXIT_FAILURE;
+	}
+
+	if (regressions) {
+		fprintf(stderr, "%d benchmarks slower than the baseline\n", regressions);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,343 @@
+/*
+ * binlog.c
+ */
+
+#include <stdint.h>
+#include <stddef.h>			// offsetof
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>			// write, pwrite, fdatasync
+#include <fcntl.h>			// open
+#include <sys/stat.h>
+
+#include "binlog.h"
+
+_Static_assert(sizeof(binlog_mark_t) == sizeof(sample_t), "mark and sample size differ");
+_Static_assert(offsetof(binlog_mark_t, kind) == offsetof(sample_t, kind), "kind offset differs");
+
+#define COLUMN(n, t, field, s)	{ .name = n, .type = t, .offset = offsetof(sample_t, field), .shift = s }
+
+static const binlog_column_t columns[] = {
+	COLUMN("t",        BINLOG_U64, t_ns,      0),
+	COLUMN("MOT",      BINLOG_BIT, motion,    7),
+	COLUMN("dX",       BINLOG_S32, delta_X,   0),
+	COLUMN("dY",       BINLOG_S32, delta_Y,   0),
+	COLUMN("SQUAL",    BINLOG_U16, squal,     0),
+	COLUMN("shut",     BINLOG_U16, shutter,   0),
+	COLUMN("pxSum",    BINLOG_U8,  pixel_sum, 0),
+	COLUMN("OVF",      BINLOG_BIT, motion,    4),
+	COLUMN("RES",      BINLOG_BIT, motion,    0),
+	COLUMN("valid",    BINLOG_U16, valid,     0),
+	COLUMN("dropped",  BINLOG_U16, dropped,   0),
+};
+
+static const binlog_column_t sensor_columns[] = {
+	COLUMN("sensor",   BINLOG_U8,  sensor,    0),
+};
+
+static const binlog_column_t i2c_columns[] = {
+	COLUMN("servo",    BINLOG_U16, servo,     0),
+	COLUMN("bright 0", BINLOG_U16, bright[0], 0),
+	COLUMN("bright 1", BINLOG_U16, bright[1], 0),
+	COLUMN("bright 2", BINLOG_U16, bright[2], 0),
+	COLUMN("bright 3", BINLOG_U16, bright[3], 0),
+};
+
+static const binlog_column_t odo_columns[] = {
+	COLUMN("X",        BINLOG_S64, pos_X,     0),
+	COLUMN("Y",        BINLOG_S64, pos_Y,     0),
+	COLUMN("vX",       BINLOG_F32, vel_X,     0),
+	COLUMN("vY",       BINLOG_F32, vel_Y,     0),
+	COLUMN("lostX",    BINLOG_S32, lost_X,    0),
+	COLUMN("lostY",    BINLOG_S32, lost_Y,    0),
+};
+
+static const binlog_column_t timing_columns[] = {
+	COLUMN("spi_ns",   BINLOG_U32, spi_ns,    0),
+	COLUMN("i2c_dt_ns", BINLOG_S32, i2c_ofs_ns, 0),
+	COLUMN("i2c_ns",   BINLOG_U32, i2c_ns,    0),
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+uint32_t binlog_crc32(uint32_t crc, const void *data, size_t len) {
+	static uint32_t table[256];
+	const uint8_t *p = data;
+
+	if (table[1] == 0) {
+		uint32_t i, j;
+		for (i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (j = 0; j < 8; j++) c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	while (len--) crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static int write_all(int fd, const uint8_t *p, size_t len) {
+	while (len) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0) return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int flush(binlog_t *log) {
+	if (log->fill == 0) return 0;
+	if (write_all(log->fd, log->buf, log->fill * sizeof(sample_t)) != 0) return -1;
+	log->fill = 0;
+	return 0;
+}
+
+static int put(binlog_t *log, const void *rec) {
+	memcpy(log->buf + log->fill * sizeof(sample_t), rec, sizeof(sample_t));
+	log->fill++;
+	log->records++;
+	if (log->fill == BINLOG_BUF_RECORDS) return flush(log);
+	return 0;
+}
+
+static int put_mark(binlog_t *log, uint8_t kind, int64_t t_realtime_ns) {
+	binlog_mark_t m;
+
+	memset(&m, 0, sizeof(m));
+	m.records = log->records;
+	m.kind = kind;
+	m.crc = log->crc;
+	m.t_realtime_ns = t_realtime_ns;
+
+	log->crc = 0;
+	log->since_checkpoint = 0;
+	return put(log, &m);
+}
+
+// picks up an existing log: drops a partial trailing record and recomputes
+// the crc of the records written after the last mark
+static int resume(binlog_t *log, uint32_t flags) {
+	struct stat st;
+	sample_t rec;
+	off_t pos, end;
+	uint64_t n;
+
+	if (fstat(log->fd, &st) != 0) return -1;
+	if (st.st_size == 0) return 1;
+
+	if (pread(log->fd, &log->hdr, sizeof(log->hdr), 0) != sizeof(log->hdr)) return -1;
+	if (memcmp(log->hdr.magic, BINLOG_MAGIC, 8) || (log->hdr.version != BINLOG_VERSION)
+			|| (log->hdr.record_size != sizeof(sample_t))
+			|| (log->hdr.flags != flags)) {
+		return -1;
+	}
+
+	n = (st.st_size - log->hdr.header_size) / sizeof(sample_t);
+	end = log->hdr.header_size + n * sizeof(sample_t);
+	if (ftruncate(log->fd, end) != 0) return -1;
+
+	// search backwards for the last mark
+	for (pos = end - sizeof(sample_t); pos >= log->hdr.header_size; pos -= sizeof(sample_t)) {
+		if (pread(log->fd, &rec, sizeof(rec), pos) != sizeof(rec)) return -1;
+		if (rec.kind != BINLOG_SAMPLE) break;
+	}
+	log->crc = 0;
+	log->since_checkpoint = 0;
+	for (pos += sizeof(sample_t); pos < end; pos += sizeof(sample_t)) {
+		if (pread(log->fd, &rec, sizeof(rec), pos) != sizeof(rec)) return -1;
+		log->crc = binlog_crc32(log->crc, &rec, sizeof(rec));
+		log->since_checkpoint++;
+	}
+
+	log->records = n;
+	if (lseek(log->fd, end, SEEK_SET) != end) return -1;
+	return 0;
+}
+
+int binlog_open(binlog_t *log, const char *path, uint32_t flags, int append) {
+	int ret;
+
+	memset(log, 0, sizeof(*log));
+	log->fd = open(path, O_RDWR | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+	if (log->fd < 0) return -1;
+
+	if (append) {
+		ret = resume(log, flags);
+		if (ret < 0) {
+			close(log->fd);
+			return -1;
+		}
+		if (ret == 0) {
+			log->appended = 1;
+			return 0;
+		}
+	}
+
+	memcpy(log->hdr.magic, BINLOG_MAGIC, 8);
+	log->hdr.version = BINLOG_VERSION;
+	log->hdr.header_size = sizeof(binlog_header_t);
+	log->hdr.record_size = sizeof(sample_t);
+	log->hdr.flags = flags;
+	log->hdr.checkpoint_interval = BINLOG_CHECKPOINT;
+	memcpy(log->hdr.column, columns, sizeof(columns));
+	log->hdr.columns = ARRAY_SIZE(columns);
+	if (flags & BINLOG_F_SENSOR) {
+		memcpy(log->hdr.column + log->hdr.columns, sensor_columns, sizeof(sensor_columns));
+		log->hdr.columns += ARRAY_SIZE(sensor_columns);
+	}
+	if (flags & BINLOG_F_I2C) {
+		memcpy(log->hdr.column + log->hdr.columns, i2c_columns, sizeof(i2c_columns));
+		log->hdr.columns += ARRAY_SIZE(i2c_columns);
+	}
+	if (flags & BINLOG_F_ODO) {
+		memcpy(log->hdr.column + log->hdr.columns, odo_columns, sizeof(odo_columns));
+		log->hdr.columns += ARRAY_SIZE(odo_columns);
+	}
+	if (flags & BINLOG_F_TIMING) {
+		memcpy(log->hdr.column + log->hdr.columns, timing_columns, sizeof(timing_columns));
+		log->hdr.columns += ARRAY_SIZE(timing_columns);
+	}
+
+	if (write_all(log->fd, (uint8_t *)&log->hdr, sizeof(log->hdr)) != 0) {
+		close(log->fd);
+		return -1;
+	}
+	return 0;
+}
+
+int binlog_start(binlog_t *log, int64_t t0_realtime_ns) {
+	if (log->appended) {
+		return put_mark(log, BINLOG_SEGMENT_MARK, t0_realtime_ns);
+	}
+
+	log->hdr.t0_realtime_ns = t0_realtime_ns;
+	if (pwrite(log->fd, &log->hdr.t0_realtime_ns, sizeof(log->hdr.t0_realtime_ns),
+			offsetof(binlog_header_t, t0_realtime_ns)) != sizeof(log->hdr.t0_realtime_ns)) {
+		return -1;
+	}
+	return 0;
+}
+
+int binlog_write(binlog_t *log, const sample_t *s) {
+	log->crc = binlog_crc32(log->crc, s, sizeof(*s));
+	if (put(log, s) != 0) return -1;
+
+	if (++log->since_checkpoint >= log->hdr.checkpoint_interval) return binlog_checkpoint(log);
+	return 0;
+}
+
+int binlog_checkpoint(binlog_t *log) {
+	if (put_mark(log, BINLOG_CHECKPOINT_MARK, 0) != 0) return -1;
+	if (flush(log) != 0) return -1;
+	return fdatasync(log->fd);
+}
+
+int binlog_close(binlog_t *log) {
+	int ret = 0;
+
+	if (log->since_checkpoint) ret = binlog_checkpoint(log);
+	else ret = flush(log);
+	close(log->fd);
+	return ret;
+}
+
+int binlog_read_header(FILE *f, binlog_header_t *hdr) {
+	if (fread(hdr, sizeof(*hdr), 1, f) != 1) return -1;
+	if (memcmp(hdr->magic, BINLOG_MAGIC, 8) != 0) return -1;
+	if ((hdr->header_size < sizeof(*hdr)) || (hdr->record_size < offsetof(sample_t, kind) + 1)) return -1;
+	// skip header padding of newer versions
+	if (fseek(f, hdr->header_size, SEEK_SET) != 0) return -1;
+	return 0;
+}
+
+static const struct {
+	const binlog_column_t *column;
+	size_t n;
+} tables[] = {
+	{ columns, ARRAY_SIZE(columns) },
+	{ sensor_columns, ARRAY_SIZE(sensor_columns) },
+	{ i2c_columns, ARRAY_SIZE(i2c_columns) },
+	{ odo_columns, ARRAY_SIZE(odo_columns) },
+	{ timing_columns, ARRAY_SIZE(timing_columns) },
+};
+
+static const binlog_column_t *find_column(const char *name) {
+	size_t i, k;
+
+	for (i = 0; i < ARRAY_SIZE(tables); i++) {
+		for (k = 0; k < tables[i].n; k++) {
+			if (strncmp(tables[i].column[k].name, name, sizeof(tables[i].column[k].name)) == 0) {
+				return &tables[i].column[k];
+			}
+		}
+	}
+	return NULL;
+}
+
+static size_t type_size(uint8_t type) {
+	switch (type) {
+	case BINLOG_U16: return 2;
+	case BINLOG_S32: case BINLOG_F32: case BINLOG_U32: return 4;
+	case BINLOG_U64: case BINLOG_S64: return 8;
+	default: return 1;
+	}
+}
+
+static int64_t get_int(const uint8_t *p, uint8_t type) {
+	union { uint8_t b[8]; uint16_t u16; int32_t s32; uint32_t u32; uint64_t u64; int64_t s64; } v;
+
+	memcpy(v.b, p, type_size(type));
+	switch (type) {
+	case BINLOG_S8: return (int8_t)v.b[0];
+	case BINLOG_U16: return v.u16;
+	case BINLOG_S32: return v.s32;
+	case BINLOG_U32: return v.u32;
+	case BINLOG_U64: return v.u64;
+	case BINLOG_S64: return v.s64;
+	default: return v.b[0];
+	}
+}
+
+static void put_int(uint8_t *p, uint8_t type, int64_t x) {
+	union { uint8_t b[8]; uint16_t u16; int32_t s32; uint32_t u32; uint64_t u64; int64_t s64; } v;
+
+	switch (type) {
+	case BINLOG_U16: v.u16 = x; break;
+	case BINLOG_S32: v.s32 = x; break;
+	case BINLOG_U32: v.u32 = x; break;
+	case BINLOG_U64: v.u64 = x; break;
+	case BINLOG_S64: v.s64 = x; break;
+	default: v.b[0] = x;
+	}
+	memcpy(p, v.b, type_size(type));
+}
+
+void binlog_sample(const binlog_header_t *hdr, const void *rec, sample_t *s) {
+	const uint8_t *r = rec;
+	uint8_t *d = (uint8_t *)s;
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	if (hdr->version >= BINLOG_VERSION) {
+		memcpy(s, rec, (hdr->record_size < sizeof(*s)) ? hdr->record_size : sizeof(*s));
+		return;
+	}
+
+	// the kind is at the same offset in every version, the rest moves
+	s->kind = r[offsetof(sample_t, kind)];
+	for (i = 0; (i < hdr->columns) && (i < BINLOG_MAX_COLUMNS); i++) {
+		const binlog_column_t *from = &hdr->column[i], *to = find_column(from->name);
+
+		if ((to == NULL) || (from->offset + type_size(from->type) > hdr->record_size)) continue;
+		if ((from->type == BINLOG_BIT) || (to->type == BINLOG_BIT)) {
+			if (from->type == to->type) d[to->offset] |= ((r[from->offset] >> from->shift) & 1) << to->shift;
+		} else if (from->type == to->type) {
+			memcpy(d + to->offset, r + from->offset, type_size(to->type));
+		} else if ((from->type != BINLOG_F32) && (to->type != BINLOG_F32)) {
+			put_int(d + to->offset, to->type, get_int(r + from->offset, from->type));
+		}
+	}
+}
@@ -0,0 +1,105 @@
+/*
+ * binlog.h
+ *
+ * compact binary sample log
+ *
+ * file layout:
+ *	binlog_header_t		column description, padded to header_size
+ *	record[]			record_size bytes each, sample_t or binlog_mark_t
+ *
+ * Every checkpoint_interval samples a checkpoint mark carrying the CRC
+ * of the records since the previous mark is written and the file is
+ * synced. A crashed log therefore loses at most the unsynced tail and
+ * every block up to the last checkpoint can be verified. Appending to
+ * an existing log starts a new segment with its own realtime anchor.
+ */
+
+#ifndef BINLOG_H_
+#define BINLOG_H_
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sample.h"
+
+#define BINLOG_MAGIC		"ADNSBLOG"
+#define BINLOG_VERSION		2		// 1: int8 dX, dY
+#define BINLOG_MAX_COLUMNS	32
+#define BINLOG_CHECKPOINT	256		// default samples between checkpoints
+#define BINLOG_BUF_RECORDS	128
+
+// header flags
+#define BINLOG_F_I2C		SAMPLE_I2C
+#define BINLOG_F_ODO		SAMPLE_ODO
+#define BINLOG_F_TIMING		SAMPLE_TIMING
+#define BINLOG_F_SENSOR		SAMPLE_SENSOR
+
+// record kinds
+#define BINLOG_SAMPLE		0
+#define BINLOG_CHECKPOINT_MARK	1
+#define BINLOG_SEGMENT_MARK	2
+
+// column types
+enum {
+	BINLOG_U8,
+	BINLOG_S8,
+	BINLOG_U16,
+	BINLOG_U64,
+	BINLOG_BIT,
+	BINLOG_S32,
+	BINLOG_S64,
+	BINLOG_F32,
+	BINLOG_U32
+};
+
+typedef struct __attribute__((packed)) {
+	char name[12];
+	uint8_t type;
+	uint8_t offset;		// byte offset inside the record
+	uint8_t shift;		// bit position for BINLOG_BIT
+	uint8_t res;
+} binlog_column_t;
+
+typedef struct __attribute__((packed)) {
+	char magic[8];
+	uint16_t version;
+	uint16_t header_size;
+	uint16_t record_size;
+	uint16_t columns;
+	uint32_t flags;
+	uint32_t checkpoint_interval;
+	int64_t t0_realtime_ns;		// wall clock time of t = 0
+	binlog_column_t column[BINLOG_MAX_COLUMNS];
+} binlog_header_t;
+
+typedef struct __attribute__((packed)) {
+	uint64_t records;			// records of any kind before this mark
+	uint8_t kind;				// same offset as sample_t.kind
+	uint8_t res[3];
+	uint32_t crc;				// crc32 of the records since the last mark
+	int64_t t_realtime_ns;		// segment start for BINLOG_SEGMENT_MARK
+	uint8_t pad[sizeof(sample_t) - 24];
+} binlog_mark_t;
+
+typedef struct {
+	int fd;
+	binlog_header_t hdr;
+	uint64_t records;			// records in the file incl. buffered ones
+	uint32_t since_checkpoint;
+	uint32_t crc;
+	uint32_t fill;
+	int appended;
+	uint8_t buf[BINLOG_BUF_RECORDS * sizeof(sample_t)];
+} binlog_t;
+
+int binlog_open(binlog_t *log, const char *path, uint32_t flags, int append);
+int binlog_start(binlog_t *log, int64_t t0_realtime_ns);
+int binlog_write(binlog_t *log, const sample_t *s);
+int binlog_checkpoint(binlog_t *log);
+int binlog_close(binlog_t *log);
+
+int binlog_read_header(FILE *f, binlog_header_t *hdr);
+// a record of a log with header hdr as sample_t, older layouts by their columns
+void binlog_sample(const binlog_header_t *hdr, const void *rec, sample_t *s);
+uint32_t binlog_crc32(uint32_t crc, const void *data, size_t len);
+
+#endif /* BINLOG_H_ */
@@ -0,0 +1,85 @@
+/*
+ * ctl.c
+ *
+ * sends one command to a running adns-connect --daemon and prints the
+ * answer, exits with failure unless it starts with "ok"
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+
+static void print_usage(const char *prog)
+{
+	printf("Usage: %s [-s socket] <command> [argument]\n", prog);
+	puts("  -s  control socket (default " DAEMON_SOCKET ")\n"
+	     " commands\n"
+	     "  state | shutter <n> | auto | time <s> | record <file> | next <file> | stop | wait | quit\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_un addr = {0};
+	const char *path = DAEMON_SOCKET;
+	char line[DAEMON_LINE + 128];
+	int fd, c, i, len = 0, n;
+
+	while ((c = getopt(argc, argv, "+s:h")) != -1) {
+		switch (c) {
+		case 's':
+			path = optarg;
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+	if (optind == argc) print_usage(argv[0]);
+
+	for (i = optind; i < argc; i++) {
+		n = snprintf(line + len, DAEMON_LINE - len, "%s%s", argv[i], (i + 1 < argc) ? " " : "\n");
+		if (n >= DAEMON_LINE - len) {
+			fprintf(stderr, "command too long\n");
+			return EXIT_FAILURE;
+		}
+		len += n;
+	}
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path too long\n");
+		return EXIT_FAILURE;
+	}
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((fd < 0) || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	if (send(fd, line, len, MSG_NOSIGNAL) != len) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	// one line back, wait may take the whole recording
+	len = 0;
+	while ((len < (int)sizeof(line) - 1) && ((n = recv(fd, line + len, sizeof(line) - 1 - len, 0)) > 0)) {
+		len += n;
+		if (memchr(line, '\n', len) != NULL) break;
+	}
+	close(fd);
+	line[len] = 0;
+	if (len == 0) {
+		fprintf(stderr, "no answer from %s\n", path);
+		return EXIT_FAILURE;
+	}
+	fputs(line, stdout);
+	if (line[len - 1] != '\n') putchar('\n');
+
+	return (strncmp(line, "ok", 2) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,330 @@
+/*
+ * daemon.c
+ *
+ * Keeps the sensor and the i2c bus open between recordings and takes
+ * line based commands on a unix stream socket, every command is answered
+ * with one line starting with "ok" or "error":
+ *	state				idle or the running recording, sensor settings
+ *	shutter <n>			apply frame period and shutter bounds, then auto mode
+ *	auto				automatic frame and shutter period
+ *	time <s>			run time of the recordings, 0 until stopped
+ *	record <file>		start recording, replaces a running one on the next sample
+ *	next <file>			start recording on the deadline the running one ends
+ *	stop				end the running recording
+ *	wait				answered when the running recording ends
+ *	quit				end the daemon
+ *
+ * Between recordings nothing touches the sensor. While recording, the
+ * socket is polled without blocking between two samples.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "adns.h"
+#include "daemon.h"
+#include "latency.h"
+#include "recorder.h"
+#include "sched.h"
+#include "trace.h"
+
+#define IDLE_MS		100		// poll period between recordings, for signals
+
+typedef struct {
+	int fd;
+	char line[DAEMON_LINE];
+	int len;
+	int waiting;			// answer when the recording ends
+} ctl_client_t;
+
+static int sensor;
+static double rate;
+static recorder_conf_t conf;
+static int listener = -1;
+static ctl_client_t clients[DAEMON_CLIENTS];
+static int quit;
+
+static sched_t sched;
+// the writer thread knows its recorder, so they are not copied
+static recorder_t recs[2];
+static recorder_t *rec = &recs[0];
+static int recording;
+static char file[DAEMON_LINE];
+static char next_file[DAEMON_LINE];
+static double run_time;
+static uint64_t samples;
+
+static void reply(ctl_client_t *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void reply(ctl_client_t *c, const char *fmt, ...) {
+	char buf[DAEMON_LINE + 128];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+	va_end(ap);
+	if (n > (int)sizeof(buf) - 2) n = sizeof(buf) - 2;
+	buf[n++] = '\n';
+	// a client too slow for one line does not get it
+	send(c->fd, buf, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+static void drop(ctl_client_t *c) {
+	close(c->fd);
+	c->fd = -1;
+}
+
+static void finish(void) {
+	int i;
+
+	recorder_stop(rec);
+	recording = 0;
+	printf("\trecorded %s: %.3f s, %llu samples\n", file, rec->t_ns / 1E9, (unsigned long long)samples);
+	recorder_report(rec, stdout);
+	for (i = 0; i < DAEMON_CLIENTS; i++) {
+		if ((clients[i].fd >= 0) && clients[i].waiting) {
+			reply(&clients[i], "ok %s %.3f s %llu samples %llu overruns", file, rec->t_ns / 1E9,
+				(unsigned long long)samples, (unsigned long long)rec->writer.overruns);
+			clients[i].waiting = 0;
+		}
+	}
+}
+
+static int start(const char *path) {
+	recorder_t *r = (rec == &recs[0]) ? &recs[1] : &recs[0];
+
+	// the running recording ends only when the next one is ready, the schedule goes on
+	if (recorder_start(r, sensor, path, &conf) != 0) return -1;
+	if (recording) {
+		finish();
+	} else if (sched_init(&sched, rate) != 0) {
+		recorder_stop(r);
+		return -1;
+	}
+	rec = r;
+	recording = 1;
+	samples = 0;
+	strcpy(file, path);
+	printf("\trecording to %s\n", file);
+	return 0;
+}
+
+static void state(ctl_client_t *c) {
+	char buf[DAEMON_LINE + 64];
+
+	if (recording) {
+		snprintf(buf, sizeof(buf), "recording %s %.3f s %llu samples", file, rec->t_ns / 1E9,
+			(unsigned long long)samples);
+	} else {
+		strcpy(buf, "idle");
+	}
+	reply(c, "ok %s, shutter %u, frame period %u, rate %.1f Hz, run time %.1f s%s%s", buf, adns.shutter,
+		adns.frame_period, rate, run_time, next_file[0] ? ", next " : "", next_file);
+}
+
+static void command(ctl_client_t *c, char *line) {
+	char *arg = strchr(line, ' ');
+
+	if (arg != NULL) {
+		*arg++ = 0;
+		while (*arg == ' ') arg++;
+	} else {
+		arg = line + strlen(line);
+	}
+
+	if (strcmp(line, "state") == 0) {
+		state(c);
+	} else if (strcmp(line, "shutter") == 0) {
+		adns_apply_t a;
+		int shutter = atoi(arg);
+
+		if ((shutter <= 0) || (shutter > 0xffff - 0x0e7e)) {
+			reply(c, "error shutter out of range");
+		} else if (ADNS_set_FPS_bounds(sensor, shutter, &a) < 1) {
+			reply(c, "error shutter %d not applied", shutter);
+		} else {
+			reply(c, "ok applied in %.1f ms", a.t_us / 1E3);
+		}
+	} else if (strcmp(line, "auto") == 0) {
+		if (ADNS_set_ext_conf(sensor, 0) < 1) reply(c, "error");
+		else reply(c, "ok");
+	} else if (strcmp(line, "time") == 0) {
+		run_time = atof(arg);
+		reply(c, "ok");
+	} else if ((strcmp(line, "record") == 0) || (strcmp(line, "next") == 0)) {
+		if (!*arg) {
+			reply(c, "error %s needs a file", line);
+		} else if ((line[0] == 'n') && recording) {
+			strcpy(next_file, arg);
+			reply(c, "ok");
+		} else if (start(arg) != 0) {
+			reply(c, "error can't record to %s", arg);
+		} else {
+			reply(c, "ok");
+		}
+	} else if (strcmp(line, "stop") == 0) {
+		if (recording) {
+			next_file[0] = 0;
+			c->waiting = 1;
+			finish();
+		} else {
+			reply(c, "ok idle");
+		}
+	} else if (strcmp(line, "wait") == 0) {
+		if (recording) c->waiting = 1;
+		else reply(c, "ok idle");
+	} else if (strcmp(line, "quit") == 0) {
+		quit = 1;
+		reply(c, "ok");
+	} else {
+		reply(c, "error unknown command %s", line);
+	}
+}
+
+static void on_readable(ctl_client_t *c) {
+	int n = recv(c->fd, c->line + c->len, sizeof(c->line) - 1 - c->len, MSG_DONTWAIT);
+	char *nl;
+
+	if (n <= 0) {
+		if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR))) return;
+		drop(c);
+		return;
+	}
+	c->len += n;
+	c->line[c->len] = 0;
+
+	while ((nl = strchr(c->line, '\n')) != NULL) {
+		int used = nl - c->line + 1;
+
+		*nl = 0;
+		if ((nl > c->line) && (nl[-1] == '\r')) nl[-1] = 0;
+		if (c->line[0]) command(c, c->line);
+		if (c->fd < 0) return;
+		memmove(c->line, c->line + used, c->len - used + 1);
+		c->len -= used;
+	}
+	if (c->len == sizeof(c->line) - 1) {
+		reply(c, "error command too long");
+		drop(c);
+	}
+}
+
+static void on_connect(void) {
+	int fd = accept(listener, NULL, NULL), i;
+
+	if (fd < 0) return;
+	for (i = 0; i < DAEMON_CLIENTS; i++) {
+		if (clients[i].fd < 0) {
+			memset(&clients[i], 0, sizeof(ctl_client_t));
+			clients[i].fd = fd;
+			return;
+		}
+	}
+	close(fd);
+}
+
+static void poll_clients(int timeout_ms) {
+	struct pollfd p[DAEMON_CLIENTS + 1];
+	int idx[DAEMON_CLIENTS + 1];
+	int n = 0, i;
+
+	p[n].fd = listener;
+	p[n].events = POLLIN;
+	idx[n++] = -1;
+	for (i = 0; i < DAEMON_CLIENTS; i++) {
+		if (clients[i].fd < 0) continue;
+		p[n].fd = clients[i].fd;
+		p[n].events = POLLIN;
+		idx[n++] = i;
+	}
+	if (poll(p, n, timeout_ms) <= 0) return;
+
+	for (i = 0; i < n; i++) {
+		if (!p[i].revents) continue;
+		if (idx[i] < 0) on_connect();
+		else on_readable(&clients[idx[i]]);
+	}
+}
+
+static int listen_on(const char *path) {
+	struct sockaddr_un addr = {0};
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	// a socket nobody answers on is left over
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		printf("another daemon listens on %s\n", path);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(fd, DAEMON_CLIENTS) != 0)) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int daemon_run(int fd, const char *path, double r, const recorder_conf_t *c, volatile sig_atomic_t *stop) {
+	int i;
+
+	sensor = fd;
+	rate = r;
+	conf = *c;
+	for (i = 0; i < DAEMON_CLIENTS; i++) clients[i].fd = -1;
+
+	listener = listen_on(path);
+	if (listener < 0) return -1;
+	printf("\tcontrol socket %s\n", path);
+
+	ADNS_read_all(sensor);
+	while (!*stop && !quit) {
+		if (recording) {
+			if (recorder_sample(rec)) samples++;
+			if ((run_time > 0) && (rec->t_ns / 1E9 >= run_time)) {
+				// the next recording takes the next deadline
+				if (next_file[0]) {
+					char path[DAEMON_LINE];
+					strcpy(path, next_file);
+					next_file[0] = 0;
+					if (start(path) != 0) finish();
+				} else {
+					finish();
+				}
+			}
+			poll_clients(0);
+		} else {
+			poll_clients(IDLE_MS);
+		}
+		lat_poll(stdout);
+		trace_poll(stderr);
+		if (recording) sched_wait(&sched);
+	}
+
+	if (recording) finish();
+	for (i = 0; i < DAEMON_CLIENTS; i++) {
+		if (clients[i].fd >= 0) drop(&clients[i]);
+	}
+	close(listener);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,19 @@
+/*
+ * daemon.h
+ *
+ * long running acquisition controlled over a unix socket (adns-ctl)
+ */
+
+#ifndef DAEMON_H_
+#define DAEMON_H_
+#include <signal.h>
+
+#include "recorder.h"
+
+#define DAEMON_SOCKET	"/tmp/adns-connect.sock"
+#define DAEMON_CLIENTS	8
+#define DAEMON_LINE		512		// longest command
+
+int daemon_run(int fd, const char *path, double rate, const recorder_conf_t *conf, volatile sig_atomic_t *stop);
+
+#endif /* DAEMON_H_ */
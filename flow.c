@@ -0,0 +1,148 @@
+/*
+ * flow.c
+ *
+ * Block matching of the central 16x16 block of the previous frame
+ * against every position within +-7 pixel in the current one (SAD with
+ * the pixel.c kernel), refined to sub pixel by fitting a parabola
+ * through the SAD of the best match and its neighbours in x and y.
+ *
+ * The sensor counts the surface movement, the image moves the other
+ * way: content at x in the previous frame is found at x - delta.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "flow.h"
+#include "pixel.h"
+
+#define SPAN	(2 * FLOW_RANGE + 1)
+
+// vertex of the parabola through (-1, l), (0, c), (1, r)
+static float parabola(uint32_t l, uint32_t c, uint32_t r) {
+	int32_t den = (int32_t)l - 2 * (int32_t)c + (int32_t)r;
+
+	if (den <= 0) return 0;
+	return 0.5f * ((int32_t)l - (int32_t)r) / den;
+}
+
+void flow_estimate(const uint8_t *prev, const uint8_t *cur, flow_t *f) {
+	const uint8_t *block = prev + FLOW_RANGE * FLOW_SIZE + FLOW_RANGE;
+	uint32_t sad[SPAN][SPAN];
+	uint32_t best = UINT32_MAX;
+	int bx = 0, by = 0;
+	int x, y;
+
+	for (y = 0; y < SPAN; y++) {
+		for (x = 0; x < SPAN; x++) {
+			sad[y][x] = pixel_sad16(block, FLOW_SIZE, cur + y * FLOW_SIZE + x, FLOW_SIZE);
+			if (sad[y][x] < best) {
+				best = sad[y][x];
+				bx = x;
+				by = y;
+			}
+		}
+	}
+
+	f->sad = best;
+	f->valid = (bx > 0) && (bx < SPAN - 1) && (by > 0) && (by < SPAN - 1);
+	f->dx = bx - FLOW_RANGE;
+	f->dy = by - FLOW_RANGE;
+	if (f->valid) {
+		f->dx += parabola(sad[by][bx - 1], best, sad[by][bx + 1]);
+		f->dy += parabola(sad[by - 1][bx], best, sad[by + 1][bx]);
+	}
+
+	// image displacement to sensor motion
+	f->dx = -f->dx;
+	f->dy = -f->dy;
+}
+
+// 400 cpi is one count per pixel, high resolution (1600 cpi) four
+float flow_counts(float pixel, int res) {
+	return res ? 4 * pixel : pixel;
+}
+
+static void pool_work(flow_pool_t *p) {
+	int k;
+
+	while ((k = atomic_fetch_add(&p->next, 1)) < p->pairs) {
+		flow_estimate(p->frames[k], p->frames[k + 1], &p->out[k]);
+	}
+}
+
+static void *pool_thread(void *arg) {
+	flow_pool_t *p = arg;
+	uint32_t seen = 0;
+
+	pthread_mutex_lock(&p->lock);
+	while (1) {
+		while ((p->generation == seen) && !p->quit) pthread_cond_wait(&p->start, &p->lock);
+		if (p->quit) break;
+		seen = p->generation;
+		pthread_mutex_unlock(&p->lock);
+
+		pool_work(p);
+
+		pthread_mutex_lock(&p->lock);
+		if (--p->busy == 0) pthread_cond_signal(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+int flow_pool_init(flow_pool_t *p, int threads) {
+	memset(p, 0, sizeof(*p));
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->start, NULL);
+	pthread_cond_init(&p->done, NULL);
+
+	// the calling thread works too
+	if (threads > FLOW_THREADS_MAX) threads = FLOW_THREADS_MAX;
+	for (p->threads = 0; p->threads < threads - 1; p->threads++) {
+		if (pthread_create(&p->thread[p->threads], NULL, pool_thread, p) != 0) {
+			flow_pool_free(p);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * estimate the n - 1 displacements between consecutive frames
+ */
+void flow_pool_run(flow_pool_t *p, const uint8_t *const *frames, int n, flow_t *out) {
+	if (n < 2) return;
+
+	pthread_mutex_lock(&p->lock);
+	p->frames = frames;
+	p->out = out;
+	p->pairs = n - 1;
+	atomic_store(&p->next, 0);
+	p->busy = p->threads;
+	p->generation++;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+
+	pool_work(p);
+
+	pthread_mutex_lock(&p->lock);
+	while (p->busy) pthread_cond_wait(&p->done, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void flow_pool_free(flow_pool_t *p) {
+	int i;
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+
+	for (i = 0; i < p->threads; i++) pthread_join(p->thread[i], NULL);
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->start);
+	pthread_cond_destroy(&p->done);
+}
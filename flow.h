@@ -0,0 +1,50 @@
+/*
+ * flow.h
+ *
+ * host side displacement estimation between two raw frames
+ */
+
+#ifndef FLOW_H_
+#define FLOW_H_
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define FLOW_SIZE			30	// frame edge
+#define FLOW_BLOCK			16	// matched block, centered in the previous frame
+#define FLOW_RANGE			((FLOW_SIZE - FLOW_BLOCK) / 2)	// search +-7 pixel
+#define FLOW_THREADS_MAX	8
+
+typedef struct {
+	float dx;				// pixel, same sign as delta_X/delta_Y of the sensor
+	float dy;
+	uint32_t sad;			// of the best integer match
+	uint8_t valid;			// 0: best match on the border of the search range
+} flow_t;
+
+// frame pairs (frames[k], frames[k + 1]) spread over worker threads
+typedef struct {
+	pthread_t thread[FLOW_THREADS_MAX];
+	int threads;			// workers besides the calling thread
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	uint32_t generation;	// bumped for every batch
+	int busy;				// workers still on the batch
+	int quit;
+
+	// current batch
+	const uint8_t *const *frames;
+	flow_t *out;
+	int pairs;
+	atomic_int next;
+} flow_pool_t;
+
+void flow_estimate(const uint8_t *prev, const uint8_t *cur, flow_t *f);
+float flow_counts(float pixel, int res);
+
+int flow_pool_init(flow_pool_t *p, int threads);
+void flow_pool_run(flow_pool_t *p, const uint8_t *const *frames, int n, flow_t *out);
+void flow_pool_free(flow_pool_t *p);
+
+#endif /* FLOW_H_ */
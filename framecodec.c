@@ -0,0 +1,324 @@
+/*
+ * framecodec.c
+ *
+ * Every pixel is predicted and only the 6 bit residual is coded. Delta
+ * frames predict from the previous frame shifted by the rounded flow
+ * estimate (flow.c), pixels moving in over the border and keyframes use
+ * the median edge predictor of JPEG-LS on the pixels already decoded.
+ *
+ * Residuals are zigzag mapped and written as a bit stream of tokens:
+ *	0 + Exp-Golomb(run - 1)		run of zero residuals
+ *	1 + Rice_k(u - 1)			one non-zero residual u
+ * with k chosen per frame from the residual histogram. Frames that would
+ * not get smaller than packed 6 bit pixels are stored packed.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "flow.h"
+#include "framecodec.h"
+#include "pixel.h"
+
+#define EDGE		FRAMECODEC_EDGE
+#define PIXELS		FRAMECODEC_PIXELS
+#define MID			32
+#define RICE_MAX	5
+#define LEVELS		64
+
+typedef struct {
+	uint8_t *p;
+	uint64_t acc;
+	int n;				// bits in acc not yet written
+} bitw_t;
+
+typedef struct {
+	const uint8_t *buf;
+	uint32_t len;
+	uint32_t pos;		// next byte to load
+	uint64_t acc;
+	int n;				// bits loaded and not consumed
+} bitr_t;
+
+// at most 32 bits at a time
+static inline void put(bitw_t *w, uint32_t v, int bits) {
+	w->acc = (w->acc << bits) | v;
+	w->n += bits;
+	while (w->n >= 8) {
+		w->n -= 8;
+		*w->p++ = w->acc >> w->n;
+	}
+}
+
+static inline void put_flush(bitw_t *w) {
+	if (w->n) *w->p++ = w->acc << (8 - w->n);
+	w->n = 0;
+}
+
+static inline void fill(bitr_t *r) {
+	while (r->n <= 56) {
+		// past the end reads zeros, caught by the length check
+		r->acc = (r->acc << 8) | ((r->pos < r->len) ? r->buf[r->pos] : 0);
+		r->pos++;
+		r->n += 8;
+	}
+}
+
+static inline uint32_t get(bitr_t *r, int bits) {
+	uint32_t v;
+
+	if (bits == 0) return 0;
+	if (r->n < bits) fill(r);
+	r->n -= bits;
+	v = (r->acc >> r->n) & ((1ULL << bits) - 1);
+	return v;
+}
+
+// leading bits equal to bit in the loaded window
+static inline int count(bitr_t *r, int bit) {
+	uint64_t top;
+
+	fill(r);
+	top = r->acc << (64 - r->n);
+	if (bit) top = ~top;
+	// the low 64 - n bits of top are set, so this stops within the window
+	return top ? __builtin_clzll(top) : 64;
+}
+
+static inline int min(int a, int b) { return (a < b) ? a : b; }
+static inline int max(int a, int b) { return (a > b) ? a : b; }
+
+// median edge detector over the left, upper and upper left neighbours
+static inline int intra(const uint8_t *p, int x, int y) {
+	int a, b, c;
+
+	if (y == 0) return x ? p[x - 1] : MID;
+	if (x == 0) return p[(y - 1) * EDGE];
+	a = p[y * EDGE + x - 1];
+	b = p[(y - 1) * EDGE + x];
+	c = p[(y - 1) * EDGE + x - 1];
+	if (c >= max(a, b)) return min(a, b);
+	if (c <= min(a, b)) return max(a, b);
+	return a + b - c;
+}
+
+// ref NULL for keyframes
+static inline int predict(const uint8_t *p, const uint8_t *ref, int x, int y, int dx, int dy) {
+	int sx = x + dx, sy = y + dy;
+
+	if ((ref == NULL) || (sx < 0) || (sx >= EDGE) || (sy < 0) || (sy >= EDGE)) return intra(p, x, y);
+	return ref[sy * EDGE + sx];
+}
+
+static inline uint8_t zigzag(int v, int pred) {
+	int s = (((v - pred) & (LEVELS - 1)) ^ MID) - MID;
+	return (s >= 0) ? 2 * s : -2 * s - 1;
+}
+
+static inline uint8_t unzigzag(int u, int pred) {
+	int s = (u & 1) ? -(u >> 1) - 1 : (u >> 1);
+	return (pred + s) & (LEVELS - 1);
+}
+
+static inline int eg_bits(uint32_t n) {
+	return 2 * (31 - __builtin_clz(n + 1)) + 1;
+}
+
+void framecodec_init(framecodec_t *c, uint32_t interval) {
+	memset(c, 0, sizeof(*c));
+	c->interval = interval;
+}
+
+void framecodec_force_key(framecodec_t *c) {
+	c->have_ref = 0;
+}
+
+int framecodec_is_key(const uint8_t *in) {
+	return in[0] != FRAMECODEC_DELTA;
+}
+
+int framecodec_encode(framecodec_t *c, const uint8_t *pixel, uint8_t *out) {
+	uint8_t cur[PIXELS], u[PIXELS];
+	uint32_t hist[LEVELS] = { 0 };
+	uint32_t run_bits = 0, best_bits = UINT32_MAX;
+	const uint8_t *ref = NULL;
+	int dx = 0, dy = 0;
+	int i, k, x, y, rice = 0, size;
+	bitw_t w;
+
+	for (i = 0; i < PIXELS; i++) cur[i] = pixel[i] & (LEVELS - 1);
+
+	if (c->have_ref && (!c->interval || (c->since_key < c->interval))) {
+		flow_t f;
+		flow_estimate(c->ref, cur, &f);
+		if (f.valid) {
+			dx = lrintf(f.dx);
+			dy = lrintf(f.dy);
+		}
+		ref = c->ref;
+	}
+
+	for (y = 0; y < EDGE; y++) {
+		for (x = 0; x < EDGE; x++) {
+			i = y * EDGE + x;
+			u[i] = zigzag(cur[i], predict(cur, ref, x, y, dx, dy));
+		}
+	}
+
+	// size of every Rice parameter from the histogram, runs cost the same
+	for (i = 0; i < PIXELS; ) {
+		if (u[i]) {
+			hist[u[i] - 1]++;
+			i++;
+		} else {
+			int run = 1;
+			while ((i + run < PIXELS) && !u[i + run]) run++;
+			run_bits += 1 + eg_bits(run - 1);
+			i += run;
+		}
+	}
+	for (k = 0; k <= RICE_MAX; k++) {
+		uint32_t bits = run_bits;
+		for (i = 0; i < LEVELS; i++) bits += hist[i] * (2 + k + (i >> k));
+		if (bits < best_bits) {
+			best_bits = bits;
+			rice = k;
+		}
+	}
+
+	size = FRAMECODEC_HEADER + (best_bits + 7) / 8;
+	if (size >= FRAMECODEC_MAX_SIZE) {
+		out[0] = FRAMECODEC_RAW;
+		out[1] = out[2] = out[3] = 0;
+		pixel_pack6(cur, out + FRAMECODEC_HEADER, PIXELS);
+		size = FRAMECODEC_MAX_SIZE;
+	} else {
+		out[0] = ref ? FRAMECODEC_DELTA : FRAMECODEC_KEY;
+		out[1] = (int8_t)dx;
+		out[2] = (int8_t)dy;
+		out[3] = rice;
+
+		w.p = out + FRAMECODEC_HEADER;
+		w.acc = 0;
+		w.n = 0;
+		for (i = 0; i < PIXELS; ) {
+			if (u[i]) {
+				uint32_t v = u[i] - 1, q = v >> rice;
+				put(&w, 1, 1);
+				// unary quotient, at most 62 ones
+				while (q >= 32) {
+					put(&w, UINT32_MAX, 32);
+					q -= 32;
+				}
+				put(&w, (uint32_t)(((1ULL << q) - 1) << 1), q + 1);
+				put(&w, v & ((1U << rice) - 1), rice);
+				i++;
+			} else {
+				uint32_t run = 1, m, len;
+				while ((i + run < PIXELS) && !u[i + run]) run++;
+				m = run;
+				len = 31 - __builtin_clz(m);
+				put(&w, 0, 1 + len);
+				put(&w, m, len + 1);
+				i += run;
+			}
+		}
+		put_flush(&w);
+	}
+
+	if (out[0] == FRAMECODEC_DELTA) {
+		c->since_key++;
+	} else {
+		c->since_key = 1;
+		c->keys++;
+	}
+	memcpy(c->ref, cur, PIXELS);
+	c->have_ref = 1;
+	c->frames++;
+	c->bytes += size;
+	return size;
+}
+
+int framecodec_decode(framecodec_t *c, const uint8_t *in, int len, uint8_t *pixel) {
+	const uint8_t *ref = NULL;
+	int dx, dy, rice, i, x, y;
+	bitr_t r;
+
+	if (len < FRAMECODEC_HEADER) goto corrupt;
+
+	switch (in[0]) {
+	case FRAMECODEC_RAW:
+		if (len != FRAMECODEC_MAX_SIZE) goto corrupt;
+		pixel_unpack6(in + FRAMECODEC_HEADER, pixel, PIXELS);
+		goto done;
+	case FRAMECODEC_DELTA:
+		if (!c->have_ref) return -1;
+		ref = c->ref;
+		break;
+	case FRAMECODEC_KEY:
+		break;
+	default:
+		goto corrupt;
+	}
+
+	dx = (int8_t)in[1];
+	dy = (int8_t)in[2];
+	rice = in[3];
+	if (rice > RICE_MAX) goto corrupt;
+
+	r.buf = in + FRAMECODEC_HEADER;
+	r.len = len - FRAMECODEC_HEADER;
+	r.pos = 0;
+	r.acc = 0;
+	r.n = 0;
+
+	for (i = 0; i < PIXELS; ) {
+		if (get(&r, 1)) {
+			int q = 0, n;
+			// unary quotient
+			while ((n = count(&r, 1)) == r.n) {
+				q += n;
+				r.n = 0;
+				if (q >= LEVELS) goto corrupt;
+			}
+			q += n;
+			r.n -= n + 1;
+			q = (q << rice) + get(&r, rice) + 1;
+			if (q >= LEVELS) goto corrupt;
+
+			y = i / EDGE;
+			x = i - y * EDGE;
+			pixel[i] = unzigzag(q, predict(pixel, ref, x, y, dx, dy));
+			i++;
+		} else {
+			int n = count(&r, 0), run;
+			// longer than a frame
+			if (n > 10) goto corrupt;
+			r.n -= n;
+			run = get(&r, n + 1);
+			if (i + run > PIXELS) goto corrupt;
+			for (y = i / EDGE, x = i - y * EDGE; run > 0; run--, i++) {
+				pixel[i] = predict(pixel, ref, x, y, dx, dy);
+				if (++x == EDGE) {
+					x = 0;
+					y++;
+				}
+			}
+		}
+	}
+	// everything read has to be in the frame
+	if ((uint64_t)r.pos * 8 - r.n > (uint64_t)r.len * 8) goto corrupt;
+
+done:
+	memcpy(c->ref, pixel, PIXELS);
+	c->have_ref = 1;
+	c->frames++;
+	c->bytes += len;
+	if (framecodec_is_key(in)) c->keys++;
+	return 0;
+
+corrupt:
+	c->have_ref = 0;
+	return -2;
+}
@@ -0,0 +1,47 @@
+/*
+ * framecodec.h
+ *
+ * lossless inter-frame compression of 30x30 6 bit frames
+ */
+
+#ifndef FRAMECODEC_H_
+#define FRAMECODEC_H_
+#include <stdint.h>
+
+#include "pixel.h"
+
+#define FRAMECODEC_EDGE		30
+#define FRAMECODEC_PIXELS	(FRAMECODEC_EDGE * FRAMECODEC_EDGE)
+#define FRAMECODEC_HEADER	4
+// raw packed frames bound the encoded size
+#define FRAMECODEC_MAX_SIZE	(FRAMECODEC_HEADER + PIXEL_PACKED_SIZE(FRAMECODEC_PIXELS))
+#define FRAMECODEC_INTERVAL	32	// default frames from one keyframe to the next
+
+// first byte of an encoded frame
+#define FRAMECODEC_KEY		0	// intra coded, no reference needed
+#define FRAMECODEC_DELTA	1	// coded against the motion compensated previous frame
+#define FRAMECODEC_RAW		2	// packed 6 bit pixels, when coding does not pay off
+
+typedef struct {
+	uint8_t ref[FRAMECODEC_PIXELS];	// previous frame, same on both sides
+	int have_ref;
+	uint32_t interval;		// 0: keyframes only when forced
+	uint32_t since_key;
+
+	// statistics
+	uint64_t frames;
+	uint64_t keys;			// incl. raw frames
+	uint64_t bytes;
+} framecodec_t;
+
+void framecodec_init(framecodec_t *c, uint32_t interval);
+// the next frame is coded without reference, e.g. for a new receiver
+void framecodec_force_key(framecodec_t *c);
+// returns the encoded size, at most FRAMECODEC_MAX_SIZE
+int framecodec_encode(framecodec_t *c, const uint8_t *pixel, uint8_t *out);
+// returns 0, < 0 on corrupt data or a delta frame without its reference
+int framecodec_decode(framecodec_t *c, const uint8_t *in, int len, uint8_t *pixel);
+// whether an encoded frame can be decoded on its own
+int framecodec_is_key(const uint8_t *in);
+
+#endif /* FRAMECODEC_H_ */
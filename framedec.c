@@ -0,0 +1,111 @@
+/*
+ * framedec.c
+ *
+ * decodes a frame stream (adns-connect -G, --packed or --delta) into
+ * records with one byte per pixel, for offline analysis
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "framecodec.h"
+#include "framestream.h"
+#include "pixel.h"
+
+static void print_usage(const char *prog)
+{
+	printf("Usage: %s <frame stream> [raw frame stream]\n", prog);
+	puts("  without output only checks the stream and reports the decode time\n");
+	exit(1);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *in, *out = NULL;
+	frame_t f, raw;
+	framecodec_t codec;
+	uint64_t frames = 0, coded = 0, bad = 0, lost = 0, bytes = 0, t_decode = 0;
+	size_t n;
+
+	if ((argc < 2) || (argc > 3)) print_usage(argv[0]);
+
+	in = fopen(argv[1], "rb");
+	if (in == NULL) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	if (argc == 3) {
+		out = fopen(argv[2], "wb");
+		if (out == NULL) {
+			perror(argv[2]);
+			return EXIT_FAILURE;
+		}
+	}
+	framecodec_init(&codec, 0);
+
+	while ((n = fread(&f, 1, FRAME_HEADER_SIZE, in)) == FRAME_HEADER_SIZE) {
+		uint32_t size = FRAME_DATA_SIZE(&f);
+		uint64_t t0;
+		int ret = 0;
+
+		if ((size > ADNS_FRAME_PIXELS) || (fread(f.pixel, 1, size, in) != size)) {
+			fprintf(stderr, "warning: truncated or broken record after frame %llu\n", (unsigned long long)frames);
+			break;
+		}
+		bytes += FRAME_HEADER_SIZE + size;
+		frames++;
+
+		memcpy(&raw, &f, FRAME_HEADER_SIZE);
+		raw.pixels = ADNS_FRAME_PIXELS;
+		t0 = now_ns();
+		if (f.pixels & FRAME_CODED) {
+			ret = framecodec_decode(&codec, f.pixel, size, raw.pixel);
+			coded++;
+		} else if (size == PIXEL_PACKED_SIZE(ADNS_FRAME_PIXELS)) {
+			pixel_unpack6(f.pixel, raw.pixel, ADNS_FRAME_PIXELS);
+		} else if (size == ADNS_FRAME_PIXELS) {
+			memcpy(raw.pixel, f.pixel, ADNS_FRAME_PIXELS);
+		} else {
+			ret = -2;
+		}
+		t_decode += now_ns() - t0;
+
+		if (ret == -1) {
+			// delta frame after a broken one, until the next keyframe
+			lost++;
+			continue;
+		} else if (ret < 0) {
+			fprintf(stderr, "warning: frame %u can't be decoded\n", f.seq);
+			bad++;
+			continue;
+		}
+		if ((out != NULL) && (fwrite(&raw, 1, FRAME_HEADER_SIZE + ADNS_FRAME_PIXELS, out)
+				!= FRAME_HEADER_SIZE + ADNS_FRAME_PIXELS)) {
+			perror(argv[2]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (n) fprintf(stderr, "warning: ignored truncated record at the end\n");
+
+	fprintf(stderr, "%llu frames, %llu coded, %.1f bytes/frame, decoded in %.1f us/frame\n",
+		(unsigned long long)frames, (unsigned long long)coded,
+		frames ? (double)bytes / frames : 0.0, frames ? t_decode / 1E3 / frames : 0.0);
+	if (lost) fprintf(stderr, "warning: %llu frames lost waiting for a keyframe\n", (unsigned long long)lost);
+
+	fclose(in);
+	if ((out != NULL) && (fclose(out) != 0)) {
+		perror(argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	return (bad || lost) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
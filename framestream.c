@@ -0,0 +1,212 @@
+/*
+ * framestream.c
+ *
+ * Frames are captured straight into a slot of a small SPSC pool and a
+ * sender thread writes them out, so writing frame N overlaps capturing
+ * frame N+1. When the sender falls behind the capture still happens, into
+ * a scratch frame, and is counted as dropped; the sequence numbers in the
+ * stream show where.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "framestream.h"
+#include "pixel.h"
+#include "sched.h"
+
+#define IDLE_NS		1000000		// poll period of an empty pool
+
+static int write_all(int out, const void *buf, size_t len) {
+	const uint8_t *p = buf;
+
+	while (len > 0) {
+		ssize_t n = write(out, p, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// displacements between the previous frame and each frame of the batch
+static void flow_batch(framestream_t *s, const frame_t *f, uint32_t n) {
+	uint32_t i, k = 0;
+
+	if (s->have_prev) s->flow_frames[k++] = s->flow_prev;
+	for (i = 0; i < n; i++) s->flow_frames[k++] = f[i].pixel;
+	flow_pool_run(&s->pool, s->flow_frames, k, s->flow_out);
+
+	// output k - 1 pairs, each with the time of its later frame
+	for (i = n - (k - 1); i < n; i++) {
+		const flow_t *r = &s->flow_out[i - (n - (k - 1))];
+		if (!r->valid) s->flow_invalid++;
+		fprintf(s->flow, "%f\t%u\t%.2f\t%.2f\t%u\t%u\n", f[i].t_ns / 1E9, f[i].seq,
+			flow_counts(r->dx, s->res), flow_counts(r->dy, s->res), r->sad, r->valid);
+	}
+
+	memcpy(s->flow_prev, f[n - 1].pixel, ADNS_FRAME_PIXELS);
+	s->have_prev = 1;
+}
+
+static void *sender_thread(void *arg) {
+	framestream_t *s = arg;
+	const struct timespec idle = { 0, IDLE_NS };
+
+	while (1) {
+		int running = atomic_load_explicit(&s->running, memory_order_acquire);
+		uint32_t n, i;
+		void *p;
+
+		n = ring_peek(&s->ring, &p);
+		if (n) {
+			frame_t *f = p;
+			if (s->flow != NULL) flow_batch(s, f, n);
+			for (i = 0; i < n; i++) {
+				const frame_t *w = &f[i];
+				if (s->format == FRAMESTREAM_PACKED6) {
+					memcpy(&s->out_frame, w, FRAME_HEADER_SIZE);
+					pixel_pack6(w->pixel, s->out_frame.pixel, ADNS_FRAME_PIXELS);
+					s->out_frame.pixels = PIXEL_PACKED_SIZE(ADNS_FRAME_PIXELS);
+					w = &s->out_frame;
+				} else if (s->format == FRAMESTREAM_DELTA) {
+					memcpy(&s->out_frame, w, FRAME_HEADER_SIZE);
+					s->out_frame.pixels = FRAME_CODED
+						| framecodec_encode(&s->codec, w->pixel, s->out_frame.pixel);
+					w = &s->out_frame;
+				}
+				if (!atomic_load(&s->error) && (write_all(s->out, w, FRAME_HEADER_SIZE + FRAME_DATA_SIZE(w)) != 0)) {
+					atomic_store(&s->error, 1);
+				}
+			}
+			ring_release(&s->ring, n);
+			s->written += n;
+		} else if (!running) {
+			break;
+		} else {
+			nanosleep(&idle, NULL);
+		}
+	}
+	return NULL;
+}
+
+int framestream_start(framestream_t *s, int out, int format, FILE *flow, int res, uint32_t buffers) {
+	memset(s, 0, sizeof(*s));
+	s->out = out;
+	s->format = format;
+	framecodec_init(&s->codec, FRAMECODEC_INTERVAL);
+	s->flow = flow;
+	s->res = res;
+
+	if (ring_init(&s->ring, sizeof(frame_t), buffers) != 0) return -1;
+
+	if (flow != NULL) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		s->flow_frames = malloc((buffers + 1) * sizeof(*s->flow_frames));
+		s->flow_out = malloc(buffers * sizeof(*s->flow_out));
+		if ((s->flow_frames == NULL) || (s->flow_out == NULL)
+				|| (flow_pool_init(&s->pool, (cpus > 0) ? cpus : 1) != 0)) {
+			free(s->flow_frames);
+			free(s->flow_out);
+			ring_free(&s->ring);
+			return -1;
+		}
+		fprintf(flow, "time\tseq\tdelta_X\tdelta_Y\tsad\tvalid\n");
+	}
+
+	s->t0 = sched_now();
+	atomic_store(&s->running, 1);
+	if (pthread_create(&s->thread, NULL, sender_thread, s) != 0) {
+		ring_free(&s->ring);
+		if (flow != NULL) {
+			flow_pool_free(&s->pool);
+			free(s->flow_frames);
+			free(s->flow_out);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * capture one frame, returns < 0 if the sensor did not deliver one
+ */
+int framestream_capture(framestream_t *s, int fd) {
+	frame_t *f = ring_reserve(&s->ring);
+	int pool = (f != NULL);
+	pixel_stats_t st;
+	int ret;
+
+	if (!pool) f = &s->scratch;
+
+	f->t_ns = sched_now() - s->t0;
+	f->seq = s->seq++;
+	f->frame_period = adns.frame_period;
+	f->pixels = ADNS_FRAME_PIXELS;
+	ret = ADNS_capture_frame(fd, f->pixel, &st);
+	if (ret < ADNS_FRAME_PIXELS) {
+		s->invalid++;
+		return -1;
+	}
+
+	if (!s->captured || (st.min < s->pixel_min)) s->pixel_min = st.min;
+	if (!s->captured || (st.max > s->pixel_max)) s->pixel_max = st.max;
+	s->pixel_sum += st.sum;
+	s->captured++;
+	if (pool) ring_commit(&s->ring);
+	else s->dropped++;
+	return 0;
+}
+
+int framestream_failed(framestream_t *s) {
+	return atomic_load(&s->error);
+}
+
+void framestream_stop(framestream_t *s) {
+	atomic_store_explicit(&s->running, 0, memory_order_release);
+	pthread_join(s->thread, NULL);
+	ring_free(&s->ring);
+	if (s->flow != NULL) {
+		flow_pool_free(&s->pool);
+		free(s->flow_frames);
+		free(s->flow_out);
+	}
+}
+
+void framestream_report(const framestream_t *s, FILE *f) {
+	double dt = (sched_now() - s->t0) / 1E9;
+
+	fprintf(f, "\tcaptured %llu frames in %.3f s (%.1f fps), sent %llu, %u buffers\n",
+		(unsigned long long)s->captured, dt, dt > 0 ? s->captured / dt : 0.0,
+		(unsigned long long)s->written, s->ring.size);
+	if (s->captured) {
+		fprintf(f, "\tpixel min %u, max %u, mean %.1f\n", s->pixel_min, s->pixel_max,
+			(double)s->pixel_sum / (s->captured * ADNS_FRAME_PIXELS));
+	}
+	if (s->codec.frames) {
+		fprintf(f, "\tdelta coded %.1f bytes/frame (%.1f:1), %llu keyframes\n",
+			(double)s->codec.bytes / s->codec.frames,
+			(double)s->codec.frames * ADNS_FRAME_PIXELS / s->codec.bytes,
+			(unsigned long long)s->codec.keys);
+	}
+	if (s->dropped) {
+		fprintf(f, "\twarning: %llu frames dropped, all buffers in use\n", (unsigned long long)s->dropped);
+	}
+	if (s->invalid) {
+		fprintf(f, "\twarning: %llu captures without start of frame\n", (unsigned long long)s->invalid);
+	}
+	if (s->flow_invalid) {
+		fprintf(f, "\twarning: %llu flow estimates hit the search range\n", (unsigned long long)s->flow_invalid);
+	}
+	if (atomic_load((atomic_int *)&s->error)) fprintf(f, "\twarning: write error, stream aborted\n");
+}
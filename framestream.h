@@ -0,0 +1,81 @@
+/*
+ * framestream.h
+ *
+ * back to back frame capture with a background sender
+ */
+
+#ifndef FRAMESTREAM_H_
+#define FRAMESTREAM_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "adns.h"
+#include "flow.h"
+#include "framecodec.h"
+#include "ring.h"
+
+#define FRAMESTREAM_BUFFERS	4	// one being captured, up to three queued
+
+// pixel data written per frame
+#define FRAMESTREAM_RAW		0	// one byte per pixel
+#define FRAMESTREAM_PACKED6	1	// 4 pixels in 3 bytes (pixel.h)
+#define FRAMESTREAM_DELTA	2	// inter-frame coded (framecodec.h)
+
+// record written per frame, host byte order
+typedef struct __attribute__((packed)) {
+	uint64_t t_ns;			// capture trigger, since stream start
+	uint32_t seq;			// capture number, gaps are dropped or failed captures
+	uint16_t frame_period;	// 24 MHz clocks
+	uint16_t pixels;		// bytes of pixel data, ADNS_FRAME_PIXELS, packed size or FRAME_CODED | size
+	uint8_t pixel[ADNS_FRAME_PIXELS];
+} frame_t;
+
+#define FRAME_HEADER_SIZE	offsetof(frame_t, pixel)
+#define FRAME_CODED			0x8000	// framecodec data, decoded in stream order
+#define FRAME_DATA_SIZE(f)	((f)->pixels & ~FRAME_CODED)
+
+typedef struct {
+	ring_t ring;
+	pthread_t thread;
+	int out;				// output file descriptor
+	int format;				// FRAMESTREAM_RAW, _PACKED6 or _DELTA
+	atomic_int running;
+	frame_t scratch;		// capture target while the pool is full
+	uint64_t t0;
+
+	// producer side
+	uint32_t seq;
+	uint64_t captured;
+	uint64_t dropped;		// captured while all buffers were in use
+	uint64_t invalid;		// captures without start of frame
+	uint64_t pixel_sum;		// over all captured frames
+	uint8_t pixel_min;
+	uint8_t pixel_max;
+
+	// consumer side
+	frame_t out_frame;		// packed or coded copy
+	framecodec_t codec;
+	uint64_t written;
+	atomic_int error;
+
+	// optional flow estimates between consecutive frames, as TSV
+	FILE *flow;
+	int res;				// counts per pixel as the sensor (-X)
+	flow_pool_t pool;
+	const uint8_t **flow_frames;	// previous frame and the batch
+	flow_t *flow_out;
+	uint8_t flow_prev[ADNS_FRAME_PIXELS];
+	int have_prev;
+	uint64_t flow_invalid;
+} framestream_t;
+
+int framestream_start(framestream_t *s, int out, int format, FILE *flow, int res, uint32_t buffers);
+int framestream_capture(framestream_t *s, int fd);
+int framestream_failed(framestream_t *s);
+void framestream_stop(framestream_t *s);
+void framestream_report(const framestream_t *s, FILE *f);
+
+#endif /* FRAMESTREAM_H_ */
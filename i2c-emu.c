@@ -0,0 +1,259 @@
+/*
+ * i2c-emu.c
+ *
+ * Servo and brightness board emulator used as i2c transport
+ *
+ * The board has a byte register file with an auto-incrementing register
+ * pointer: the first byte of a write message sets the pointer, further
+ * bytes are written from there, read messages read from the pointer on.
+ * Words are stored low byte first:
+ *	0x32	servo position (w), moves between 0 and max at speed counts/ms
+ *	0x36	servo maximum (w)
+ *	0x39	servo speed (b), 0 holds the position
+ *	0x72	brightness of four photo diodes along the servo travel (4 w)
+ *
+ * Time on the wire is modelled at 100 kHz per start, address, data byte
+ * with its acknowledge and stop, so access patterns can be compared
+ * without the board.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "i2c-emu.h"
+
+#define EMU_MAX			4
+#define BOARD_ADDRESS	0x18
+
+#define REG_POSITION	0x32
+#define REG_MAX			0x36
+#define REG_SPEED		0x39
+#define REG_BRIGHT		0x72
+#define BRIGHT_CHANNELS	4
+#define BRIGHT_MAX		1000
+
+#define BIT_NS			10000	// 100 kHz
+#define STEP_NS			1000000	// servo speed unit
+
+typedef struct {
+	int fd;
+	int realtime;
+	uint64_t t_base;		// CLOCK_MONOTONIC at open
+	uint64_t now;			// emulator time
+	uint64_t t_update;		// time the board state is valid for
+
+	uint8_t reg[0x100];
+	uint8_t ptr;
+
+	int32_t position;
+	int32_t dir;
+	uint64_t step_rest;		// ns towards the next count
+
+	i2c_emu_stats_t stats;
+} i2c_emu_t;
+
+static i2c_emu_t *emu_tab[EMU_MAX];
+
+static uint64_t monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static i2c_emu_t *emu_lookup(int fd) {
+	int i;
+	for (i = 0; i < EMU_MAX; i++) {
+		if (emu_tab[i] && (emu_tab[i]->fd == fd)) return emu_tab[i];
+	}
+	return NULL;
+}
+
+static uint16_t reg_w(const i2c_emu_t *e, uint8_t r) {
+	return e->reg[r] | (e->reg[(uint8_t)(r + 1)] << 8);
+}
+
+static void set_w(i2c_emu_t *e, uint8_t r, uint16_t v) {
+	e->reg[r] = v;
+	e->reg[(uint8_t)(r + 1)] = v >> 8;
+}
+
+// brightness falls off linearly with the distance of the servo to a diode
+static void emu_bright(i2c_emu_t *e) {
+	int32_t max = reg_w(e, REG_MAX), i;
+
+	if (max == 0) max = 1;
+	for (i = 0; i < BRIGHT_CHANNELS; i++) {
+		int32_t d = abs(e->position - max * (2 * i + 1) / (2 * BRIGHT_CHANNELS));
+		int32_t b = BRIGHT_MAX - (int32_t)((int64_t)d * BRIGHT_MAX * BRIGHT_CHANNELS / max);
+		set_w(e, REG_BRIGHT + 2 * i, (b > 0) ? b : 0);
+	}
+}
+
+// servo travel up to now, back and forth between 0 and max
+static void emu_update(i2c_emu_t *e) {
+	uint64_t steps;
+	int32_t max = reg_w(e, REG_MAX);
+
+	if (e->now > e->t_update) {
+		e->step_rest += e->now - e->t_update;
+		e->t_update = e->now;
+	}
+	steps = e->step_rest / STEP_NS;
+	e->step_rest %= STEP_NS;
+
+	if (e->reg[REG_SPEED] && (max > 0)) {
+		uint64_t travel = (steps * e->reg[REG_SPEED]) % (2 * (uint64_t)max);
+		while (travel--) {
+			if ((e->position + e->dir < 0) || (e->position + e->dir > max)) e->dir = -e->dir;
+			e->position += e->dir;
+		}
+	}
+	set_w(e, REG_POSITION, e->position);
+	emu_bright(e);
+}
+
+static void emu_written(i2c_emu_t *e, uint8_t first, uint16_t len) {
+	uint8_t r;
+	uint16_t k;
+
+	for (k = 0; k < len; k++) {
+		r = first + k;
+		if ((r == REG_POSITION) || (r == REG_POSITION + 1)) {
+			e->position = reg_w(e, REG_POSITION);
+			e->dir = 1;
+		}
+	}
+	if (e->position > reg_w(e, REG_MAX)) e->position = reg_w(e, REG_MAX);
+	emu_update(e);
+}
+
+static int emu_transfer(int fd, struct i2c_msg *msgs, unsigned int n) {
+	i2c_emu_t *e = emu_lookup(fd);
+	uint64_t bits = 1;		// stop
+	unsigned int i;
+	uint16_t k;
+
+	if (e == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (msgs[i].addr != BOARD_ADDRESS) {
+			errno = ENXIO;
+			return -1;
+		}
+	}
+
+	if (e->realtime) {
+		uint64_t t = monotonic_ns() - e->t_base;
+		if (t > e->now) e->now = t;
+	}
+	emu_update(e);
+	e->stats.transfers++;
+
+	for (i = 0; i < n; i++) {
+		struct i2c_msg *m = &msgs[i];
+
+		if (m->flags & I2C_M_RD) {
+			for (k = 0; k < m->len; k++) m->buf[k] = e->reg[e->ptr++];
+		} else if (m->len > 0) {
+			uint8_t first = m->buf[0];
+
+			e->ptr = first;
+			for (k = 1; k < m->len; k++) e->reg[e->ptr++] = m->buf[k];
+			if (m->len > 1) emu_written(e, first, m->len - 1);
+		}
+		// (re)start, address and data, each byte acknowledged
+		bits += 1 + 9 + 9 * m->len;
+		e->stats.messages++;
+		e->stats.bytes += m->len;
+	}
+	e->now += bits * BIT_NS;
+	e->stats.bus_ns += bits * BIT_NS;
+
+	if (e->realtime) {
+		// like i2c-dev, return when the transaction is over
+		uint64_t t = e->t_base + e->now;
+		struct timespec ts = { t / 1000000000ULL, t % 1000000000ULL };
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+	}
+	return n;
+}
+
+static int emu_open(const char *device, int address) {
+	int i;
+	i2c_emu_t *e;
+
+	if (address != BOARD_ADDRESS) return -1;
+	for (i = 0; i < EMU_MAX; i++) {
+		if (emu_tab[i] == NULL) break;
+	}
+	if (i == EMU_MAX) return -1;
+
+	e = calloc(1, sizeof(*e));
+	if (e == NULL) return -1;
+
+	// a real descriptor keeps close() in the callers valid
+	e->fd = open("/dev/null", O_RDWR);
+	if (e->fd < 0) {
+		free(e);
+		return -1;
+	}
+
+	e->realtime = 1;
+	e->t_base = monotonic_ns();
+	e->dir = 1;
+	set_w(e, REG_MAX, 6000);
+	emu_update(e);
+
+	emu_tab[i] = e;
+	return e->fd;
+}
+
+static void emu_close(int fd) {
+	int i;
+	for (i = 0; i < EMU_MAX; i++) {
+		if (emu_tab[i] && (emu_tab[i]->fd == fd)) {
+			close(emu_tab[i]->fd);
+			free(emu_tab[i]);
+			emu_tab[i] = NULL;
+		}
+	}
+}
+
+const i2c_transport_t i2c_transport_emu = {
+	.name = "emu",
+	.open = emu_open,
+	.transfer = emu_transfer,
+	.close = emu_close,
+};
+
+int I2C_emu_set_realtime(int fd, int realtime) {
+	i2c_emu_t *e = emu_lookup(fd);
+	if (e == NULL) return -1;
+
+	e->realtime = realtime;
+	if (realtime) e->t_base = monotonic_ns() - e->now;
+	return 0;
+}
+
+int I2C_emu_get_stats(int fd, i2c_emu_stats_t *stats) {
+	i2c_emu_t *e = emu_lookup(fd);
+	if (e == NULL) return -1;
+
+	*stats = e->stats;
+	return 0;
+}
+
+int I2C_emu_reset_stats(int fd) {
+	i2c_emu_t *e = emu_lookup(fd);
+	if (e == NULL) return -1;
+
+	memset(&e->stats, 0, sizeof(e->stats));
+	return 0;
+}
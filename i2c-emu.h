@@ -0,0 +1,28 @@
+/*
+ * i2c-emu.h
+ *
+ * in-process emulation of the servo and brightness board at 0x18
+ */
+
+#ifndef I2C_EMU_H_
+#define I2C_EMU_H_
+#include <stdint.h>
+
+#include "i2c-transport.h"
+
+// i2c device name selecting the emulated board
+#define I2C_EMU_DEVICE	"emu"
+
+typedef struct {
+	uint64_t transfers;		// I2C_RDWR calls
+	uint64_t messages;		// i2c_msg entries
+	uint64_t bytes;			// data bytes, without addresses
+	uint64_t bus_ns;		// modelled wire time incl. start, address and stop
+} i2c_emu_stats_t;
+
+// realtime != 0: a transfer returns after its modelled bus time (default)
+int I2C_emu_set_realtime(int fd, int realtime);
+int I2C_emu_get_stats(int fd, i2c_emu_stats_t *stats);
+int I2C_emu_reset_stats(int fd);
+
+#endif /* I2C_EMU_H_ */
@@ -0,0 +1,30 @@
+/*
+ * i2c-transport.h
+ *
+ * backend interface below the i2c access functions
+ */
+
+#ifndef I2C_TRANSPORT_H_
+#define I2C_TRANSPORT_H_
+#include <stdint.h>
+#include <linux/i2c.h>
+
+typedef struct {
+	const char *name;
+	// returns a file descriptor identifying the opened bus, < 0 on error
+	int (*open)(const char *device, int address);
+	// same semantics as ioctl(fd, I2C_RDWR): one combined transaction,
+	// repeated start between the messages, returns the messages transferred
+	int (*transfer)(int fd, struct i2c_msg *msgs, unsigned int n);
+	void (*close)(int fd);
+} i2c_transport_t;
+
+// real hardware using the i2c-dev driver
+extern const i2c_transport_t i2c_transport_dev;
+// in-process servo and brightness board (i2c-emu.c)
+extern const i2c_transport_t i2c_transport_emu;
+
+const i2c_transport_t *I2C_get_transport(void);
+void I2C_set_transport(const i2c_transport_t *t);
+
+#endif /* I2C_TRANSPORT_H_ */
@@ -6,48 +6,201 @@
  */
 
 #include <unistd.h>			// read, write
-#include <linux/i2c-dev.h>	// I2C_SLAVE
+#include <linux/i2c-dev.h>	// I2C_SLAVE, I2C_RDWR
 #include <fcntl.h>			//open
 #include <sys/ioctl.h>		// ioctl
 #include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "i2c.h"
+#include "i2c-emu.h"
+#include "i2c-transport.h"
+#include "latency.h"
 
 int i2c = 0;
-uint8_t buf[10];
+static uint16_t slave;
+static const i2c_transport_t *transport = &i2c_transport_dev;
+// the aux thread reads while the main thread drives the servo
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
-int i2cInit(const char* dev, int address) {
-	i2c = open(dev, O_RDWR);
-	if (i2c < 0) return 1;
+static int dev_open(const char *device, int address) {
+	int fd = open(device, O_RDWR);
+	if (fd < 0) return -1;
+
+	if (ioctl(fd, I2C_SLAVE, address)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int dev_transfer(int fd, struct i2c_msg *msgs, unsigned int n) {
+	struct i2c_rdwr_ioctl_data data = { msgs, n };
+	return ioctl(fd, I2C_RDWR, &data);
+}
+
+static void dev_close(int fd) {
+	close(fd);
+}
+
+const i2c_transport_t i2c_transport_dev = {
+	.name = "i2c-dev",
+	.open = dev_open,
+	.transfer = dev_transfer,
+	.close = dev_close,
+};
+
+const i2c_transport_t *I2C_get_transport(void) {
+	return transport;
+}
 
-	if (ioctl(i2c, I2C_SLAVE, address)) return 1;
+void I2C_set_transport(const i2c_transport_t *t) {
+	transport = t;
+}
+
+int i2cInit(const char* dev, int address) {
+	if (strcmp(dev, I2C_EMU_DEVICE) == 0) transport = &i2c_transport_emu;
+	slave = address;
+	i2c = transport->open(dev, address);
+	if (i2c < 0) {
+		i2c = 0;
+		return 1;
+	}
 	return 0;
 }
 
+static int transfer(struct i2c_msg *msgs, unsigned int n) {
+	int ret;
+
+	pthread_mutex_lock(&lock);
+	ret = transport->transfer(i2c, msgs, n);
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+int i2cFd(void) {
+	return i2c ? i2c : -1;
+}
+
+// register address, repeated start and the value in one transaction
+static int read_reg(uint8_t address, uint8_t *val, int len) {
+	struct i2c_msg msg[2] = {
+		{ slave, 0, 1, &address },
+		{ slave, I2C_M_RD, len, val },
+	};
+
+	if (!i2c) return 1;
+	return (transfer(msg, 2) == 2) ? 0 : 1;
+}
+
+static int write_reg(uint8_t address, const uint8_t *val, int len) {
+	uint8_t buf[5] = { address };
+	struct i2c_msg msg = { slave, 0, len + 1, buf };
+
+	if (!i2c) return 1;
+	memcpy(buf + 1, val, len);
+	return (transfer(&msg, 1) == 1) ? 0 : 1;
+}
+
 uint16_t i2cReadW(uint8_t address) {
-	if (i2c) {
-		buf[0] = address;
-		write(i2c, buf, 1);
-		read(i2c, buf, 2);
+	uint8_t buf[2];
+	uint64_t t_lat = lat_start();
+	int ret = read_reg(address, buf, 2);
 
-		return (uint16_t) ((buf[1] << 8) | buf[0]);
-	} else return -1;
+	lat_end(LAT_I2C_READ, t_lat);
+	if (ret) return -1;
+	return (uint16_t) ((buf[1] << 8) | buf[0]);
 }
 
 uint32_t i2cReadL(uint8_t address) {
-	if (i2c) {
-		buf[0] = address;
-		write(i2c, buf, 1);
-		read(i2c, buf, 4);
+	uint8_t buf[4];
 
-		return (uint32_t) ((buf[3] << 24) | (buf[2] << 16) | (buf[1] << 8) | buf[0] );
-	} else return -1;
+	if (read_reg(address, buf, 4)) return -1;
+	return (uint32_t) ((buf[3] << 24) | (buf[2] << 16) | (buf[1] << 8) | buf[0] );
 }
 
 uint8_t i2cReadB(uint8_t address) {
-	if (i2c) {
-		buf[0] = address;
-		write(i2c, buf, 1);
-		read(i2c, buf, 1);
+	uint8_t buf[1];
+
+	if (read_reg(address, buf, 1)) return -1;
+	return buf[0];
+}
+
+// SMBus word order, low byte first like the reads
+int i2cWriteW(uint8_t address, uint16_t value) {
+	uint8_t buf[2] = { value, value >> 8 };
+	return write_reg(address, buf, 2);
+}
+
+int i2cWriteB(uint8_t address, uint8_t value) {
+	return write_reg(address, &value, 1);
+}
+
+void i2cBatchInit(i2c_batch_t *b) {
+	memset(b, 0, sizeof(*b));
+}
+
+int i2cBatchAdd(i2c_batch_t *b, uint8_t address, int len) {
+	if ((b->n == I2C_BATCH_MAX) || ((len != 1) && (len != 2) && (len != 4))) return -1;
+	b->reg[b->n] = address;
+	b->len[b->n] = len;
+	b->runs = 0;
+	return b->n++;
+}
+
+int i2cBatchPlan(i2c_batch_t *b) {
+	uint8_t order[I2C_BATCH_MAX];
+	int i, k, r = -1, used = 0;
+	unsigned end = 0;
+
+	// by register address, a handful of registers
+	for (i = 0; i < b->n; i++) {
+		for (k = i; (k > 0) && (b->reg[order[k - 1]] > b->reg[i]); k--) order[k] = order[k - 1];
+		order[k] = i;
+	}
+
+	for (i = 0; i < b->n; i++) {
+		int idx = order[i];
+		unsigned reg = b->reg[idx], last = reg + b->len[idx];
+
+		// contiguous or overlapping registers continue the burst read
+		if ((r < 0) || (reg > end)) {
+			r++;
+			b->start[r] = reg;
+			b->msg[2 * r] = (struct i2c_msg){ slave, 0, 1, &b->start[r] };
+			b->msg[2 * r + 1] = (struct i2c_msg){ slave, I2C_M_RD, 0, b->data + used };
+			end = reg;
+		}
+		if (last > end) {
+			used += last - end;
+			end = last;
+		}
+		if (used > I2C_BATCH_BYTES) return -1;
+		b->msg[2 * r + 1].len = end - b->start[r];
+		b->ofs[idx] = (b->msg[2 * r + 1].buf - b->data) + (reg - b->start[r]);
+	}
+	b->runs = r + 1;
+	return b->runs;
+}
+
+int i2cBatchRead(i2c_batch_t *b) {
+	uint64_t t_lat;
+	int ret;
+
+	if (!i2c) return 1;
+	if ((b->runs == 0) && (i2cBatchPlan(b) < 1)) return 1;
+	t_lat = lat_start();
+	ret = transfer(b->msg, 2 * b->runs);
+	lat_end(LAT_I2C_BATCH, t_lat);
+	return (ret == 2 * b->runs) ? 0 : 1;
+}
+
+uint32_t i2cBatchValue(const i2c_batch_t *b, int idx) {
+	const uint8_t *p = b->data + b->ofs[idx];
+	uint32_t val = 0;
+	int k;
 
-		return buf[0];
-	} else return -1;
+	for (k = b->len[idx] - 1; k >= 0; k--) val = (val << 8) | p[k];
+	return val;
 }
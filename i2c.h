@@ -8,10 +8,45 @@
 #ifndef I2C_H_
 #define I2C_H_
 #include <stdint.h>
+#include <linux/i2c.h>
 
+#define I2C_BATCH_MAX	16		// registers of a batch
+#define I2C_BATCH_BYTES	64
+
+/*
+ * registers read together in one I2C_RDWR transaction, contiguous ones
+ * merged into one burst read of the auto-incrementing register pointer
+ */
+typedef struct {
+	int n;
+	uint8_t reg[I2C_BATCH_MAX];
+	uint8_t len[I2C_BATCH_MAX];
+	uint8_t ofs[I2C_BATCH_MAX];	// of the value in data
+	int runs;					// burst reads, set by i2cBatchPlan
+	uint8_t start[I2C_BATCH_MAX];
+	struct i2c_msg msg[2 * I2C_BATCH_MAX];
+	uint8_t data[I2C_BATCH_BYTES];
+} i2c_batch_t;
+
+// returns 0 on success, dev I2C_EMU_DEVICE opens the emulated board
 int i2cInit(const char* dev, int address);
 uint32_t i2cReadL(uint8_t address);
 uint16_t i2cReadW(uint8_t address);
 uint8_t i2cReadB(uint8_t address);
+// 0 on success
+int i2cWriteW(uint8_t address, uint16_t value);
+int i2cWriteB(uint8_t address, uint8_t value);
+
+void i2cBatchInit(i2c_batch_t *b);
+// len 1 (b), 2 (w) or 4 (l), returns the index of the value or -1 if full
+int i2cBatchAdd(i2c_batch_t *b, uint8_t address, int len);
+// merges the registers into burst reads, returns their number or -1
+int i2cBatchPlan(i2c_batch_t *b);
+// 0 on success
+int i2cBatchRead(i2c_batch_t *b);
+// value idx of the last read, little endian like the single reads
+uint32_t i2cBatchValue(const i2c_batch_t *b, int idx);
+// the i2c file descriptor, -1 if not open
+int i2cFd(void);
 
 #endif /* I2C_H_ */
@@ -0,0 +1,156 @@
+/*
+ * latency.c
+ *
+ * Recording is a bucket index computation and a few relaxed atomic adds,
+ * so it can stay on in every thread without locks. Buckets are log-linear
+ * as in HdrHistogram: every power of two is split into LAT_SUB equal
+ * steps, which keeps the relative error of a percentile below 1/LAT_SUB.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <stdatomic.h>
+
+#include "latency.h"
+
+// min starts above any value, so a 0 ns record is a minimum like any other
+#define LAT_HIST_INIT	{ .min = UINT64_MAX }
+
+lat_hist_t lat_hist[LAT_OPS] = { [0 ... LAT_OPS - 1] = LAT_HIST_INIT };
+
+static const char *names[LAT_OPS] = {
+	[LAT_MOTION_BURST]	= "motion burst",
+	[LAT_REG_READ]		= "register read",
+	[LAT_REG_WRITE]		= "register write",
+	[LAT_REG_PLAN]		= "register plan",
+	[LAT_FRAME_BURST]	= "frame burst",
+	[LAT_I2C_READ]		= "i2c read",
+	[LAT_I2C_BATCH]		= "i2c batch",
+	[LAT_LOG_FORMAT]	= "log format",
+	[LAT_SOCKET_SEND]	= "socket send",
+	[LAT_MOTION_EVENT]	= "motion event",
+};
+
+static volatile sig_atomic_t requested;
+
+static inline int bucket(uint64_t ns) {
+	int e;
+
+	if (ns < 2 * LAT_SUB) return ns;
+	e = 63 - __builtin_clzll(ns);
+	if (e > LAT_MAX_BITS) return LAT_BUCKETS - 1;
+	return (e - LAT_SUB_BITS + 1) * LAT_SUB + ((ns >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+// middle of a bucket
+static uint64_t value(int b) {
+	int e;
+
+	if (b < 2 * LAT_SUB) return b;
+	e = b / LAT_SUB + LAT_SUB_BITS - 1;
+	return ((uint64_t)(LAT_SUB + b % LAT_SUB) << (e - LAT_SUB_BITS)) + (1ULL << (e - LAT_SUB_BITS)) / 2;
+}
+
+void lat_record(int op, uint64_t ns) {
+	lat_hist_t *h = &lat_hist[op];
+	uint64_t m;
+
+	atomic_fetch_add_explicit(&h->bucket[bucket(ns)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum, ns, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+
+	m = atomic_load_explicit(&h->max, memory_order_relaxed);
+	while ((ns > m) && !atomic_compare_exchange_weak_explicit(&h->max, &m, ns,
+			memory_order_relaxed, memory_order_relaxed));
+	m = atomic_load_explicit(&h->min, memory_order_relaxed);
+	while ((ns < m) && !atomic_compare_exchange_weak_explicit(&h->min, &m, ns,
+			memory_order_relaxed, memory_order_relaxed));
+}
+
+void lat_reset(void) {
+	int op;
+
+	memset(lat_hist, 0, sizeof(lat_hist));
+	for (op = 0; op < LAT_OPS; op++) atomic_store(&lat_hist[op].min, UINT64_MAX);
+}
+
+// a record counted but its minimum not yet stored reads as 0
+static uint64_t min_of(const lat_hist_t *h) {
+	uint64_t m = atomic_load(&h->min);
+	return (m == UINT64_MAX) ? 0 : m;
+}
+
+// value below which a fraction q of the samples fall, within min and max
+static double percentile(const lat_hist_t *h, const uint64_t *b, uint64_t n, double q) {
+	uint64_t rank = q * n, seen = 0, v = value(LAT_BUCKETS - 1);
+	uint64_t min = min_of(h), max = atomic_load(&h->max);
+	int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += b[i];
+		if (seen > rank) {
+			v = value(i);
+			break;
+		}
+	}
+	if (v > max) v = max;
+	if (v < min) v = min;
+	return v / 1E3;
+}
+
+static uint64_t snapshot(const lat_hist_t *h, uint64_t *b) {
+	uint64_t n = 0;
+	int i;
+
+	// the counts may still move
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		b[i] = atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+		n += b[i];
+	}
+	return n;
+}
+
+double lat_percentile(int op, double q) {
+	static uint64_t b[LAT_BUCKETS];
+	uint64_t n = snapshot(&lat_hist[op], b);
+
+	return n ? percentile(&lat_hist[op], b, n, q) : 0;
+}
+
+void lat_report(FILE *f) {
+	static uint64_t b[LAT_BUCKETS];
+	int op;
+
+	fprintf(f, "\t%-16s %9s %9s %9s %9s %9s %9s %9s %9s (us)\n", "latency", "count", "mean", "min",
+		"p50", "p90", "p99", "p99.9", "max");
+	for (op = 0; op < LAT_OPS; op++) {
+		lat_hist_t *h = &lat_hist[op];
+		uint64_t n = snapshot(h, b);
+
+		if (n == 0) continue;
+		fprintf(f, "\t%-16s %9llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", names[op],
+			(unsigned long long)n, (double)atomic_load(&h->sum) / n / 1E3,
+			min_of(h) / 1E3, percentile(h, b, n, 0.5), percentile(h, b, n, 0.9),
+			percentile(h, b, n, 0.99), percentile(h, b, n, 0.999), atomic_load(&h->max) / 1E3);
+	}
+}
+
+static void on_signal(int sig) {
+	requested = 1;
+}
+
+void lat_signal_init(void) {
+	struct sigaction sa = {0};
+
+	sa.sa_handler = on_signal;
+	sigaction(SIGUSR1, &sa, NULL);
+}
+
+void lat_poll(FILE *f) {
+	if (!requested) return;
+	requested = 0;
+	lat_report(f);
+	fflush(f);
+}
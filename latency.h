@@ -0,0 +1,65 @@
+/*
+ * latency.h
+ *
+ * always-on latency histograms per operation type
+ */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdatomic.h>
+
+// operations
+enum {
+	LAT_MOTION_BURST,
+	LAT_REG_READ,			// single register
+	LAT_REG_WRITE,
+	LAT_REG_PLAN,			// batched register accesses
+	LAT_FRAME_BURST,
+	LAT_I2C_READ,
+	LAT_I2C_BATCH,			// one sample's registers in one transaction
+	LAT_LOG_FORMAT,			// one sample, TSV or binary
+	LAT_SOCKET_SEND,
+	LAT_MOTION_EVENT,		// from the MOTION edge to the burst read
+	LAT_OPS
+};
+
+// log-linear: 8 linear steps per power of two, exact below 16 ns
+#define LAT_SUB_BITS	3
+#define LAT_SUB			(1 << LAT_SUB_BITS)
+#define LAT_MAX_BITS	40		// ~18 minutes, longer goes into the last bucket
+#define LAT_BUCKETS		((LAT_MAX_BITS - LAT_SUB_BITS + 2) * LAT_SUB)
+
+typedef struct {
+	_Atomic uint64_t count;
+	_Atomic uint64_t sum;
+	_Atomic uint64_t min;
+	_Atomic uint64_t max;
+	_Atomic uint64_t bucket[LAT_BUCKETS];
+} lat_hist_t;
+
+extern lat_hist_t lat_hist[LAT_OPS];
+
+static inline uint64_t lat_start(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void lat_record(int op, uint64_t ns);
+
+static inline void lat_end(int op, uint64_t t_start) {
+	lat_record(op, lat_start() - t_start);
+}
+
+void lat_reset(void);
+// us, 0 without samples
+double lat_percentile(int op, double q);
+void lat_report(FILE *f);
+// SIGUSR1 asks for a report, printed by lat_poll outside the handler
+void lat_signal_init(void);
+void lat_poll(FILE *f);
+
+#endif /* LATENCY_H_ */
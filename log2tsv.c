@@ -0,0 +1,96 @@
+/*
+ * log2tsv.c
+ *
+ * converts a binary sample log (adns-connect -B) into the TSV layout
+ * adns-connect writes without -B
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binlog.h"
+#include "sample.h"
+
+static void print_usage(const char *prog)
+{
+	printf("Usage: %s <binary log> [tsv file]\n", prog);
+	puts("  writes to stdout if no tsv file is given\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *in, *out = stdout;
+	binlog_header_t hdr;
+	uint8_t rec[1024];
+	sample_t s;
+	int64_t offset_ns = 0;
+	uint64_t records = 0, samples = 0, unverified = 0, bad = 0, dropped = 0;
+	uint32_t crc = 0;
+	size_t n;
+
+	if ((argc < 2) || (argc > 3)) print_usage(argv[0]);
+
+	in = fopen(argv[1], "rb");
+	if (in == NULL) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	if ((binlog_read_header(in, &hdr) != 0) || (hdr.record_size > sizeof(rec))) {
+		fprintf(stderr, "%s: not a binary sample log\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	if (argc == 3) {
+		out = fopen(argv[2], "w");
+		if (out == NULL) {
+			perror(argv[2]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	int columns = hdr.flags & (BINLOG_F_I2C | BINLOG_F_ODO | BINLOG_F_TIMING | BINLOG_F_SENSOR);
+	if (columns & BINLOG_F_TIMING) sample_print_anchor(out, hdr.t0_realtime_ns);
+	sample_print_header(out, columns);
+
+	while ((n = fread(rec, 1, hdr.record_size, in)) == hdr.record_size) {
+		binlog_sample(&hdr, rec, &s);
+
+		if (s.kind == BINLOG_SAMPLE) {
+			crc = binlog_crc32(crc, rec, hdr.record_size);
+			s.t_ns += offset_ns;
+			sample_print(out, &s, columns);
+			samples++;
+			dropped += s.dropped;
+			unverified++;
+		} else {
+			binlog_mark_t *m = (binlog_mark_t *)rec;
+			if ((m->crc != crc) || (m->records != records)) {
+				fprintf(stderr, "warning: block of %llu records before record %llu failed verification\n",
+					(unsigned long long)unverified, (unsigned long long)records);
+				bad += unverified;
+			}
+			if (m->kind == BINLOG_SEGMENT_MARK) {
+				// appended run, keep the time line of the first segment
+				offset_ns = m->t_realtime_ns - hdr.t0_realtime_ns;
+			}
+			crc = 0;
+			unverified = 0;
+		}
+		records++;
+	}
+
+	if (n) fprintf(stderr, "warning: ignored truncated record at the end\n");
+	if (unverified) {
+		fprintf(stderr, "warning: %llu records after the last checkpoint are not verified\n",
+			(unsigned long long)unverified);
+	}
+	if (dropped) fprintf(stderr, "warning: %llu samples were dropped while logging\n", (unsigned long long)dropped);
+	if (bad) fprintf(stderr, "warning: %llu records failed verification\n", (unsigned long long)bad);
+
+	fclose(in);
+	if (out != stdout) fclose(out);
+
+	return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
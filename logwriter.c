@@ -0,0 +1,110 @@
+/*
+ * logwriter.c
+ *
+ * The acquisition thread never blocks on storage: samples go into an SPSC
+ * ring and a writer thread drains everything available in one batch.
+ * When the ring is full the sample is counted as overrun and the count
+ * is carried in the dropped field of the next sample that fits, so gaps
+ * are visible in the log itself and in the end of run report.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "latency.h"
+#include "logwriter.h"
+
+#define IDLE_NS		2000000		// poll period of an empty ring
+
+static void *writer_thread(void *arg) {
+	logwriter_t *w = arg;
+	const struct timespec idle = { 0, IDLE_NS };
+
+	while (1) {
+		int running = atomic_load_explicit(&w->running, memory_order_acquire);
+		uint32_t total = 0;
+		uint32_t n;
+		void *p;
+
+		// drain everything there is, in contiguous chunks
+		while ((n = ring_peek(&w->ring, &p)) > 0) {
+			sample_t *s = p;
+			uint32_t i;
+			for (i = 0; i < n; i++) {
+				uint64_t t_lat = lat_start();
+				if (w->blog != NULL) {
+					if (binlog_write(w->blog, &s[i]) != 0) w->error = 1;
+				} else if (sample_print(w->lfd, &s[i], w->columns) < 0) {
+					w->error = 1;
+				}
+				lat_end(LAT_LOG_FORMAT, t_lat);
+			}
+			ring_release(&w->ring, n);
+			total += n;
+		}
+
+		if (total) {
+			// one write per batch, not per sample
+			if ((w->lfd != NULL) && (fflush(w->lfd) != 0)) w->error = 1;
+			w->written += total;
+			w->batches++;
+		} else if (!running) {
+			break;
+		} else {
+			nanosleep(&idle, NULL);
+		}
+	}
+	return NULL;
+}
+
+int logwriter_start(logwriter_t *w, FILE *lfd, binlog_t *blog, int columns, uint32_t capacity) {
+	memset(w, 0, sizeof(*w));
+	w->lfd = lfd;
+	w->blog = blog;
+	w->columns = columns;
+
+	if (ring_init(&w->ring, sizeof(sample_t), capacity) != 0) return -1;
+
+	atomic_store(&w->running, 1);
+	if (pthread_create(&w->thread, NULL, writer_thread, w) != 0) {
+		ring_free(&w->ring);
+		return -1;
+	}
+	return 0;
+}
+
+int logwriter_push(logwriter_t *w, sample_t *s) {
+	uint32_t fill;
+
+	s->dropped = (w->pending_drop > UINT16_MAX) ? UINT16_MAX : w->pending_drop;
+	if (ring_push(&w->ring, s) != 0) {
+		w->overruns++;
+		w->pending_drop++;
+		return -1;
+	}
+	w->pending_drop = 0;
+	w->pushed++;
+
+	fill = ring_count(&w->ring);
+	if (fill > w->max_fill) w->max_fill = fill;
+	return 0;
+}
+
+void logwriter_stop(logwriter_t *w) {
+	atomic_store_explicit(&w->running, 0, memory_order_release);
+	pthread_join(w->thread, NULL);
+	ring_free(&w->ring);
+}
+
+void logwriter_report(const logwriter_t *w, FILE *f) {
+	fprintf(f, "\tlogged %llu samples in %llu batches, max. queue fill %u of %u\n",
+		(unsigned long long)w->written, (unsigned long long)w->batches, w->max_fill, w->ring.size);
+	if (w->overruns) {
+		fprintf(f, "\twarning: %llu samples dropped by log overruns\n", (unsigned long long)w->overruns);
+	}
+	if (w->error) fprintf(f, "\twarning: write errors on log file\n");
+}
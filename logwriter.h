@@ -0,0 +1,46 @@
+/*
+ * logwriter.h
+ *
+ * background thread writing samples handed over by the acquisition loop
+ */
+
+#ifndef LOGWRITER_H_
+#define LOGWRITER_H_
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "binlog.h"
+#include "ring.h"
+#include "sample.h"
+
+#define LOGWRITER_CAPACITY	4096	// samples buffered between the threads
+#define LOGWRITER_TSV_BUFFER	(256 * 1024)	// stdio buffer for TSV files
+
+typedef struct {
+	ring_t ring;
+	pthread_t thread;
+	FILE *lfd;				// TSV output, or
+	binlog_t *blog;			// binary output
+	int columns;			// optional TSV columns (sample.h)
+	atomic_int running;
+
+	// producer side
+	uint64_t pushed;
+	uint64_t overruns;		// samples dropped because the ring was full
+	uint32_t pending_drop;	// not yet announced in a logged sample
+	uint32_t max_fill;
+
+	// consumer side
+	uint64_t written;
+	uint64_t batches;
+	int error;
+} logwriter_t;
+
+int logwriter_start(logwriter_t *w, FILE *lfd, binlog_t *blog, int columns, uint32_t capacity);
+int logwriter_push(logwriter_t *w, sample_t *s);
+void logwriter_stop(logwriter_t *w);
+void logwriter_report(const logwriter_t *w, FILE *f);
+
+#endif /* LOGWRITER_H_ */
@@ -2,49 +2,104 @@
 #include <unistd.h>		//close, sleep
 #include <stdio.h>		//fprintf, printf
 #include <stdlib.h>		//atoi, atof
+#include <math.h>		//llround
 #include <string.h>		//strcmp
 #include <getopt.h>		//getoptlong
-#include <sys/time.h>	//gettimeofday
+#include <signal.h>		//sigaction
+#include <fcntl.h>		//open
 
 #include "adns.h"
+#include "aux.h"
+#include "daemon.h"
+#include "framestream.h"
 #include "i2c.h"
+#include "i2c-emu.h"
+#include "latency.h"
+#include "motion.h"
+#include "multi.h"
+#include "recorder.h"
+#include "sample.h"
+#include "sched.h"
+#include "server.h"
 #include "socket-server.h"
+#include "sweep.h"
+#include "trace.h"
 
 #define I2C_SLAVE_ADDRESS	0x18
 
 static uint8_t automatic = 0;
 static uint8_t socket = 0;
 static const char *file = NULL;
+static uint8_t binary = 0;
+static uint8_t append = 0;
 static uint8_t i2c_log = 0;
 static const char *i2c_dev = "/dev/i2c-0";
 static uint8_t manual = 0;
 //~ static uint16_t readAddr;
 static uint8_t run;
 static uint16_t shutter = 0;
-static double time = 0;
+static double run_time = 0;
 static uint8_t verbose = 0;
 static uint8_t res = 0;
 static uint8_t grab = 0;
-static uint8_t quit = 0;
+static uint8_t stream = 0;
+static int stream_format = FRAMESTREAM_RAW;
+static const char *flow_file = NULL;
+static double rate = 10;
+static double log_rate = 0;
+static uint8_t odometry = 0;
+static uint8_t timing = 0;
+static volatile sig_atomic_t stop = 0;
+static uint16_t port = SOCKET_SERVER_PORT;
+static uint8_t daemonize = 0;
+static const char *control = DAEMON_SOCKET;
+static const char *sweep = NULL;
+static double i2c_rate = AUX_RATE;
+static int i2c_merge = AUX_INTERPOLATE;
+static aux_t aux;
+static const char *sensors[MULTI_SENSORS];
+static int n_sensors = 0;
+static const char *motion_line = NULL;
+static double idle_rate = MOTION_IDLE_RATE;
 
-double getTime() {
-	struct timeval tp;
-	gettimeofday( &tp, NULL );
-	return tp.tv_sec + tp.tv_usec/1E6;
+static void on_signal(int sig) {
+	stop = 1;
 }
 
 static void print_usage(const char *prog)
 {
-	printf("Usage: %s [-afimStvbVdDhlLsO3]\n", prog);
+	printf("Usage: %s [-afimStvbVdDEhlLsO3]\n", prog);
 	puts(" general\n"
 	     "  -f --file     log file to write to\n"
+	     "  -B --binary   write log file in binary format (see adns-log2tsv)\n"
+	     "  -A --append   append to an existing binary log file\n"
 	     "  -g --grab     grab frame\n"
-	     "  -i --i2c      additional i2c sensor\n"
+	     "  -G --stream   capture frames back to back into the log file\n"
+	     "     --packed   store streamed pixels packed to 6 bit\n"
+	     "     --delta    store streamed pixels inter-frame coded (adns-framedec)\n"
+	     "     --flow FILE  log displacements estimated from the streamed frames\n"
+	     "  -i --i2c      additional i2c sensor (device, " I2C_EMU_DEVICE " for the emulated board)\n"
+	     "     --i2c-rate i2c sample rate on a thread of its own (Hz, default 50), merged\n"
+	     "                into the motion samples by time, 0 reads it with every motion read\n"
+	     "     --i2c-merge nearest|interp  i2c value at a motion sample (default interp)\n"
 	     "  -k --socket   write using socket\n"
+	     "  -P --port     socket port (default 15000)\n"
+	     "     --daemon   keep running, controlled over a unix socket (see adns-ctl)\n"
+	     "     --control  unix socket of the daemon (default " DAEMON_SOCKET ")\n"
+	     "     --sweep PLAN  record the servo speed and shutter sweep of a plan file (see sweep.c)\n"
+	     "                into the directory or, with log single, the binary log file given by -f\n"
+	     "  -F --rate     sample rate (Hz, default 10), also of socket odometry\n"
+	     "     --log-rate log at a lower rate than sampled, dX and dY summed in between\n"
+	     "                (Hz, default every sample)\n"
+	     "     --motion-line CHIP:LINE  sample when the sensor MOTION pin on this GPIO line\n"
+	     "                reports motion, at most at --rate, e.g. gpiochip0:25\n"
+	     "     --idle-rate  sample rate without motion (Hz, default 1)\n"
+	     "  -o --odometry log position and velocity integrated at the sample rate\n"
+	     "  -T --timing   log SPI and i2c transaction times and the realtime of t = 0\n"
 	     "  -r --run      run\n"
 	     "  -t --time     run time\n"
-	     "  -v --verbose  be verbose\n"
-	     "  -w --werbose  be wery verbose\n"
+	     "  -v --verbose  be verbose, trace sensor access (dumped at exit and on SIGUSR2)\n"
+	     "  -w --werbose  be wery verbose, trace every register access\n"
 	     " ADNS specific\n"
 	     "  -a --auto     set auto frame and shutter period\n"
 	     "  -m --manual   set fixed frame and shutter period\n"
@@ -55,13 +110,20 @@ static void print_usage(const char *prog)
 	     "  -C --cs-high  chip select active high\n"
 	     "  -d --delay    delay (usec)\n"
 	     "  -D --device   device to use (default /dev/spidev0.0)\n"
+	     "     --sensor DEV  log this sensor, repeated for up to 8 sensors in one log with\n"
+	     "                a sensor column, a thread per bus (spidevB of spidevB.C)\n"
 	     "  -H --cpha     clock phase\n"
 	     "  -l --loop     loopback\n"
 	     "  -L --lsb      least significant bit first\n"
 	     "  -R --ready    \n"
 	     "  -s --speed    max speed (Hz)\n"
+	     "     --read-mode single|planned|pipelined  register access strategy\n"
 	     "  -O --cpol     clock polarity\n"
-	     "  -3 --3wire    SI/SO signals shared\n");
+	     "  -3 --3wire    SI/SO signals shared\n"
+	     " emulation\n"
+	     "  -E --emulate  use emulated sensor instead of spidev\n"
+	     "     --emu-speed X[,Y]  emulated surface speed (pixel/s)\n"
+	     "     --emu-seed N       emulated surface texture seed\n");
 	exit(1);
 }
 
@@ -75,10 +137,15 @@ static void parse_opts(int argc, char *argv[])
 			{ "device",  1, 0, 'D' },
 			{ "shutter", 1, 0, 'S' },
 			{ "file",    1, 0, 'f' },
+			{ "binary",  0, 0, 'B' },
+			{ "append",  0, 0, 'A' },
 			{ "grab",    0, 0, 'g' },
+			{ "stream",  0, 0, 'G' },
+			{ "rate",    1, 0, 'F' },
 			{ "help",    0, 0, 'h' },
 			{ "i2c",     1, 0, 'i' },
 			{ "socket",  0, 0, 'k' },
+			{ "port",    1, 0, 'P' },
 			{ "run",     0, 0, 'r' },
 			{ "time",    1, 0, 't' },
 			{ "verbose", 0, 0, 'v' },
@@ -86,11 +153,29 @@ static void parse_opts(int argc, char *argv[])
 			{ "manual",  0, 0, 'm' },
 			{ "highres", 0, 0, 'X' },
 			{ "auto",    0, 0, 'a' },
+			{ "emulate", 0, 0, 'E' },
+			{ "emu-speed", 1, 0, 0x100 },
+			{ "emu-seed",  1, 0, 0x101 },
+			{ "read-mode", 1, 0, 0x102 },
+			{ "packed",  0, 0, 0x103 },
+			{ "flow",    1, 0, 0x104 },
+			{ "delta",   0, 0, 0x105 },
+			{ "log-rate", 1, 0, 0x106 },
+			{ "odometry", 0, 0, 'o' },
+			{ "timing",  0, 0, 'T' },
+			{ "daemon",  0, 0, 0x107 },
+			{ "control", 1, 0, 0x108 },
+			{ "sweep",   1, 0, 0x109 },
+			{ "i2c-rate", 1, 0, 0x10a },
+			{ "i2c-merge", 1, 0, 0x10b },
+			{ "sensor",  1, 0, 0x10c },
+			{ "motion-line", 1, 0, 0x10d },
+			{ "idle-rate", 1, 0, 0x10e },
 			{ NULL, 0, 0, 0 },
 		};
 		int c;
 
-		c = getopt_long(argc, argv, "D:f:i:S:t:aghkmrvwX", lopts, NULL);
+		c = getopt_long(argc, argv, "D:f:F:i:P:S:t:aABEgGhkmorTvwX", lopts, NULL);
 
 		if (c == -1)
 			break;
@@ -102,6 +187,12 @@ static void parse_opts(int argc, char *argv[])
 			case 'g':
 				grab = 1;
 				break;
+			case 'G':
+				stream = 1;
+				break;
+			case 'F':
+				rate = atof(optarg);
+				break;
 			case 'i':
 				i2c_log = 1;
 				i2c_dev = optarg;
@@ -116,7 +207,7 @@ static void parse_opts(int argc, char *argv[])
 				automatic = 1;
 				break;
 			case 't':
-				time = atof(optarg);
+				run_time = atof(optarg);
 				break;
 			case 'S':
 				shutter = atoi(optarg);
@@ -130,9 +221,69 @@ static void parse_opts(int argc, char *argv[])
 			case 'k':
 				socket = 1;
 				break;
+			case 'P':
+				port = atoi(optarg);
+				break;
 			case 'f':
 				file = optarg;
 				break;
+			case 'B':
+				binary = 1;
+				break;
+			case 'A':
+				append = 1;
+				break;
+			case 0x103:
+				stream_format = FRAMESTREAM_PACKED6;
+				break;
+			case 0x104:
+				flow_file = optarg;
+				break;
+			case 0x105:
+				stream_format = FRAMESTREAM_DELTA;
+				break;
+			case 0x106:
+				log_rate = atof(optarg);
+				break;
+			case 'o':
+				odometry = 1;
+				break;
+			case 'T':
+				timing = 1;
+				break;
+			case 0x107:
+				daemonize = 1;
+				break;
+			case 0x108:
+				control = optarg;
+				break;
+			case 0x109:
+				sweep = optarg;
+				break;
+			case 0x10a:
+				i2c_rate = atof(optarg);
+				break;
+			case 0x10b:
+				if (strcmp(optarg, "nearest") == 0) i2c_merge = AUX_NEAREST;
+				else if (strcmp(optarg, "interp") == 0) i2c_merge = AUX_INTERPOLATE;
+				else {
+					printf("unknown i2c merge %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 0x10c:
+				if (n_sensors == MULTI_SENSORS) {
+					printf("at most %d sensors\n", MULTI_SENSORS);
+					exit(1);
+				}
+				sensors[n_sensors++] = optarg;
+				break;
+			case 0x10d:
+				motion_line = optarg;
+				break;
+			case 0x10e:
+				idle_rate = atof(optarg);
+				break;
 			case 'h':
 				print_usage(argv[0]);
 				break;
@@ -141,12 +292,145 @@ static void parse_opts(int argc, char *argv[])
 	}
 }
 
+/*
+ * capture frames as fast as the sensor allows into a file until the run
+ * time is over or the output fails
+ */
+static int stream_frames(int fd, int out) {
+	framestream_t *fs;
+	FILE *flow = NULL;
+	uint64_t t0;
+
+	if (flow_file != NULL) {
+		flow = fopen(flow_file, "w");
+		if (flow == NULL) {
+			printf("can't open flow file %s\n", flow_file);
+			return -1;
+		}
+	}
+
+	// frame_t is too big for the stack
+	fs = malloc(sizeof(framestream_t));
+	if ((fs == NULL) || (framestream_start(fs, out, stream_format, flow, res, FRAMESTREAM_BUFFERS) != 0)) {
+		printf("can't start frame stream\n");
+		if (flow != NULL) fclose(flow);
+		free(fs);
+		return -1;
+	}
+
+	ADNS_read_all(fd);
+	t0 = sched_now();
+	do {
+		framestream_capture(fs, fd);
+		lat_poll(stdout);
+		trace_poll(stderr);
+	} while ((((sched_now() - t0) / 1E9 < run_time) || run)
+		&& !framestream_failed(fs) && !stop);
+
+	framestream_stop(fs);
+	framestream_report(fs, stdout);
+	lat_report(stdout);
+	trace_dump(stderr);
+	if (flow != NULL) fclose(flow);
+	free(fs);
+	return 0;
+}
+
+static void stop_aux(recorder_conf_t *conf) {
+	if (conf->aux == NULL) return;
+	aux_stop(conf->aux);
+	aux_report(conf->aux, stdout);
+	conf->aux = NULL;
+}
+
+// the settings of the command line on one of several sensors
+static void configure(adns_t *s) {
+	if (manual) adns_set_ext_conf(s, 0x03);
+	if (shutter && (adns_set_FPS_bounds(s, shutter, NULL) < 1)) {
+		printf("\twarning: shutter bounds of %s not applied\n", s->device);
+	}
+	if (automatic) adns_set_ext_conf(s, 0);
+	adns_set_conf(s, res ? 0x10 : 0x00);
+}
+
+/*
+ * all sensors into one log, the i2c channels are not sampled: they
+ * belong to the single sensor rig
+ */
+static int run_multi(int argc, char *argv[], recorder_conf_t *conf) {
+	static multi_t m;
+	recorder_t rec;
+	sched_t sched;
+	double max_rate = rate;
+	int i;
+
+	adns_parse_opts(argc, argv);
+	multi_init(&m);
+	for (i = 0; i < n_sensors; i++) {
+		adns_t *s;
+
+		if (multi_add(&m, sensors[i]) < 0) {
+			printf("can't open sensor %s\n", sensors[i]);
+			multi_close(&m);
+			return EXIT_FAILURE;
+		}
+		s = &m.sensor[i].adns;
+		configure(s);
+		adns_get_FPS_bounds(s);
+		if (24E6 / s->adns.frame_period_min < max_rate) max_rate = 24E6 / s->adns.frame_period_min;
+	}
+	printf("\t%d sensors on %d buses\n", m.n_sensors, m.n_buses);
+	if (i2c_log) printf("\twarning: no i2c channels with several sensors\n");
+	if (max_rate < rate) {
+		printf("\twarning: rate limited to sensor frame rate %.1f Hz\n", max_rate);
+		rate = max_rate;
+	}
+
+	conf->columns = (conf->columns & ~SAMPLE_I2C) | SAMPLE_SENSOR;
+	conf->aux = NULL;
+	// the merge keeps up with the buses at their rate
+	if (sched_init(&sched, rate) != 0) {
+		printf("invalid sample rate %f\n", rate);
+		multi_close(&m);
+		return EXIT_FAILURE;
+	}
+	if (file != NULL) printf("\tsave values to file: %s\n", file);
+	if (recorder_start(&rec, -1, file, conf) != 0) {
+		multi_close(&m);
+		return EXIT_FAILURE;
+	}
+	if (multi_start(&m, rate, &rec) != 0) {
+		printf("can't start sensor threads\n");
+		recorder_stop(&rec);
+		multi_close(&m);
+		return EXIT_FAILURE;
+	}
+
+	do {
+		multi_merge(&m, &rec);
+		lat_poll(stdout);
+		trace_poll(stderr);
+		sched_wait(&sched);
+	} while (((rec.t_ns / 1E9 < run_time) || run) && !stop);
+
+	multi_stop(&m, &rec);
+	recorder_stop(&rec);
+	multi_report(&m, stdout);
+	logwriter_report(&rec.writer, stdout);
+	lat_report(stdout);
+	trace_dump(stderr);
+	multi_close(&m);
+	return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
 	int ret;
 	int fd;
-	FILE* lfd = NULL;
-	double t, t0;
+	recorder_conf_t conf = {0};
+	recorder_t rec;
+	sched_t sched;
+	motion_t motion;
 
 	printf("\nADNS connect tool\n");
 	
@@ -156,6 +440,20 @@ int main(int argc, char *argv[])
 	}
 	
 	parse_opts(argc, argv);
+	conf.columns = (i2c_log ? SAMPLE_I2C : 0) | (odometry ? SAMPLE_ODO : 0) | (timing ? SAMPLE_TIMING : 0);
+	conf.binary = binary;
+	conf.append = append;
+	conf.log_period_ns = (log_rate > 0) ? llround(1E9 / log_rate) : 0;
+
+	if (n_sensors > 0) {
+		struct sigaction sa = {0};
+		sa.sa_handler = on_signal;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		lat_signal_init();
+		trace_signal_init();
+		return run_multi(argc, argv, &conf);
+	}
 
 	ret = init_SPI(&fd, argc, argv);
 	if (ret < 0) {
@@ -169,8 +467,11 @@ int main(int argc, char *argv[])
 	}
 
 	if (shutter) {
+		adns_apply_t a;
 		printf("\tset shutter period maximum bounds: %d\n", shutter);
-		ADNS_set_FPS_bounds(fd, shutter);
+		if (ADNS_set_FPS_bounds(fd, shutter, &a) > 0) {
+			printf("\tapplied in %.1f ms, %d write(s), %d readback(s)\n", a.t_us / 1E3, a.writes, a.reads);
+		}
 	}
 
 	if (automatic) {
@@ -183,89 +484,132 @@ int main(int argc, char *argv[])
 		ADNS_set_conf(fd,0x10);	
 	} else ADNS_set_conf(fd,0x00);	
 		
-	if (grab) {
+	if (grab || stream) {
 		printf("waring: sensor needs to be manually reset after frame grabing is finished\n");
 	}
+
+	struct sigaction sa = {0};
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	// kill -USR1 prints the latency histograms, -USR2 dumps the trace
+	lat_signal_init();
+	trace_signal_init();
+
+	if (stream && !socket) {
+		if (file == NULL) {
+			printf("streaming needs a log file\n");
+			return EXIT_FAILURE;
+		}
+		int out = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out < 0) {
+			printf("can't open frame file %s\n", file);
+			return EXIT_FAILURE;
+		}
+		printf("\tstream frames to file: %s\n", file);
+		stream_frames(fd, out);
+		close(out);
+		close(fd);
+		return EXIT_SUCCESS;
+	}
 	
-	if (file != NULL) {
-		printf("\tsave values to file: %s\n",file);
-		// setup log file
-		lfd = fopen(file, "w");
-		fprintf(lfd, "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s", "t", "MOT", "dX", "dY", "SQUAL", "shut", "pxSum", "OVF", "RES", "valid");
-		if (i2c_log) {
-			fprintf(lfd, "\t%s\t%s\t%s\t%s\t%s", "servo", "bright 0", "bright 1", "bright 2", "bright 3");
-			// init i2c 
-			i2cInit(i2c_dev, I2C_SLAVE_ADDRESS);
+	if (i2c_log) {
+		// init i2c 
+		if (i2cInit(i2c_dev, I2C_SLAVE_ADDRESS)) {
+			printf("\twarning: can't open i2c device %s\n", i2c_dev);
+			i2c_log = 0;
 		}
-		fprintf(lfd, "\n");
-	} else lfd = stdout;
+	}
+
+	ADNS_get_FPS_bounds(fd);
+
+	// the sensor can't deliver new motion data faster than its frame rate, in any mode
+	double max_rate = 24E6 / adns.frame_period_min;
+	if (rate > max_rate) {
+		printf("\twarning: rate limited to sensor frame rate %.1f Hz\n", max_rate);
+		rate = max_rate;
+	}
 
 	// socket server functionality 
 	if (socket) {
 		printf("\tsetup server socket\n");
-		socket_server_init();
-
-		while(1) {
-			printf( "\tlisten\n");
-			if (socket_server_wait_for_client() != SUCCESS) {
-				socket_server_close();
-				return EXIT_SUCCESS;
-			}
-			
-			char *buffer = NULL;
-			int size;
-			while(1) {
-				socket_server_receive(&buffer, &size);
-				// parse received data
-				if (size > 0) {
-					if ((strcmp("quit", buffer) == 0)
-						|| (strcmp("exit", buffer) == 0) 
-						|| (strcmp("q", buffer) == 0)) { 
-						quit = 1;
-					} else if ((strcmp("grab", buffer) == 0)
-						|| (strcmp("g", buffer) == 0)) { 
-						grab = 1;
-					};
-					
-					free(buffer);
-				}
+		ret = server_run(fd, port, rate, verbose, &stop);
+		lat_report(stdout);
+		trace_dump(stderr);
+		close(fd);
+		return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 
-				if (quit) {
-					if (verbose) printf("\t\tsocket: termination signal received\n");
-					printf("\tconnection closed by client\n");
-					quit = 0;
-					client_socket_close();
-					break;
-				}
-				if (grab) {
-					if (verbose) printf("\t\tsocket: raw frame request received\n");
-
-					uint8_t frame[900];
-					if (ADNS_read_frame_burst(fd, frame) >= 900) {
-						socket_server_send((char*)frame,900);
-					} else {
-						// capture failed
-						if (verbose) printf("\t\traw frame capture failed\n");
-						// send only ping answer
-						socket_server_send((char*)frame,1);
-					}
-					grab=0;
-				}
-			}
+	// servo and brightness at their own rate, the motion rate does not wait for the bus
+	if (i2c_log && (i2c_rate > 0)) {
+		if (aux_start(&aux, i2c_rate, i2c_merge) != 0) {
+			printf("can't start i2c sampling\n");
+			close(fd);
+			return EXIT_FAILURE;
 		}
-		socket_server_close();
-		return EXIT_SUCCESS;
+		conf.aux = &aux;
+	}
+
+	if (daemonize) {
+		ret = daemon_run(fd, control, rate, &conf, &stop);
+		stop_aux(&conf);
+		lat_report(stdout);
+		trace_dump(stderr);
+		close(fd);
+		return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (sweep) {
+		sweep_plan_t plan;
+
+		if (file == NULL) {
+			printf("a sweep needs a log directory or file\n");
+			stop_aux(&conf);
+			close(fd);
+			return EXIT_FAILURE;
+		}
+		ret = (sweep_load(&plan, sweep) == 0) ? sweep_run(fd, &plan, file, rate, &conf, i2c_log, &stop) : -1;
+		stop_aux(&conf);
+		lat_report(stdout);
+		trace_dump(stderr);
+		close(fd);
+		return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
 
 	if (grab) {
 		uint8_t frame[900];
 		ADNS_read_frame_burst(fd, frame);
+		stop_aux(&conf);
+		trace_dump(stderr);
 		close(fd);
 		return EXIT_SUCCESS;
 	}			
 	
-	ADNS_get_FPS_bounds(fd);
-	t0 = getTime();
+	if (sched_init(&sched, rate) != 0) {
+		printf("invalid sample rate %f\n", rate);
+		stop_aux(&conf);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	// on motion instead of every period
+	if (motion_line != NULL) {
+		if (motion_open(&motion, &motion_source_gpio, motion_line, rate, idle_rate) != 0) {
+			printf("can't open motion line %s\n", motion_line);
+			stop_aux(&conf);
+			close(fd);
+			return EXIT_FAILURE;
+		}
+		printf("\tsample on motion of %s, at %.1f Hz without\n", motion_line, idle_rate);
+	}
+
+	if (file != NULL) printf("\tsave values to file: %s\n",file);
+	if (recorder_start(&rec, fd, file, &conf) != 0) {
+		if (motion_line != NULL) motion_close(&motion);
+		stop_aux(&conf);
+		close(fd);
+		return EXIT_FAILURE;
+	}
 
 //	if (run) {
 //		while(1) {
@@ -276,30 +620,29 @@ int main(int argc, char *argv[])
 //	}
 	
 	do {
-		t = getTime();
-		ADNS_read_motion_burst(fd);
-		
-		fprintf(lfd, "%f\t%u\t%d\t%d", t - t0, adns.motion.MOT, adns.delta_X, adns.delta_Y);	
-		fprintf(lfd, "\t%d\t%d\t%d\t%d", adns.squal, adns.shutter, adns.pixel_sum, adns.motion.OVF);
-		fprintf(lfd, "\t%d\t0x%x", adns.motion.RES, adns.product_ID + adns.inv_product_ID);
-		
-		if (i2c_log) {
-			uint16_t servo_value = i2cReadW(0x32);
-			uint16_t brightness_value[4];
-			brightness_value[0] = i2cReadW(0x76);
-			brightness_value[1] = i2cReadW(0x78);
-			brightness_value[2] = i2cReadW(0x72);
-			brightness_value[3] = i2cReadW(0x74);
-			fprintf(lfd, "\t%u", servo_value);
-			fprintf(lfd, "\t%u\t%u\t%u\t%u", brightness_value[0], brightness_value[1], brightness_value[2], brightness_value[3]);
+		if (motion_line == NULL) {
+			recorder_sample(&rec);
+		} else if (motion_sample(&motion, &rec) < 0) {
+			printf("motion line failed\n");
+			break;
 		}
-		fprintf(lfd, "\n");
+		lat_poll(stdout);
+		trace_poll(stderr);
 
-		usleep(100000);			
-//		usleep(adns.frame_period / 24);
-	} while (((t - t0) < time) || run);
+		if (motion_line == NULL) sched_wait(&sched);
+	} while (((rec.t_ns / 1E9 < run_time) || run) && !stop);
 	
-	if (lfd != NULL) fclose(lfd);
+	recorder_stop(&rec);
+	if (motion_line != NULL) {
+		motion_report(&motion, stdout);
+		motion_close(&motion);
+	} else {
+		sched_report(&sched, stdout);
+	}
+	recorder_report(&rec, stdout);
+	stop_aux(&conf);
+	lat_report(stdout);
+	trace_dump(stderr);
 	close(fd);
 
 	return EXIT_SUCCESS;
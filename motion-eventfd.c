@@ -0,0 +1,54 @@
+/*
+ * motion-eventfd.c
+ *
+ * Motion source driven by the program itself: every motion_eventfd_signal
+ * is an event, stamped when it is taken since an eventfd only counts.
+ */
+
+#define _GNU_SOURCE		// ppoll()
+
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "motion-source.h"
+
+static uint64_t monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int efd_open(const char *spec) {
+	return eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+static int efd_wait(int fd, uint64_t timeout_ns, uint64_t *t_ns) {
+	struct pollfd p = { fd, POLLIN, 0 };
+	struct timespec ts = { timeout_ns / 1000000000ULL, timeout_ns % 1000000000ULL };
+	uint64_t n;
+
+	if (ppoll(&p, 1, &ts, NULL) < 0) return (errno == EINTR) ? 0 : -1;
+	if (read(fd, &n, sizeof(n)) != sizeof(n)) return (errno == EAGAIN) ? 0 : -1;
+	*t_ns = monotonic_ns();
+	return (n > INT32_MAX) ? INT32_MAX : n;
+}
+
+static void efd_close(int fd) {
+	close(fd);
+}
+
+const motion_source_t motion_source_eventfd = {
+	.name = "eventfd",
+	.open = efd_open,
+	.wait = efd_wait,
+	.close = efd_close,
+};
+
+int motion_eventfd_signal(int fd) {
+	uint64_t one = 1;
+	return (write(fd, &one, sizeof(one)) == sizeof(one)) ? 0 : -1;
+}
@@ -0,0 +1,32 @@
+/*
+ * motion-source.h
+ *
+ * backend interface below event-driven sampling: something that tells
+ * when the sensor reports motion
+ */
+
+#ifndef MOTION_SOURCE_H_
+#define MOTION_SOURCE_H_
+#include <stdint.h>
+
+typedef struct {
+	const char *name;
+	// returns a file descriptor identifying the opened source, < 0 on error
+	int (*open)(const char *spec);
+	/*
+	 * waits up to timeout_ns, 0 only takes what is pending, returns the
+	 * events taken, 0 on timeout or a signal, -1 on error; *t_ns is the
+	 * CLOCK_MONOTONIC time of the first
+	 */
+	int (*wait)(int fd, uint64_t timeout_ns, uint64_t *t_ns);
+	void (*close)(int fd);
+} motion_source_t;
+
+// MOTION pin on a GPIO character device line, CHIP:LINE (motion.c)
+extern const motion_source_t motion_source_gpio;
+// eventfd written by motion_eventfd_signal, stand-in for tests (motion-eventfd.c)
+extern const motion_source_t motion_source_eventfd;
+
+int motion_eventfd_signal(int fd);
+
+#endif /* MOTION_SOURCE_H_ */
@@ -0,0 +1,154 @@
+/*
+ * motion.c
+ *
+ * The ADNS-3080 pulls MOTION low when it has motion data and releases it
+ * when the motion register is read, so every falling edge after a read is
+ * new motion. Edges wake the loop through a motion source, the GPIO line
+ * event of the pin carries its kernel timestamp. Reads follow an edge
+ * right away unless the previous one is less than a sample period ago;
+ * the edges until then are covered by that read. Without motion a
+ * heartbeat read keeps SQUAL and shutter in the log.
+ */
+
+#define _GNU_SOURCE		// ppoll()
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "latency.h"
+#include "motion.h"
+#include "recorder.h"
+#include "sched.h"
+
+#define GPIO_EVENTS		16		// taken per read()
+
+static void sleep_until(uint64_t t) {
+	struct timespec ts = { t / 1000000000ULL, t % 1000000000ULL };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+int motion_open(motion_t *m, const motion_source_t *src, const char *spec, double rate, double idle_rate) {
+	memset(m, 0, sizeof(*m));
+	if ((rate <= 0) || (idle_rate <= 0)) return -1;
+	m->src = src;
+	m->min_ns = 1E9 / rate;
+	m->idle_ns = 1E9 / idle_rate;
+	m->fd = src->open(spec);
+	return (m->fd < 0) ? -1 : 0;
+}
+
+int motion_sample(motion_t *m, recorder_t *r) {
+	uint64_t now = sched_now(), due = m->t_last + m->idle_ns, t_ev = 0;
+	uint64_t t_pending;
+	int n = 0;
+
+	// the first call reads right away, MOTION may be low since before
+	if (now < due) {
+		n = m->src->wait(m->fd, due - now, &t_ev);
+		if (n < 0) return -1;
+		if ((n == 0) && (sched_now() < due)) return 0;
+	}
+
+	if (n > 0) {
+		m->events += n;
+		now = sched_now();
+		if (now < m->t_last + m->min_ns) {
+			sleep_until(m->t_last + m->min_ns);
+			// the read below covers these
+			n = m->src->wait(m->fd, 0, &t_pending);
+			if (n > 0) {
+				m->events += n;
+				m->coalesced += n;
+			}
+		}
+	} else {
+		m->heartbeats++;
+	}
+
+	m->t_last = sched_now();
+	if (t_ev) lat_record(LAT_MOTION_EVENT, m->t_last - t_ev);
+	m->reads++;
+	return recorder_sample(r);
+}
+
+void motion_close(motion_t *m) {
+	m->src->close(m->fd);
+	m->fd = -1;
+}
+
+void motion_report(const motion_t *m, FILE *f) {
+	fprintf(f, "\tmotion %s: %llu events, %llu coalesced, %llu reads, %llu of them heartbeats\n",
+		m->src->name, (unsigned long long)m->events, (unsigned long long)m->coalesced,
+		(unsigned long long)m->reads, (unsigned long long)m->heartbeats);
+}
+
+/*
+ * spec is CHIP:LINE, the chip a path or a name in /dev
+ */
+static int gpio_open(const char *spec) {
+	struct gpio_v2_line_request req;
+	const char *colon = strrchr(spec, ':');
+	char chip[256];
+	char *end;
+	long line;
+	int fd, ret;
+
+	if ((colon == NULL) || (colon == spec) || (colon - spec >= (int)sizeof(chip) - 5)) return -1;
+	line = strtol(colon + 1, &end, 0);
+	if (*end || (line < 0)) return -1;
+	snprintf(chip, sizeof(chip), "%s%.*s", (spec[0] == '/') ? "" : "/dev/", (int)(colon - spec), spec);
+
+	fd = open(chip, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = line;
+	req.num_lines = 1;
+	// MOTION is active low, edge timestamps on CLOCK_MONOTONIC
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	req.event_buffer_size = GPIO_EVENTS;
+	strncpy(req.consumer, "adns-connect", sizeof(req.consumer) - 1);
+	ret = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	close(fd);
+	if (ret < 0) return -1;
+
+	// wait polls, reads only take what is there
+	fcntl(req.fd, F_SETFL, fcntl(req.fd, F_GETFL) | O_NONBLOCK);
+	return req.fd;
+}
+
+static int gpio_wait(int fd, uint64_t timeout_ns, uint64_t *t_ns) {
+	struct pollfd p = { fd, POLLIN, 0 };
+	struct timespec ts = { timeout_ns / 1000000000ULL, timeout_ns % 1000000000ULL };
+	struct gpio_v2_line_event ev[GPIO_EVENTS];
+	ssize_t len;
+	int n = 0;
+
+	if (ppoll(&p, 1, &ts, NULL) < 0) return (errno == EINTR) ? 0 : -1;
+	while ((len = read(fd, ev, sizeof(ev))) > 0) {
+		if (n == 0) *t_ns = ev[0].timestamp_ns;
+		n += len / sizeof(ev[0]);
+	}
+	if ((len < 0) && (errno != EAGAIN)) return -1;
+	return n;
+}
+
+static void gpio_close(int fd) {
+	close(fd);
+}
+
+const motion_source_t motion_source_gpio = {
+	.name = "gpio",
+	.open = gpio_open,
+	.wait = gpio_wait,
+	.close = gpio_close,
+};
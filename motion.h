@@ -0,0 +1,41 @@
+/*
+ * motion.h
+ *
+ * event-driven sampling: the motion burst is read when the sensor reports
+ * motion, at most at the sample rate, and at an idle rate without
+ */
+
+#ifndef MOTION_H_
+#define MOTION_H_
+#include <stdint.h>
+#include <stdio.h>
+
+#include "motion-source.h"
+#include "recorder.h"
+
+#define MOTION_IDLE_RATE	1		// Hz, default of --idle-rate
+
+typedef struct {
+	const motion_source_t *src;
+	int fd;
+	uint64_t min_ns;		// between reads
+	uint64_t idle_ns;		// heartbeat without motion
+	uint64_t t_last;		// CLOCK_MONOTONIC of the last read
+
+	uint64_t events;
+	uint64_t coalesced;		// events covered by a read already due
+	uint64_t reads;
+	uint64_t heartbeats;
+} motion_t;
+
+// rate caps the reads, idle_rate is the heartbeat, returns 0 or -1
+int motion_open(motion_t *m, const motion_source_t *src, const char *spec, double rate, double idle_rate);
+/*
+ * waits for motion or the heartbeat and samples into r, returns what
+ * recorder_sample returns, 0 if interrupted or -1 if the source failed
+ */
+int motion_sample(motion_t *m, recorder_t *r);
+void motion_close(motion_t *m);
+void motion_report(const motion_t *m, FILE *f);
+
+#endif /* MOTION_H_ */
@@ -0,0 +1,223 @@
+/*
+ * multi.c
+ *
+ * Sensors on separate buses are read in parallel, each bus by a thread of
+ * its own at the full rate; sensors sharing a bus take turns within a
+ * period. Every sample is stamped at the midpoint of its motion read like
+ * a single sensor sample and queued on its bus. The main thread merges the
+ * bus queues: the oldest queued sample is handed on once no bus can still
+ * deliver an older one, which an empty bus tells by its watermark.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "adns.h"
+#include "multi.h"
+#include "recorder.h"
+#include "sample.h"
+#include "sched.h"
+
+void multi_init(multi_t *m) {
+	memset(m, 0, sizeof(*m));
+}
+
+// the bus of /dev/spidevB.C is /dev/spidevB
+static void bus_name(char *name, size_t size, const char *device) {
+	const char *dot = strrchr(device, '.');
+	size_t n = strlen(device);
+
+	if ((dot != NULL) && (strchr(dot, '/') == NULL)) n = dot - device;
+	if (n >= size) n = size - 1;
+	memcpy(name, device, n);
+	name[n] = 0;
+}
+
+int multi_add(multi_t *m, const char *device) {
+	multi_sensor_t *s;
+	multi_bus_t *b;
+	char name[64];
+	int i;
+
+	if (m->n_sensors == MULTI_SENSORS) return -1;
+	s = &m->sensor[m->n_sensors];
+	if (adns_open(&s->adns, device) != 0) return -1;
+
+	bus_name(name, sizeof(name), device);
+	for (i = 0; i < m->n_buses; i++) {
+		if (strcmp(m->bus[i].name, name) == 0) break;
+	}
+	b = &m->bus[i];
+	if (i == m->n_buses) {
+		strcpy(b->name, name);
+		b->m = m;
+		m->n_buses++;
+	}
+	b->sensor[b->n++] = m->n_sensors;
+	return m->n_sensors++;
+}
+
+static void sensor_sample(multi_t *m, multi_bus_t *b, int k) {
+	multi_sensor_t *s = &m->sensor[k];
+	const adns3080_t *a = &s->adns.adns;
+	sample_t sample = {0};
+	uint64_t ta, tb;
+
+	// nothing taken from now on is older
+	ta = sched_now_raw();
+	atomic_store_explicit(&b->watermark, ta - m->t0, memory_order_release);
+	adns_read_motion_burst(&s->adns);
+	tb = sched_now_raw();
+
+	sample.t_ns		= ta + (tb - ta) / 2 - m->t0;
+	sample.spi_ns		= tb - ta;
+	s->samples++;
+	if (m->columns & SAMPLE_ODO) odo_update(&s->odo, sample.t_ns, a->motion_val, a->delta_X, a->delta_Y);
+
+	// like recorder_sample, per sensor
+	s->motion_flags |= a->motion_val & 0x90;
+	s->sum_X += a->delta_X;
+	s->sum_Y += a->delta_Y;
+	if (sample.t_ns < s->next_log) return;
+	s->next_log += m->log_period_ns;
+	if (s->next_log <= sample.t_ns) s->next_log = sample.t_ns + m->log_period_ns;
+
+	sample.sensor		= k;
+	sample.motion		= a->motion_val | s->motion_flags;
+	s->motion_flags = 0;
+	sample.delta_X		= s->sum_X;
+	sample.delta_Y		= s->sum_Y;
+	s->sum_X = s->sum_Y = 0;
+	sample.squal		= a->squal;
+	sample.shutter		= a->shutter;
+	sample.pixel_sum	= a->pixel_sum;
+	sample.valid		= a->product_ID + a->inv_product_ID;
+	if (m->columns & SAMPLE_ODO) {
+		sample.pos_X		= s->odo.x;
+		sample.pos_Y		= s->odo.y;
+		sample.vel_X		= s->odo.vx;
+		sample.vel_Y		= s->odo.vy;
+		sample.lost_X		= s->odo.lost_x;
+		sample.lost_Y		= s->odo.lost_y;
+	}
+	if (ring_push(&b->ring, &sample) != 0) b->overruns++;
+}
+
+static void *bus_thread(void *arg) {
+	multi_bus_t *b = arg;
+	multi_t *m = b->m;
+	int i;
+
+	while (atomic_load_explicit(&m->running, memory_order_acquire)) {
+		for (i = 0; i < b->n; i++) sensor_sample(m, b, b->sensor[i]);
+		sched_wait(&b->sched);
+	}
+	// done, everything it took is queued
+	atomic_store_explicit(&b->watermark, UINT64_MAX, memory_order_release);
+	return NULL;
+}
+
+int multi_start(multi_t *m, double rate, const recorder_t *r) {
+	int i;
+
+	m->columns = r->conf.columns;
+	m->log_period_ns = r->conf.log_period_ns;
+	m->t0 = r->t0;
+	for (i = 0; i < m->n_sensors; i++) odo_init(&m->sensor[i].odo);
+
+	atomic_store(&m->running, 1);
+	for (i = 0; i < m->n_buses; i++) {
+		multi_bus_t *b = &m->bus[i];
+
+		if ((sched_init(&b->sched, rate) != 0)
+			|| (ring_init(&b->ring, sizeof(sample_t), MULTI_CAPACITY) != 0)) break;
+		atomic_store(&b->watermark, 0);
+		if (pthread_create(&b->thread, NULL, bus_thread, b) != 0) {
+			ring_free(&b->ring);
+			break;
+		}
+	}
+	if (i < m->n_buses) {
+		int n = i;
+
+		atomic_store(&m->running, 0);
+		for (i = 0; i < n; i++) {
+			pthread_join(m->bus[i].thread, NULL);
+			ring_free(&m->bus[i].ring);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+int multi_merge(multi_t *m, recorder_t *r) {
+	int n = 0;
+
+	while (1) {
+		sample_t *first = NULL;
+		uint64_t limit = UINT64_MAX;
+		int i, k = -1;
+
+		for (i = 0; i < m->n_buses; i++) {
+			multi_bus_t *b = &m->bus[i];
+			// the watermark first, a sample queued before it was raised is then visible
+			uint64_t w = atomic_load_explicit(&b->watermark, memory_order_acquire);
+			void *p;
+
+			if (ring_peek(&b->ring, &p) == 0) {
+				if (w < limit) limit = w;
+			} else if ((first == NULL) || (((sample_t *)p)->t_ns < first->t_ns)) {
+				first = p;
+				k = i;
+			}
+		}
+		if ((first == NULL) || (first->t_ns > limit)) break;
+
+		recorder_push(r, first);
+		ring_release(&m->bus[k].ring, 1);
+		m->merged++;
+		n++;
+	}
+	return n;
+}
+
+void multi_stop(multi_t *m, recorder_t *r) {
+	int i;
+
+	atomic_store_explicit(&m->running, 0, memory_order_release);
+	for (i = 0; i < m->n_buses; i++) pthread_join(m->bus[i].thread, NULL);
+	multi_merge(m, r);
+	for (i = 0; i < m->n_buses; i++) ring_free(&m->bus[i].ring);
+}
+
+void multi_close(multi_t *m) {
+	int i;
+
+	for (i = 0; i < m->n_sensors; i++) adns_close(&m->sensor[i].adns);
+	m->n_sensors = 0;
+}
+
+void multi_report(const multi_t *m, FILE *f) {
+	int i, j;
+
+	for (i = 0; i < m->n_buses; i++) {
+		const multi_bus_t *b = &m->bus[i];
+
+		fprintf(f, "\tbus %s: %llu overruns\n", b->name, (unsigned long long)b->overruns);
+		sched_report(&b->sched, f);
+		for (j = 0; j < b->n; j++) {
+			const multi_sensor_t *s = &m->sensor[b->sensor[j]];
+			fprintf(f, "\t\tsensor %d %s: %llu samples", b->sensor[j], s->adns.device,
+				(unsigned long long)s->samples);
+			if (m->columns & SAMPLE_ODO) {
+				fprintf(f, ", odometry X %lld Y %lld counts, %llu overflows", (long long)s->odo.x,
+					(long long)s->odo.y, (unsigned long long)s->odo.overflows);
+			}
+			fprintf(f, "\n");
+		}
+	}
+	fprintf(f, "\t%llu samples merged\n", (unsigned long long)m->merged);
+}
@@ -0,0 +1,76 @@
+/*
+ * multi.h
+ *
+ * several sensors in one log: a thread per SPI bus, the sensors on a bus
+ * read one after the other, all samples merged into one stream by time
+ */
+
+#ifndef MULTI_H_
+#define MULTI_H_
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "adns.h"
+#include "odometry.h"
+#include "recorder.h"
+#include "ring.h"
+#include "sched.h"
+
+#define MULTI_SENSORS	8
+#define MULTI_CAPACITY	1024	// samples per bus between the threads
+
+typedef struct {
+	adns_t adns;
+	odo_t odo;
+	uint64_t next_log;
+	uint8_t motion_flags;	// MOT and OVF of samples not logged
+	int32_t sum_X;			// deltas since the last logged sample
+	int32_t sum_Y;
+	uint64_t samples;
+} multi_sensor_t;
+
+struct multi;
+
+typedef struct {
+	char name[64];			// spidev path without the chip select
+	int sensor[MULTI_SENSORS];
+	int n;
+	struct multi *m;
+	pthread_t thread;
+	ring_t ring;
+	sched_t sched;
+	/*
+	 * samples taken later than this are still to come, every one taken
+	 * before is in the ring once it is read after the watermark
+	 */
+	_Atomic uint64_t watermark;
+	uint64_t overruns;
+} multi_bus_t;
+
+typedef struct multi {
+	multi_sensor_t sensor[MULTI_SENSORS];
+	int n_sensors;
+	multi_bus_t bus[MULTI_SENSORS];
+	int n_buses;
+	atomic_int running;
+	int columns;
+	uint64_t log_period_ns;
+	uint64_t t0;			// of the recorder
+	uint64_t merged;
+} multi_t;
+
+void multi_init(multi_t *m);
+// opens the sensor and puts it on its bus, returns its index or -1
+int multi_add(multi_t *m, const char *device);
+// starts a thread per bus sampling at rate into the log of r (started with fd -1)
+int multi_start(multi_t *m, double rate, const recorder_t *r);
+// hands the samples that can't be preceded by any still to come to r in time order
+int multi_merge(multi_t *m, recorder_t *r);
+// joins the threads and merges what is left
+void multi_stop(multi_t *m, recorder_t *r);
+void multi_close(multi_t *m);
+void multi_report(const multi_t *m, FILE *f);
+
+#endif /* MULTI_H_ */
@@ -0,0 +1,65 @@
+/*
+ * odometry.c
+ *
+ * Sums the motion deltas into 64 bit positions. When the sensor moved
+ * more than a delta register holds between two reads, it reports the
+ * saturated value with OVF set and the rest is gone. Then the counts
+ * predicted from the rate and acceleration of the previous intervals are
+ * taken instead, and the difference is kept as estimated loss. The estimate can only be as good
+ * as the motion before the overflow, so reading often enough to never
+ * saturate is still the real fix.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "odometry.h"
+
+// counts of one axis for an interval of dt seconds
+static int64_t axis(odo_t *o, int n, double dt, int ovf, int delta, int64_t *lost) {
+	double pred = (o->rate[n] + o->acc[n] * dt) * dt;
+	int64_t d = delta;
+
+	if (ovf && ((delta >= ODO_DELTA_MAX) || (delta <= -ODO_DELTA_MAX - 1))) {
+		// at least the saturated value was moved, in its direction
+		if ((pred * delta > 0) && (fabs(pred) > abs(delta))) {
+			d = llround(pred);
+			*lost += d - delta;
+		} else {
+			o->unestimated++;
+		}
+	}
+
+	if (dt > 0) {
+		float rate = d / dt;
+		if (o->samples > 1) o->acc[n] += (1 - exp(-dt / ODO_TAU_ACC)) * ((rate - o->rate[n]) / dt - o->acc[n]);
+		o->rate[n] = rate;
+	}
+	return d;
+}
+
+void odo_init(odo_t *o) {
+	memset(o, 0, sizeof(*o));
+}
+
+void odo_update(odo_t *o, uint64_t t_ns, uint8_t motion, int8_t delta_X, int8_t delta_Y) {
+	int ovf = (motion >> 4) & 1;
+	double dt = o->samples ? (t_ns - o->t_ns) / 1E9 : 0;
+	int64_t dx, dy;
+
+	if (ovf) o->overflows++;
+	dx = axis(o, 0, dt, ovf, delta_X, &o->lost_x);
+	dy = axis(o, 1, dt, ovf, delta_Y, &o->lost_y);
+	o->x += dx;
+	o->y += dy;
+
+	if (dt > 0) {
+		float a = 1 - exp(-dt / ODO_TAU);
+		o->vx += a * (dx / dt - o->vx);
+		o->vy += a * (dy / dt - o->vy);
+	}
+	o->t_ns = t_ns;
+	o->samples++;
+}
@@ -0,0 +1,34 @@
+/*
+ * odometry.h
+ *
+ * dead reckoning from the motion registers, read at the full sample rate
+ */
+
+#ifndef ODOMETRY_H_
+#define ODOMETRY_H_
+#include <stdint.h>
+
+#define ODO_TAU			0.1		// s, time constant of the reported velocity
+#define ODO_TAU_ACC		0.05	// s, time constant of the acceleration estimate
+#define ODO_DELTA_MAX	127		// delta registers saturate at -128 / 127
+
+typedef struct {
+	int64_t x;				// counts incl. estimated lost ones
+	int64_t y;
+	int64_t lost_x;			// estimated part of x and y
+	int64_t lost_y;
+	float vx;				// counts/s, smoothed
+	float vy;
+	float rate[2];			// counts/s of the last interval, per axis
+	float acc[2];			// counts/s^2, smoothed
+	uint64_t t_ns;			// last update
+	uint64_t samples;
+	uint64_t overflows;		// samples with OVF set
+	uint64_t unestimated;	// saturated axes without a usable velocity
+} odo_t;
+
+void odo_init(odo_t *o);
+// one motion burst taken at t_ns, motion is the raw motion register
+void odo_update(odo_t *o, uint64_t t_ns, uint8_t motion, int8_t delta_X, int8_t delta_Y);
+
+#endif /* ODOMETRY_H_ */
@@ -0,0 +1,353 @@
+/*
+ * pixel.c
+ *
+ * Every kernel has a scalar version and, where the target has it, an
+ * SSE2/SSSE3 (x86, picked at run time) or NEON (ARM, picked at build
+ * time) version that handles the bulk and leaves the tail to the scalar
+ * code.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pixel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_X86
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON)
+#define PIXEL_NEON
+#include <arm_neon.h>
+#endif
+
+typedef void (*pack_fn)(const uint8_t *, uint8_t *, int);
+typedef void (*frame_fn)(const uint8_t *, uint8_t *, int, pixel_stats_t *, uint32_t *);
+typedef uint32_t (*sad_fn)(const uint8_t *, int, const uint8_t *, int);
+
+static pack_fn pack_impl;
+static pack_fn unpack_impl;
+static frame_fn frame_impl;
+static sad_fn sad_impl;
+static const char *impl_name;
+
+static void stats_init(pixel_stats_t *st) {
+	st->sof = -1;
+	st->sum = 0;
+	st->min = 0xff;
+	st->max = 0;
+}
+
+// continues the stats, so the vector versions can hand over their tail
+static void frame_tail(const uint8_t *rx, uint8_t *pixel, int i, int n, pixel_stats_t *st, uint32_t *hist) {
+	for (; i < n; i++) {
+		uint8_t p = rx[i] & 0x3f;
+
+		if ((st->sof < 0) && ((rx[i] & PIXEL_SOF) == PIXEL_SOF)) st->sof = i;
+		pixel[i] = p;
+		st->sum += p;
+		if (p < st->min) st->min = p;
+		if (p > st->max) st->max = p;
+		if (hist) hist[p]++;
+	}
+}
+
+void pixel_frame_scalar(const uint8_t *rx, uint8_t *pixel, int n, pixel_stats_t *st, uint32_t *hist) {
+	stats_init(st);
+	if (hist) memset(hist, 0, PIXEL_LEVELS * sizeof(*hist));
+	frame_tail(rx, pixel, 0, n, st, hist);
+}
+
+void pixel_pack6_scalar(const uint8_t *pixel, uint8_t *packed, int n) {
+	int i;
+
+	for (i = 0; i < n; i += 4) {
+		uint32_t v = (pixel[i] & 0x3f) | (pixel[i + 1] & 0x3f) << 6
+			| (pixel[i + 2] & 0x3f) << 12 | (uint32_t)(pixel[i + 3] & 0x3f) << 18;
+		*packed++ = v;
+		*packed++ = v >> 8;
+		*packed++ = v >> 16;
+	}
+}
+
+void pixel_unpack6_scalar(const uint8_t *packed, uint8_t *pixel, int n) {
+	int i;
+
+	for (i = 0; i < n; i += 4) {
+		uint32_t v = packed[0] | packed[1] << 8 | packed[2] << 16;
+		pixel[i] = v & 0x3f;
+		pixel[i + 1] = (v >> 6) & 0x3f;
+		pixel[i + 2] = (v >> 12) & 0x3f;
+		pixel[i + 3] = v >> 18;
+		packed += 3;
+	}
+}
+
+uint32_t pixel_sad16_scalar(const uint8_t *a, int stride_a, const uint8_t *b, int stride_b) {
+	uint32_t sad = 0;
+	int i, j;
+
+	for (j = 0; j < 16; j++) {
+		for (i = 0; i < 16; i++) sad += (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+		a += stride_a;
+		b += stride_b;
+	}
+	return sad;
+}
+
+#ifdef PIXEL_X86
+// one row per instruction
+__attribute__((target("sse2")))
+static uint32_t sad16_sse2(const uint8_t *a, int stride_a, const uint8_t *b, int stride_b) {
+	__m128i sum = _mm_setzero_si128();
+	int j;
+
+	for (j = 0; j < 16; j++) {
+		__m128i ra = _mm_loadu_si128((const __m128i *)a);
+		__m128i rb = _mm_loadu_si128((const __m128i *)b);
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(ra, rb));
+		a += stride_a;
+		b += stride_b;
+	}
+	return _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+}
+
+__attribute__((target("sse2")))
+static void frame_sse2(const uint8_t *rx, uint8_t *pixel, int n, pixel_stats_t *st, uint32_t *hist) {
+	const __m128i mask = _mm_set1_epi8(0x3f);
+	const __m128i sof = _mm_set1_epi8((char)PIXEL_SOF);
+	__m128i vmin = _mm_set1_epi8((char)0xff);
+	__m128i vmax = _mm_setzero_si128();
+	__m128i vsum = _mm_setzero_si128();
+	uint8_t lane[16];
+	int i, k;
+
+	stats_init(st);
+	if (hist) memset(hist, 0, PIXEL_LEVELS * sizeof(*hist));
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i r = _mm_loadu_si128((const __m128i *)(rx + i));
+		__m128i p = _mm_and_si128(r, mask);
+
+		if (st->sof < 0) {
+			int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(r, sof), sof));
+			if (m) st->sof = i + __builtin_ctz(m);
+		}
+		_mm_storeu_si128((__m128i *)(pixel + i), p);
+		vsum = _mm_add_epi64(vsum, _mm_sad_epu8(p, _mm_setzero_si128()));
+		vmin = _mm_min_epu8(vmin, p);
+		vmax = _mm_max_epu8(vmax, p);
+		if (hist) {
+			// the pixels are in L1 already, this is not another pass over the burst
+			for (k = 0; k < 16; k++) hist[pixel[i + k]]++;
+		}
+	}
+
+	st->sum = _mm_cvtsi128_si32(vsum) + _mm_cvtsi128_si32(_mm_srli_si128(vsum, 8));
+	_mm_storeu_si128((__m128i *)lane, vmin);
+	for (k = 0; k < 16; k++) if (lane[k] < st->min) st->min = lane[k];
+	_mm_storeu_si128((__m128i *)lane, vmax);
+	for (k = 0; k < 16; k++) if (lane[k] > st->max) st->max = lane[k];
+
+	frame_tail(rx, pixel, i, n, st, hist);
+}
+
+// 16 pixels to 12 bytes per round
+__attribute__((target("ssse3")))
+static void pack6_ssse3(const uint8_t *pixel, uint8_t *packed, int n) {
+	const __m128i mask = _mm_set1_epi8(0x3f);
+	const __m128i mul_pair = _mm_set1_epi16(0x4001);		// p0 + 64 * p1
+	const __m128i mul_quad = _mm_set1_epi32(0x10000001);	// q0 + 4096 * q1
+	const __m128i drop = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pixel + i)), mask);
+		v = _mm_maddubs_epi16(v, mul_pair);
+		v = _mm_madd_epi16(v, mul_quad);
+		v = _mm_shuffle_epi8(v, drop);
+		_mm_storel_epi64((__m128i *)packed, v);
+		uint32_t hi = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+		memcpy(packed + 8, &hi, 4);
+		packed += 12;
+	}
+	pixel_pack6_scalar(pixel + i, packed, n - i);
+}
+
+__attribute__((target("ssse3")))
+static void unpack6_ssse3(const uint8_t *packed, uint8_t *pixel, int n) {
+	const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i m0 = _mm_set1_epi32(0x0000003f);
+	const __m128i m1 = _mm_set1_epi32(0x00003f00);
+	const __m128i m2 = _mm_set1_epi32(0x003f0000);
+	const __m128i m3 = _mm_set1_epi32(0x3f000000);
+	int i;
+
+	// 12 bytes are used, the load must not run over the end
+	for (i = 0; i + 16 <= n && PIXEL_PACKED_SIZE(n - i) >= 16; i += 16) {
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)packed), spread);
+		// pixel k of each 24 bit group moves to byte k: shift by 2k
+		__m128i r = _mm_and_si128(v, m0);
+		r = _mm_or_si128(r, _mm_and_si128(_mm_slli_epi32(v, 2), m1));
+		r = _mm_or_si128(r, _mm_and_si128(_mm_slli_epi32(v, 4), m2));
+		r = _mm_or_si128(r, _mm_and_si128(_mm_slli_epi32(v, 6), m3));
+		_mm_storeu_si128((__m128i *)(pixel + i), r);
+		packed += 12;
+	}
+	pixel_unpack6_scalar(packed, pixel + i, n - i);
+}
+#endif
+
+#ifdef PIXEL_NEON
+static uint32_t sad16_neon(const uint8_t *a, int stride_a, const uint8_t *b, int stride_b) {
+	uint16x8_t sum = vdupq_n_u16(0);
+	uint32x4_t s32;
+	int j;
+
+	// 16 rows of at most 2 * 255 per lane fit 16 bit
+	for (j = 0; j < 16; j++) {
+		sum = vpadalq_u8(sum, vabdq_u8(vld1q_u8(a), vld1q_u8(b)));
+		a += stride_a;
+		b += stride_b;
+	}
+	s32 = vpaddlq_u16(sum);
+	return vgetq_lane_u32(s32, 0) + vgetq_lane_u32(s32, 1) + vgetq_lane_u32(s32, 2) + vgetq_lane_u32(s32, 3);
+}
+
+static void frame_neon(const uint8_t *rx, uint8_t *pixel, int n, pixel_stats_t *st, uint32_t *hist) {
+	const uint8x16_t mask = vdupq_n_u8(0x3f);
+	const uint8x16_t sof = vdupq_n_u8(PIXEL_SOF);
+	uint8x16_t vmin = vdupq_n_u8(0xff);
+	uint8x16_t vmax = vdupq_n_u8(0);
+	uint32x4_t vsum = vdupq_n_u32(0);
+	uint8_t lane[16];
+	int i, k;
+
+	stats_init(st);
+	if (hist) memset(hist, 0, PIXEL_LEVELS * sizeof(*hist));
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		uint8x16_t r = vld1q_u8(rx + i);
+		uint8x16_t p = vandq_u8(r, mask);
+
+		if (st->sof < 0) {
+			uint8x16_t m = vceqq_u8(vandq_u8(r, sof), sof);
+			uint8x8_t any = vorr_u8(vget_low_u8(m), vget_high_u8(m));
+			if (vget_lane_u64(vreinterpret_u64_u8(any), 0)) {
+				for (k = 0; k < 16; k++) {
+					if ((rx[i + k] & PIXEL_SOF) == PIXEL_SOF) break;
+				}
+				st->sof = i + k;
+			}
+		}
+		vst1q_u8(pixel + i, p);
+		vsum = vpadalq_u16(vsum, vpaddlq_u8(p));
+		vmin = vminq_u8(vmin, p);
+		vmax = vmaxq_u8(vmax, p);
+		if (hist) {
+			for (k = 0; k < 16; k++) hist[pixel[i + k]]++;
+		}
+	}
+
+	st->sum = vgetq_lane_u32(vsum, 0) + vgetq_lane_u32(vsum, 1)
+		+ vgetq_lane_u32(vsum, 2) + vgetq_lane_u32(vsum, 3);
+	vst1q_u8(lane, vmin);
+	for (k = 0; k < 16; k++) if (lane[k] < st->min) st->min = lane[k];
+	vst1q_u8(lane, vmax);
+	for (k = 0; k < 16; k++) if (lane[k] > st->max) st->max = lane[k];
+
+	frame_tail(rx, pixel, i, n, st, hist);
+}
+
+// 64 pixels to 48 bytes per round
+static void pack6_neon(const uint8_t *pixel, uint8_t *packed, int n) {
+	const uint8x16_t mask = vdupq_n_u8(0x3f);
+	int i;
+
+	for (i = 0; i + 64 <= n; i += 64) {
+		uint8x16x4_t p = vld4q_u8(pixel + i);
+		uint8x16x3_t b;
+		uint8x16_t p0 = vandq_u8(p.val[0], mask);
+		uint8x16_t p1 = vandq_u8(p.val[1], mask);
+		uint8x16_t p2 = vandq_u8(p.val[2], mask);
+		uint8x16_t p3 = vandq_u8(p.val[3], mask);
+		b.val[0] = vorrq_u8(p0, vshlq_n_u8(p1, 6));
+		b.val[1] = vorrq_u8(vshrq_n_u8(p1, 2), vshlq_n_u8(p2, 4));
+		b.val[2] = vorrq_u8(vshrq_n_u8(p2, 4), vshlq_n_u8(p3, 2));
+		vst3q_u8(packed, b);
+		packed += 48;
+	}
+	pixel_pack6_scalar(pixel + i, packed, n - i);
+}
+
+static void unpack6_neon(const uint8_t *packed, uint8_t *pixel, int n) {
+	const uint8x16_t mask = vdupq_n_u8(0x3f);
+	int i;
+
+	for (i = 0; i + 64 <= n; i += 64) {
+		uint8x16x3_t b = vld3q_u8(packed);
+		uint8x16x4_t p;
+		p.val[0] = vandq_u8(b.val[0], mask);
+		p.val[1] = vandq_u8(vorrq_u8(vshrq_n_u8(b.val[0], 6), vshlq_n_u8(b.val[1], 2)), mask);
+		p.val[2] = vandq_u8(vorrq_u8(vshrq_n_u8(b.val[1], 4), vshlq_n_u8(b.val[2], 4)), mask);
+		p.val[3] = vshrq_n_u8(b.val[2], 2);
+		vst4q_u8(pixel + i, p);
+		packed += 48;
+	}
+	pixel_unpack6_scalar(packed, pixel + i, n - i);
+}
+#endif
+
+// chosen once, whichever thread comes first, before any kernel is called
+static pthread_once_t selected = PTHREAD_ONCE_INIT;
+
+static void pixel_select(void) {
+	pack_impl = pixel_pack6_scalar;
+	unpack_impl = pixel_unpack6_scalar;
+	frame_impl = pixel_frame_scalar;
+	sad_impl = pixel_sad16_scalar;
+	impl_name = "scalar";
+#if defined(PIXEL_X86)
+	if (__builtin_cpu_supports("sse2")) {
+		frame_impl = frame_sse2;
+		sad_impl = sad16_sse2;
+		impl_name = "sse2";
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		pack_impl = pack6_ssse3;
+		unpack_impl = unpack6_ssse3;
+		impl_name = "ssse3";
+	}
+#elif defined(PIXEL_NEON)
+	pack_impl = pack6_neon;
+	unpack_impl = unpack6_neon;
+	frame_impl = frame_neon;
+	sad_impl = sad16_neon;
+	impl_name = "neon";
+#endif
+}
+
+const char *pixel_impl(void) {
+	pthread_once(&selected, pixel_select);
+	return impl_name;
+}
+
+void pixel_pack6(const uint8_t *pixel, uint8_t *packed, int n) {
+	pthread_once(&selected, pixel_select);
+	pack_impl(pixel, packed, n);
+}
+
+void pixel_unpack6(const uint8_t *packed, uint8_t *pixel, int n) {
+	pthread_once(&selected, pixel_select);
+	unpack_impl(packed, pixel, n);
+}
+
+void pixel_frame(const uint8_t *rx, uint8_t *pixel, int n, pixel_stats_t *st, uint32_t *hist) {
+	pthread_once(&selected, pixel_select);
+	frame_impl(rx, pixel, n, st, hist);
+}
+
+uint32_t pixel_sad16(const uint8_t *a, int stride_a, const uint8_t *b, int stride_b) {
+	pthread_once(&selected, pixel_select);
+	return sad_impl(a, stride_a, b, stride_b);
+}
@@ -0,0 +1,42 @@
+/*
+ * pixel.h
+ *
+ * kernels over raw 6 bit sensor pixels
+ */
+
+#ifndef PIXEL_H_
+#define PIXEL_H_
+#include <stdint.h>
+
+// 4 pixels in 3 bytes, little endian: p0 | p1 << 6 | p2 << 12 | p3 << 18
+#define PIXEL_PACKED_SIZE(n)	((n) / 4 * 3)
+
+#define PIXEL_LEVELS	64
+#define PIXEL_SOF		0xc0	// start of frame and valid bit in the pixel burst
+
+typedef struct {
+	int sof;				// first byte with PIXEL_SOF set, -1 if none
+	uint32_t sum;
+	uint8_t min;
+	uint8_t max;
+} pixel_stats_t;
+
+const char *pixel_impl(void);
+
+// mask raw burst bytes to pixels and gather stats in one pass, hist may be NULL
+void pixel_frame(const uint8_t *rx, uint8_t *pixel, int n, pixel_stats_t *st, uint32_t *hist);
+void pixel_frame_scalar(const uint8_t *rx, uint8_t *pixel, int n, pixel_stats_t *st, uint32_t *hist);
+
+// n has to be a multiple of 4
+void pixel_pack6(const uint8_t *pixel, uint8_t *packed, int n);
+void pixel_unpack6(const uint8_t *packed, uint8_t *pixel, int n);
+
+// sum of absolute differences of two 16x16 blocks
+uint32_t pixel_sad16(const uint8_t *a, int stride_a, const uint8_t *b, int stride_b);
+
+// reference versions, always scalar
+void pixel_pack6_scalar(const uint8_t *pixel, uint8_t *packed, int n);
+void pixel_unpack6_scalar(const uint8_t *packed, uint8_t *pixel, int n);
+uint32_t pixel_sad16_scalar(const uint8_t *a, int stride_a, const uint8_t *b, int stride_b);
+
+#endif /* PIXEL_H_ */
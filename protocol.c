@@ -0,0 +1,51 @@
+/*
+ * protocol.c
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "protocol.h"
+
+/*
+ * append received bytes and hand every complete request to h
+ *
+ * returns -1 if the stream is not framed correctly
+ */
+int proto_feed(proto_rx_t *rx, int client, const uint8_t *data, int len, proto_handler_t h) {
+	while (len > 0) {
+		uint32_t n = sizeof(rx->buf) - rx->len;
+		uint32_t off = 0;
+
+		if (n > (uint32_t)len) n = len;
+		memcpy(rx->buf + rx->len, data, n);
+		rx->len += n;
+		data += n;
+		len -= n;
+
+		while (rx->len - off >= sizeof(proto_req_t)) {
+			proto_req_t req;
+
+			memcpy(&req, rx->buf + off, sizeof(req));
+			if ((req.magic != PROTO_MAGIC) || (req.len > PROTO_MAX_PAYLOAD)) return -1;
+			if (rx->len - off < sizeof(req) + req.len) break;
+
+			h(client, &req, rx->buf + off + sizeof(req));
+			off += sizeof(req) + req.len;
+		}
+
+		// keep the incomplete rest at the start
+		memmove(rx->buf, rx->buf + off, rx->len - off);
+		rx->len -= off;
+	}
+	return 0;
+}
+
+void proto_resp_init(proto_resp_t *r, const proto_req_t *req, uint8_t status, uint32_t len) {
+	memset(r, 0, sizeof(*r));
+	r->magic = PROTO_MAGIC;
+	r->len = len;
+	r->id = req->id;
+	r->cmd = req->cmd;
+	r->status = status;
+}
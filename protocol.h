@@ -0,0 +1,99 @@
+/*
+ * protocol.h
+ *
+ * framed binary socket protocol, all fields little endian
+ *
+ * A client switches to it by starting with PROTO_MAGIC; anything else is
+ * served with the old text commands. Every request carries an id that is
+ * echoed in its responses, so requests can be pipelined. Grab and
+ * subscribe requests answer with a stream of responses, the last one
+ * flagged PROTO_F_LAST.
+ */
+
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+#include <stdint.h>
+
+#define PROTO_MAGIC			0x018030adU		// bytes ad 30 80 01
+#define PROTO_MAX_PAYLOAD	256				// request payload
+
+// commands
+#define PROTO_PING			0	// -
+#define PROTO_GRAB			1	// uint32 frames, answered with 900 pixels (675 bytes packed, less coded) each
+#define PROTO_SUBSCRIBE		2	// uint32 period (us), answered with proto_motion_t
+#define PROTO_READ_REG		3	// addresses, answered with one value each
+#define PROTO_WRITE_REG		4	// address, value pairs
+#define PROTO_SET_SHUTTER	5	// uint16 shutter maximum bound
+#define PROTO_CANCEL		6	// uint32 id of a grab or subscription
+#define PROTO_ODOMETRY		7	// uint32 period (us), answered with proto_odo_t
+#define PROTO_STATS			8	// -, answered with the latency report as text
+
+// status
+#define PROTO_OK			0
+#define PROTO_EINVAL		1	// malformed request
+#define PROTO_EIO			2	// sensor access failed
+#define PROTO_EBUSY			3	// too many requests in flight, or no room for the answer
+#define PROTO_ECANCELED		4
+
+// request flags
+#define PROTO_F_PACKED6		0x02	// grab: send pixels packed, 4 in 3 bytes (pixel.h)
+#define PROTO_F_DELTA		0x04	// grab: send pixels inter-frame coded (framecodec.h)
+
+// response flags
+#define PROTO_F_LAST		0x01	// no more responses for this id
+// PROTO_F_PACKED6 set if the payload is packed
+// PROTO_F_DELTA set if the payload is coded, to be decoded in seq order
+// starting with the first response, which is always a keyframe
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint8_t cmd;
+	uint8_t flags;
+	uint16_t len;			// payload bytes following the header
+	uint32_t id;
+} proto_req_t;
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint32_t len;			// payload bytes following the header
+	uint32_t id;
+	uint8_t cmd;
+	uint8_t status;
+	uint8_t flags;
+	uint8_t res;
+	uint64_t t_ns;			// CLOCK_MONOTONIC when the data was taken
+	uint16_t shutter;
+	uint16_t frame_period;
+	uint32_t seq;			// response number within the request
+} proto_resp_t;
+
+typedef struct __attribute__((packed)) {
+	int32_t delta_X;		// accumulated since the previous sample
+	int32_t delta_Y;
+	uint16_t squal;
+	uint8_t motion;
+	uint8_t pixel_sum;
+} proto_motion_t;
+
+typedef struct __attribute__((packed)) {
+	int64_t pos_X;			// counts since the subscription, incl. estimated lost ones
+	int64_t pos_Y;
+	float vel_X;			// counts/s
+	float vel_Y;
+	int32_t lost_X;			// estimated counts lost to overflows since the subscription
+	int32_t lost_Y;
+	uint32_t overflows;
+} proto_odo_t;
+
+// reassembly of requests split or coalesced by TCP
+typedef struct {
+	uint8_t buf[2 * (sizeof(proto_req_t) + PROTO_MAX_PAYLOAD)];
+	uint32_t len;
+} proto_rx_t;
+
+typedef void (*proto_handler_t)(int client, const proto_req_t *req, const uint8_t *payload);
+
+int proto_feed(proto_rx_t *rx, int client, const uint8_t *data, int len, proto_handler_t h);
+void proto_resp_init(proto_resp_t *r, const proto_req_t *req, uint8_t status, uint32_t len);
+
+#endif /* PROTOCOL_H_ */
@@ -0,0 +1,181 @@
+/*
+ * recorder.c
+ *
+ * The log file, its writer thread and the odometry belong to a recording,
+ * the sample schedule to the caller, so a new recording can start on the
+ * next deadline after the previous one.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adns.h"
+#include "i2c.h"
+#include "recorder.h"
+#include "sample.h"
+#include "sched.h"
+
+// servo and bright[0..3], the brightness words are read in one burst
+static const uint8_t i2c_regs[5] = { 0x32, 0x76, 0x78, 0x72, 0x74 };
+
+int recorder_start(recorder_t *r, int fd, const char *file, const recorder_conf_t *conf) {
+	memset(r, 0, sizeof(*r));
+	r->fd = fd;
+	r->conf = *conf;
+
+	if (file == NULL) {
+		r->lfd = stdout;
+	} else if (conf->binary) {
+		r->blog = malloc(sizeof(binlog_t));
+		if ((r->blog == NULL) || (binlog_open(r->blog, file, conf->columns, conf->append) != 0)) {
+			printf("can't open binary log file %s\n", file);
+			free(r->blog);
+			return -1;
+		}
+	} else {
+		r->lfd = fopen(file, "w");
+		if (r->lfd == NULL) {
+			printf("can't open log file %s\n", file);
+			return -1;
+		}
+		setvbuf(r->lfd, NULL, _IOFBF, LOGWRITER_TSV_BUFFER);
+	}
+
+	// t = 0 and its wall clock time
+	r->t0_realtime = sched_anchor(&r->t0);
+	if (r->blog != NULL) binlog_start(r->blog, r->t0_realtime);
+	if ((file != NULL) && (r->lfd != NULL)) {
+		if (conf->columns & SAMPLE_TIMING) sample_print_anchor(r->lfd, r->t0_realtime);
+		sample_print_header(r->lfd, conf->columns);
+	}
+	if (logwriter_start(&r->writer, r->lfd, r->blog, conf->columns, LOGWRITER_CAPACITY) != 0) {
+		printf("can't start log writer\n");
+		if (r->blog != NULL) {
+			binlog_close(r->blog);
+			free(r->blog);
+		}
+		if ((r->lfd != NULL) && (r->lfd != stdout)) fclose(r->lfd);
+		return -1;
+	}
+	odo_init(&r->odo);
+	if ((conf->columns & SAMPLE_I2C) && (conf->aux == NULL)) {
+		int i;
+		for (i = 0; i < 5; i++) i2cBatchAdd(&r->i2c, i2c_regs[i], 2);
+		i2cBatchPlan(&r->i2c);
+	}
+	return 0;
+}
+
+// hands on samples whose i2c values are known, in order
+static void flush(recorder_t *r, int force) {
+	while (r->pending_n) {
+		sample_t *s = &r->pending[r->pending_head];
+		int f = force || (r->pending_n == RECORDER_PENDING) || (r->t_ns - s->t_ns > r->conf.aux->max_wait_ns);
+
+		if (!aux_merge(r->conf.aux, s->t_ns + r->t0, s, f)) break;
+		logwriter_push(&r->writer, s);
+		r->pending_head = (r->pending_head + 1) % RECORDER_PENDING;
+		r->pending_n--;
+	}
+}
+
+int recorder_sample(recorder_t *r) {
+	sample_t sample = {0};
+	uint64_t ta, tb;
+
+	// stamped in the middle of the transfer
+	ta = sched_now_raw();
+	ADNS_read_motion_burst(r->fd);
+	tb = sched_now_raw();
+
+	sample.t_ns		= ta + (tb - ta) / 2 - r->t0;
+	sample.spi_ns		= tb - ta;
+	r->t_ns = sample.t_ns;
+	if (r->conf.columns & SAMPLE_ODO) odo_update(&r->odo, sample.t_ns, adns.motion_val, adns.delta_X, adns.delta_Y);
+
+	// integrate every sample, log the ones due, with MOT, OVF and the deltas of the skipped ones
+	r->motion_flags |= adns.motion_val & 0x90;
+	r->sum_X += adns.delta_X;
+	r->sum_Y += adns.delta_Y;
+	if (sample.t_ns < r->next_log) return 0;
+	r->next_log += r->conf.log_period_ns;
+	if (r->next_log <= sample.t_ns) r->next_log = sample.t_ns + r->conf.log_period_ns;
+
+	sample.motion		= adns.motion_val | r->motion_flags;
+	r->motion_flags = 0;
+	sample.delta_X		= r->sum_X;
+	sample.delta_Y		= r->sum_Y;
+	r->sum_X = r->sum_Y = 0;
+	sample.squal		= adns.squal;
+	sample.shutter		= adns.shutter;
+	sample.pixel_sum	= adns.pixel_sum;
+	sample.valid		= adns.product_ID + adns.inv_product_ID;
+
+	if ((r->conf.columns & SAMPLE_I2C) && (r->conf.aux == NULL)) {
+		int i, failed;
+
+		ta = sched_now_raw();
+		failed = i2cBatchRead(&r->i2c);
+		tb = sched_now_raw();
+		// like the single reads, all ones without an answer
+		sample.servo		= failed ? 0xffff : i2cBatchValue(&r->i2c, 0);
+		for (i = 0; i < 4; i++) sample.bright[i] = failed ? 0xffff : i2cBatchValue(&r->i2c, i + 1);
+		sample.i2c_ofs_ns	= (int64_t)(ta + (tb - ta) / 2 - r->t0) - (int64_t)sample.t_ns;
+		sample.i2c_ns		= tb - ta;
+	}
+	if (r->conf.columns & SAMPLE_ODO) {
+		sample.pos_X		= r->odo.x;
+		sample.pos_Y		= r->odo.y;
+		sample.vel_X		= r->odo.vx;
+		sample.vel_Y		= r->odo.vy;
+		sample.lost_X		= r->odo.lost_x;
+		sample.lost_Y		= r->odo.lost_y;
+	}
+
+	if ((r->conf.columns & SAMPLE_I2C) && (r->conf.aux != NULL)) {
+		// waits for the aux sample after it
+		flush(r, 0);
+		r->pending[(r->pending_head + r->pending_n++) % RECORDER_PENDING] = sample;
+		flush(r, 0);
+		return 1;
+	}
+	logwriter_push(&r->writer, &sample);
+	return 1;
+}
+
+void recorder_push(recorder_t *r, sample_t *s) {
+	r->t_ns = s->t_ns;
+	logwriter_push(&r->writer, s);
+}
+
+void recorder_stop(recorder_t *r) {
+	if (r->pending_n) flush(r, 1);
+	logwriter_stop(&r->writer);
+	if (r->blog != NULL) {
+		binlog_close(r->blog);
+		free(r->blog);
+		r->blog = NULL;
+	}
+	if (r->lfd == stdout) {
+		fflush(stdout);
+	} else if (r->lfd != NULL) {
+		fclose(r->lfd);
+	}
+	r->lfd = NULL;
+}
+
+void recorder_report(const recorder_t *r, FILE *f) {
+	const odo_t *odo = &r->odo;
+
+	logwriter_report(&r->writer, f);
+	if (!(r->conf.columns & SAMPLE_ODO)) return;
+	fprintf(f, "\todometry X %lld Y %lld counts, %llu overflows, estimated lost X %lld Y %lld\n",
+		(long long)odo->x, (long long)odo->y, (unsigned long long)odo->overflows,
+		(long long)odo->lost_x, (long long)odo->lost_y);
+	if (odo->unestimated) {
+		fprintf(f, "\twarning: %llu saturated deltas without a velocity to estimate the loss\n",
+			(unsigned long long)odo->unestimated);
+	}
+}
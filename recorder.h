@@ -0,0 +1,61 @@
+/*
+ * recorder.h
+ *
+ * one recording: samples read at the caller's schedule into a log file
+ */
+
+#ifndef RECORDER_H_
+#define RECORDER_H_
+#include <stdint.h>
+#include <stdio.h>
+
+#include "aux.h"
+#include "binlog.h"
+#include "i2c.h"
+#include "logwriter.h"
+#include "odometry.h"
+
+typedef struct {
+	int columns;			// optional column groups (sample.h)
+	int binary;				// binlog instead of TSV
+	int append;				// binary logs only
+	uint64_t log_period_ns;	// 0: log every sample
+	aux_t *aux;				// i2c channels of their own, NULL: read with the motion
+} recorder_conf_t;
+
+#define RECORDER_PENDING	128		// samples waiting for their i2c values
+
+typedef struct {
+	int fd;
+	recorder_conf_t conf;
+	FILE *lfd;
+	binlog_t *blog;
+	logwriter_t writer;
+	odo_t odo;
+
+	uint64_t t0;			// CLOCK_MONOTONIC_RAW of t = 0
+	int64_t t0_realtime;
+	uint64_t t_ns;			// of the last sample
+	uint64_t next_log;
+	uint8_t motion_flags;	// MOT and OVF of samples not logged
+	int32_t sum_X;			// deltas since the last logged sample
+	int32_t sum_Y;
+	i2c_batch_t i2c;		// servo and brightness, in sample order
+	sample_t pending[RECORDER_PENDING];
+	uint32_t pending_head;
+	uint32_t pending_n;
+} recorder_t;
+
+/*
+ * file NULL writes TSV to stdout, fd -1 for samples pushed by the caller,
+ * returns 0 or -1; r must not move until stopped
+ */
+int recorder_start(recorder_t *r, int fd, const char *file, const recorder_conf_t *conf);
+// returns 1 if the sample was logged, 0 if decimated
+int recorder_sample(recorder_t *r);
+// logs a sample read elsewhere, its t_ns relative to r->t0
+void recorder_push(recorder_t *r, sample_t *s);
+void recorder_stop(recorder_t *r);
+void recorder_report(const recorder_t *r, FILE *f);
+
+#endif /* RECORDER_H_ */
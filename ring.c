@@ -0,0 +1,88 @@
+/*
+ * ring.c
+ *
+ * head and tail are free running counters, the element index is the
+ * counter masked with size - 1. The producer only writes head, the
+ * consumer only writes tail; each side caches the other's counter and
+ * only reloads it when the cached value says full/empty.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "ring.h"
+
+int ring_init(ring_t *r, size_t elem_size, uint32_t size) {
+	if ((size == 0) || (size & (size - 1))) return -1;
+
+	memset(r, 0, sizeof(*r));
+	r->buf = malloc(elem_size * size);
+	if (r->buf == NULL) return -1;
+	// touch everything now, not on the hot path
+	memset(r->buf, 0, elem_size * size);
+
+	r->elem_size = elem_size;
+	r->size = size;
+	r->mask = size - 1;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	return 0;
+}
+
+void ring_free(ring_t *r) {
+	free(r->buf);
+	r->buf = NULL;
+}
+
+void *ring_reserve(ring_t *r) {
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	if (head - r->tail_cache == r->size) {
+		r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+		if (head - r->tail_cache == r->size) return NULL;
+	}
+	return r->buf + (head & r->mask) * r->elem_size;
+}
+
+void ring_commit(ring_t *r) {
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+int ring_push(ring_t *r, const void *elem) {
+	void *slot = ring_reserve(r);
+	if (slot == NULL) return -1;
+
+	memcpy(slot, elem, r->elem_size);
+	ring_commit(r);
+	return 0;
+}
+
+uint32_t ring_peek(ring_t *r, void **first) {
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	uint32_t n;
+
+	if (r->head_cache == tail) {
+		r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+		if (r->head_cache == tail) return 0;
+	}
+
+	// contiguous part only, the rest follows on the next peek
+	n = r->head_cache - tail;
+	if ((tail & r->mask) + n > r->size) n = r->size - (tail & r->mask);
+
+	*first = r->buf + (tail & r->mask) * r->elem_size;
+	return n;
+}
+
+void ring_release(ring_t *r, uint32_t n) {
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+}
+
+uint32_t ring_count(ring_t *r) {
+	return atomic_load_explicit(&r->head, memory_order_acquire)
+		- atomic_load_explicit(&r->tail, memory_order_acquire);
+}
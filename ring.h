@@ -0,0 +1,43 @@
+/*
+ * ring.h
+ *
+ * lock-free single producer / single consumer ring of fixed-size elements
+ */
+
+#ifndef RING_H_
+#define RING_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define RING_CACHELINE	64
+
+typedef struct {
+	// producer side
+	_Alignas(RING_CACHELINE) _Atomic uint32_t head;
+	uint32_t tail_cache;
+	// consumer side
+	_Alignas(RING_CACHELINE) _Atomic uint32_t tail;
+	uint32_t head_cache;
+	// constant after init
+	_Alignas(RING_CACHELINE) uint8_t *buf;
+	size_t elem_size;
+	uint32_t size;			// power of two
+	uint32_t mask;
+} ring_t;
+
+int ring_init(ring_t *r, size_t elem_size, uint32_t size);
+void ring_free(ring_t *r);
+
+// producer
+void *ring_reserve(ring_t *r);
+void ring_commit(ring_t *r);
+int ring_push(ring_t *r, const void *elem);
+
+// consumer
+uint32_t ring_peek(ring_t *r, void **first);
+void ring_release(ring_t *r, uint32_t n);
+
+uint32_t ring_count(ring_t *r);
+
+#endif /* RING_H_ */
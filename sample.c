@@ -0,0 +1,59 @@
+/*
+ * sample.c
+ *
+ * TSV layout of the sample log, shared by the logger and the binary log
+ * converter so both produce identical files
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sample.h"
+
+// wall clock time of t = 0, ahead of the column header
+void sample_print_anchor(FILE *f, int64_t t0_realtime_ns) {
+	fprintf(f, "# t0 realtime %lld.%09lld\n", (long long)(t0_realtime_ns / 1000000000),
+		(long long)(t0_realtime_ns % 1000000000));
+}
+
+void sample_print_header(FILE *f, int columns) {
+	fprintf(f, "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s", "t", "MOT", "dX", "dY", "SQUAL", "shut", "pxSum", "OVF", "RES", "valid");
+	if (columns & SAMPLE_SENSOR) fprintf(f, "\t%s", "sensor");
+	if (columns & SAMPLE_I2C) {
+		fprintf(f, "\t%s\t%s\t%s\t%s\t%s", "servo", "bright 0", "bright 1", "bright 2", "bright 3");
+	}
+	if (columns & SAMPLE_ODO) {
+		fprintf(f, "\t%s\t%s\t%s\t%s\t%s\t%s", "X", "Y", "vX", "vY", "lostX", "lostY");
+	}
+	if (columns & SAMPLE_TIMING) {
+		fprintf(f, "\t%s", "spi_us");
+		if (columns & SAMPLE_I2C) fprintf(f, "\t%s\t%s", "i2c_dt_us", "i2c_us");
+	}
+	fprintf(f, "\n");
+}
+
+int sample_print(FILE *f, const sample_t *s, int columns) {
+	int ret;
+
+	ret = fprintf(f, "%f\t%u\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t0x%x",
+		s->t_ns / 1E9, SAMPLE_MOT(s), s->delta_X, s->delta_Y,
+		s->squal, s->shutter, s->pixel_sum, SAMPLE_OVF(s),
+		SAMPLE_RES(s), s->valid);
+	if ((ret >= 0) && (columns & SAMPLE_SENSOR)) ret = fprintf(f, "\t%u", s->sensor);
+	if ((ret >= 0) && (columns & SAMPLE_I2C)) {
+		ret = fprintf(f, "\t%u\t%u\t%u\t%u\t%u",
+			s->servo, s->bright[0], s->bright[1], s->bright[2], s->bright[3]);
+	}
+	if ((ret >= 0) && (columns & SAMPLE_ODO)) {
+		ret = fprintf(f, "\t%lld\t%lld\t%.1f\t%.1f\t%d\t%d",
+			(long long)s->pos_X, (long long)s->pos_Y, s->vel_X, s->vel_Y, s->lost_X, s->lost_Y);
+	}
+	if ((ret >= 0) && (columns & SAMPLE_TIMING)) {
+		ret = fprintf(f, "\t%.1f", s->spi_ns / 1E3);
+		if ((ret >= 0) && (columns & SAMPLE_I2C)) {
+			ret = fprintf(f, "\t%.1f\t%.1f", s->i2c_ofs_ns / 1E3, s->i2c_ns / 1E3);
+		}
+	}
+	if (ret >= 0) ret = fprintf(f, "\n");
+	return ret;
+}
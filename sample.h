@@ -0,0 +1,52 @@
+/*
+ * sample.h
+ *
+ * one logged measurement, fixed size so it can be stored as is
+ */
+
+#ifndef SAMPLE_H_
+#define SAMPLE_H_
+#include <stdint.h>
+#include <stdio.h>
+
+#define SAMPLE_MOT(s)	(((s)->motion >> 7) & 1)
+#define SAMPLE_OVF(s)	(((s)->motion >> 4) & 1)
+#define SAMPLE_RES(s)	((s)->motion & 1)
+
+// optional column groups, same bits as the binlog header flags
+#define SAMPLE_I2C		0x01
+#define SAMPLE_ODO		0x02
+#define SAMPLE_TIMING	0x04
+#define SAMPLE_SENSOR	0x08
+
+typedef struct __attribute__((packed)) {
+	uint64_t t_ns;		// midpoint of the motion read, CLOCK_MONOTONIC_RAW since start of the log
+	uint8_t kind;		// record kind in binary logs, 0 for samples
+	uint8_t motion;		// motion register (MOT, OVF, RES)
+	int32_t delta_X;	// sum of the reads since the last logged sample
+	int32_t delta_Y;
+	uint16_t squal;
+	uint16_t shutter;
+	uint8_t pixel_sum;
+	uint8_t sensor;		// index of the sensor in multi-sensor logs
+	uint16_t valid;		// product_ID + inv_product_ID
+	uint16_t servo;
+	uint16_t bright[4];
+	uint16_t dropped;	// samples lost to log overruns right before this one
+	int64_t pos_X;		// integrated counts (odometry.h)
+	int64_t pos_Y;
+	float vel_X;		// counts/s
+	float vel_Y;
+	int32_t lost_X;		// estimated counts lost to overflows, cumulative
+	int32_t lost_Y;
+	uint32_t spi_ns;	// duration of the motion read
+	int32_t i2c_ofs_ns;	// midpoint of the i2c reads (the nearer one if merged) relative to t_ns
+	uint32_t i2c_ns;	// duration of the i2c reads
+} sample_t;
+
+void sample_print_anchor(FILE *f, int64_t t0_realtime_ns);
+
+void sample_print_header(FILE *f, int columns);
+int sample_print(FILE *f, const sample_t *s, int columns);
+
+#endif /* SAMPLE_H_ */
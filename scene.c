@@ -0,0 +1,81 @@
+/*
+ * scene.c
+ *
+ * deterministic value noise texture, sampled at sub pixel positions so
+ * consecutive frames are consistent with the integrated motion
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "scene.h"
+
+#define ONE			(1 << SCENE_Q)
+#define COARSE_SHIFT	(SCENE_Q + 2)	// lattice every 4 pixel
+#define FINE_SHIFT		(SCENE_Q + 1)	// lattice every 2 pixel
+
+static uint32_t hash(int64_t ix, int64_t iy, uint32_t seed) {
+	uint32_t h = seed ^ (uint32_t)ix * 0x9e3779b1u ^ (uint32_t)iy * 0x85ebca77u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+// bilinear interpolated lattice noise, returns 0..255
+static uint32_t noise(int64_t x, int64_t y, int shift, uint32_t seed) {
+	int64_t ix = x >> shift;
+	int64_t iy = y >> shift;
+	uint32_t fx = (x - (ix << shift)) >> (shift - 8);
+	uint32_t fy = (y - (iy << shift)) >> (shift - 8);
+
+	uint32_t v00 = hash(ix,     iy,     seed) & 0xff;
+	uint32_t v10 = hash(ix + 1, iy,     seed) & 0xff;
+	uint32_t v01 = hash(ix,     iy + 1, seed) & 0xff;
+	uint32_t v11 = hash(ix + 1, iy + 1, seed) & 0xff;
+
+	uint32_t a = v00 * (256 - fx) + v10 * fx;
+	uint32_t b = v01 * (256 - fx) + v11 * fx;
+	return (a * (256 - fy) + b * fy) >> 16;
+}
+
+void scene_init(scene_t *s, uint32_t seed) {
+	memset(s, 0, sizeof(*s));
+	s->seed = seed;
+}
+
+void scene_set_speed(scene_t *s, int32_t speed_x, int32_t speed_y) {
+	s->speed_x = speed_x;
+	s->speed_y = speed_y;
+}
+
+void scene_advance(scene_t *s, uint64_t dt_ns) {
+	// integrate in steps of max. 1 s to stay inside 64 bit
+	while (dt_ns) {
+		uint64_t step = dt_ns > 1000000000ULL ? 1000000000ULL : dt_ns;
+		s->rem_x += (int64_t)s->speed_x * (int64_t)step * ONE;
+		s->rem_y += (int64_t)s->speed_y * (int64_t)step * ONE;
+		s->x += s->rem_x / 1000000000LL;
+		s->y += s->rem_y / 1000000000LL;
+		s->rem_x %= 1000000000LL;
+		s->rem_y %= 1000000000LL;
+		dt_ns -= step;
+	}
+}
+
+uint8_t scene_pixel(const scene_t *s, int64_t x, int64_t y) {
+	uint32_t v = 2 * noise(x, y, COARSE_SHIFT, s->seed) + noise(x, y, FINE_SHIFT, ~s->seed);
+	// 0..765 -> 6 bit
+	return (v * 64) / 766;
+}
+
+void scene_render(const scene_t *s, uint8_t *frame) {
+	int i, j;
+	for (j = 0; j < SCENE_FRAME_SIZE; j++) {
+		for (i = 0; i < SCENE_FRAME_SIZE; i++) {
+			frame[j * SCENE_FRAME_SIZE + i] = scene_pixel(s, s->x + i * ONE, s->y + j * ONE);
+		}
+	}
+}
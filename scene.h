@@ -0,0 +1,30 @@
+/*
+ * scene.h
+ *
+ * synthetic surface texture moving below the emulated sensor
+ */
+
+#ifndef SCENE_H_
+#define SCENE_H_
+#include <stdint.h>
+
+#define SCENE_FRAME_SIZE	30
+#define SCENE_Q			8	// fixed point fraction bits of positions
+
+typedef struct {
+	uint32_t seed;
+	int32_t speed_x;	// pixel/s
+	int32_t speed_y;	// pixel/s
+	int64_t x;			// position in 1/256 pixel
+	int64_t y;
+	int64_t rem_x;		// sub step remainder of the integration
+	int64_t rem_y;
+} scene_t;
+
+void scene_init(scene_t *s, uint32_t seed);
+void scene_set_speed(scene_t *s, int32_t speed_x, int32_t speed_y);
+void scene_advance(scene_t *s, uint64_t dt_ns);
+uint8_t scene_pixel(const scene_t *s, int64_t x, int64_t y);
+void scene_render(const scene_t *s, uint8_t *frame);
+
+#endif /* SCENE_H_ */
@@ -0,0 +1,111 @@
+/*
+ * sched.c
+ *
+ * Deadlines are k * period after the start, independent of how long the
+ * work between two waits took, so the rate does not drift. When the work
+ * overruns one or more periods the missed deadlines are counted and the
+ * schedule continues at the next deadline still ahead.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "sched.h"
+
+uint64_t sched_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t sched_now_raw(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define ANCHOR_TRIES	8
+
+// the realtime reading bracketed most tightly by two raw readings
+int64_t sched_anchor(uint64_t *raw) {
+	uint64_t best = UINT64_MAX;
+	int64_t realtime = 0;
+	int i;
+
+	for (i = 0; i < ANCHOR_TRIES; i++) {
+		struct timespec ts;
+		uint64_t a, b;
+
+		a = sched_now_raw();
+		clock_gettime(CLOCK_REALTIME, &ts);
+		b = sched_now_raw();
+		if (b - a < best) {
+			best = b - a;
+			*raw = a + (b - a) / 2;
+			realtime = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+		}
+	}
+	return realtime;
+}
+
+int sched_init(sched_t *s, double rate) {
+	if (rate <= 0) return -1;
+
+	s->period_ns = 1E9 / rate;
+	if (s->period_ns == 0) s->period_ns = 1;
+	s->t_start = sched_now();
+	s->deadline = s->t_start;
+	s->samples = 0;
+	s->missed = 0;
+	s->late_min = INT64_MAX;
+	s->late_max = INT64_MIN;
+	s->late_sum = 0;
+	s->late_sumsq = 0;
+	return 0;
+}
+
+int sched_wait(sched_t *s) {
+	uint64_t now;
+	int missed = 0;
+	struct timespec ts;
+
+	s->deadline += s->period_ns;
+	s->samples++;
+
+	now = sched_now();
+	if (now > s->deadline) {
+		// overrun: skip the deadlines that already passed, wait for the next one ahead
+		missed = (now - s->deadline) / s->period_ns + 1;
+		s->deadline += (uint64_t)missed * s->period_ns;
+		s->missed += missed;
+	}
+
+	ts.tv_sec = s->deadline / 1000000000ULL;
+	ts.tv_nsec = s->deadline % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+	int64_t late = (int64_t)(sched_now() - s->deadline);
+	if (late < s->late_min) s->late_min = late;
+	if (late > s->late_max) s->late_max = late;
+	s->late_sum += late;
+	s->late_sumsq += (double)late * late;
+
+	return missed;
+}
+
+void sched_report(const sched_t *s, FILE *f) {
+	if (s->samples == 0) return;
+
+	double elapsed = (sched_now() - s->t_start) / 1E9;
+	double mean = s->late_sum / s->samples;
+	double var = s->late_sumsq / s->samples - mean * mean;
+
+	fprintf(f, "\tsamples %llu in %.3f s - %.3f Hz (target %.3f Hz)\n",
+		(unsigned long long)s->samples, elapsed, s->samples / elapsed, 1E9 / s->period_ns);
+	fprintf(f, "\tmissed deadlines %llu\n", (unsigned long long)s->missed);
+	fprintf(f, "\tjitter min %.1f us, max %.1f us, mean %.1f us, sd %.1f us\n",
+		s->late_min / 1E3, s->late_max / 1E3, mean / 1E3, sqrt(var > 0 ? var : 0) / 1E3);
+}
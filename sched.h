@@ -0,0 +1,33 @@
+/*
+ * sched.h
+ *
+ * sampling on absolute CLOCK_MONOTONIC deadlines
+ */
+
+#ifndef SCHED_H_
+#define SCHED_H_
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct {
+	uint64_t period_ns;
+	uint64_t t_start;		// first deadline
+	uint64_t deadline;		// next deadline
+	uint64_t samples;		// deadlines served
+	uint64_t missed;		// deadlines skipped because we were late
+	int64_t late_min;		// wakeup lateness
+	int64_t late_max;
+	double late_sum;
+	double late_sumsq;
+} sched_t;
+
+uint64_t sched_now(void);
+// sample timestamps, not slewed by NTP
+uint64_t sched_now_raw(void);
+// realtime (ns since the epoch) of the CLOCK_MONOTONIC_RAW instant *raw
+int64_t sched_anchor(uint64_t *raw);
+int sched_init(sched_t *s, double rate);
+int sched_wait(sched_t *s);
+void sched_report(const sched_t *s, FILE *f);
+
+#endif /* SCHED_H_ */
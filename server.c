@@ -0,0 +1,553 @@
+/*
+ * server.c
+ *
+ * Serves socket clients between socket_server_poll rounds. Clients
+ * starting with PROTO_MAGIC speak the framed protocol of protocol.h,
+ * everything else gets the old text commands (grab, stream [n], stats,
+ * quit).
+ *
+ * Register access and configuration requests are answered right away.
+ * Frame grabs and motion subscriptions become jobs: one capture serves
+ * every client waiting for a frame, one motion burst read serves every
+ * subscription that is due, and its deltas are accumulated for the
+ * others. Clients with a full send queue are skipped, not waited for.
+ *
+ * Odometry subscriptions share one integrator that reads the sensor at
+ * the server's sample rate as long as any of them exists.
+ *
+ * Delta coded grabs share one encoder, so a frame is coded once for all
+ * of them. A job that misses a coded frame, or has just started, is out
+ * of sync and gets a keyframe forced on the next capture.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adns.h"
+#include "framecodec.h"
+#include "framestream.h"
+#include "latency.h"
+#include "odometry.h"
+#include "pixel.h"
+#include "protocol.h"
+#include "sched.h"
+#include "server.h"
+#include "socket-server.h"
+#include "trace.h"
+
+#define CLIENT_NEW		0
+#define CLIENT_TEXT		1
+#define CLIENT_BINARY	2
+
+typedef struct {
+	proto_req_t req;		// cmd 0: free
+	uint32_t left;			// frames still to send
+	uint64_t period_ns;		// subscriptions
+	uint64_t deadline;
+	int32_t delta_X;		// accumulated since the last sample sent
+	int32_t delta_Y;
+	uint32_t seq;
+	uint8_t synced;			// delta grabs: has the last coded frame
+	uint8_t started;		// odometry: base taken
+	odo_t base;				// odometry state at the first burst
+} job_t;
+
+typedef struct {
+	uint8_t mode;
+
+	// text protocol
+	uint8_t grab;
+	uint8_t streaming;
+	uint64_t stream_left;	// frames still to send
+	uint64_t streamed;
+	uint64_t skipped;		// frames not sent, send queue full
+	uint64_t t_stream;
+
+	// binary protocol
+	proto_rx_t rx;
+	job_t job[SERVER_JOBS];
+} client_state_t;
+
+static client_state_t clients[SOCKET_SERVER_CLIENTS];
+static int sensor;
+static int verbose;
+static uint64_t t0;
+static framecodec_t codec;		// shared by all delta coded grabs
+static odo_t odo;
+static uint64_t odo_period_ns;
+static uint64_t odo_next;
+
+// a response header and the biggest payload, sent as one message
+static uint8_t msg[sizeof(proto_resp_t) + ADNS_FRAME_PIXELS];
+
+static result_t respond(int client, const proto_resp_t *r, const void *payload) {
+	memcpy(msg, r, sizeof(*r));
+	if (payload != NULL) memcpy(msg + sizeof(*r), payload, r->len);
+	return socket_server_send(client, msg, sizeof(*r) + r->len);
+}
+
+static void respond_status(int client, const proto_req_t *req, uint8_t status) {
+	proto_resp_t r;
+
+	proto_resp_init(&r, req, status, 0);
+	r.flags = PROTO_F_LAST;
+	r.t_ns = sched_now();
+	r.shutter = adns.shutter;
+	r.frame_period = adns.frame_period;
+	respond(client, &r, NULL);
+}
+
+// latency report as text, NULL if it can't be made
+static char *stats_text(size_t *len) {
+	char *text = NULL;
+	FILE *f = open_memstream(&text, len);
+
+	if (f == NULL) return NULL;
+	lat_report(f);
+	fclose(f);
+	return text;
+}
+
+static void client_stream_report(int client, client_state_t *c) {
+	double dt = (sched_now() - c->t_stream) / 1E9;
+
+	printf("\tclient %d: streamed %llu frames in %.3f s (%.1f fps)", client,
+		(unsigned long long)c->streamed, dt, dt > 0 ? c->streamed / dt : 0.0);
+	if (c->skipped) printf(", %llu skipped while its queue was full", (unsigned long long)c->skipped);
+	printf("\n");
+	c->streaming = 0;
+}
+
+static void on_text(int client, client_state_t *c, char *buffer, int size) {
+	if ((strcmp("quit", buffer) == 0)
+		|| (strcmp("exit", buffer) == 0) 
+		|| (strcmp("q", buffer) == 0)) { 
+		if (verbose) printf("\t\tsocket: termination signal received\n");
+		socket_server_disconnect(client);
+	} else if ((strcmp("grab", buffer) == 0)
+		|| (strcmp("g", buffer) == 0)) { 
+		if (verbose) printf("\t\tsocket: raw frame request received\n");
+		c->grab = 1;
+	} else if (strcmp("stats", buffer) == 0) {
+		size_t len;
+		char *text = stats_text(&len);
+		if (text != NULL) socket_server_send(client, text, len);
+		free(text);
+	} else if (strncmp("stream", buffer, 6) == 0) {
+		// "stream [n]": n frames, until the client leaves without
+		uint64_t n = strtoull(buffer + 6, NULL, 10);
+		if (verbose) printf("\t\tsocket: frame stream request received\n");
+		if (c->streaming) client_stream_report(client, c);
+		c->stream_left = n ? n : UINT64_MAX;
+		c->streamed = 0;
+		c->skipped = 0;
+		c->t_stream = sched_now();
+		c->streaming = 1;
+	}
+}
+
+static job_t *job_add(client_state_t *c, const proto_req_t *req) {
+	int i;
+
+	for (i = 0; i < SERVER_JOBS; i++) {
+		if (c->job[i].req.cmd == 0) {
+			memset(&c->job[i], 0, sizeof(job_t));
+			c->job[i].req = *req;
+			return &c->job[i];
+		}
+	}
+	return NULL;
+}
+
+static void on_request(int client, const proto_req_t *req, const uint8_t *payload) {
+	client_state_t *c = &clients[client];
+	adns_plan_t plan;
+	uint32_t arg = 0;
+	job_t *j;
+	int i;
+
+	if (verbose > 1) printf("\t\tsocket: request %u cmd %u len %u\n", req->id, req->cmd, req->len);
+	if (req->len >= 4) memcpy(&arg, payload, 4);
+
+	switch (req->cmd) {
+	case PROTO_PING:
+		respond_status(client, req, PROTO_OK);
+		break;
+
+	case PROTO_GRAB:
+	case PROTO_SUBSCRIBE:
+	case PROTO_ODOMETRY:
+		if ((req->len != 4) || (arg == 0)) {
+			respond_status(client, req, PROTO_EINVAL);
+			break;
+		}
+		j = job_add(c, req);
+		if (j == NULL) {
+			respond_status(client, req, PROTO_EBUSY);
+			break;
+		}
+		j->left = arg;
+		j->period_ns = (uint64_t)arg * 1000;
+		j->deadline = sched_now();
+		break;
+
+	case PROTO_READ_REG: {
+		uint8_t val[PROTO_MAX_PAYLOAD];
+		proto_resp_t r;
+
+		ADNS_plan_init(&plan);
+		for (i = 0; i < req->len; i++) {
+			uint8_t a = payload[i] & 0x7f;
+			// bursts would need more than one byte
+			if ((a == 0x40) || (a == 0x50) || (ADNS_plan_read(&plan, a, &val[i]) != 0)) break;
+		}
+		if ((req->len == 0) || (i < req->len)) {
+			respond_status(client, req, PROTO_EINVAL);
+			break;
+		}
+		if (ADNS_plan_exec(sensor, &plan) < 1) {
+			respond_status(client, req, PROTO_EIO);
+			break;
+		}
+		proto_resp_init(&r, req, PROTO_OK, req->len);
+		r.flags = PROTO_F_LAST;
+		r.t_ns = sched_now();
+		r.shutter = adns.shutter;
+		r.frame_period = adns.frame_period;
+		respond(client, &r, val);
+		break;
+	}
+
+	case PROTO_WRITE_REG:
+		ADNS_plan_init(&plan);
+		for (i = 0; i + 1 < req->len; i += 2) {
+			if (ADNS_plan_write(&plan, payload[i] & 0x7f, payload[i + 1]) != 0) break;
+		}
+		if ((req->len == 0) || (i != req->len)) {
+			respond_status(client, req, PROTO_EINVAL);
+			break;
+		}
+		respond_status(client, req, (ADNS_plan_exec(sensor, &plan) < 1) ? PROTO_EIO : PROTO_OK);
+		break;
+
+	case PROTO_SET_SHUTTER: {
+		uint16_t shutter;
+
+		if (req->len != 2) {
+			respond_status(client, req, PROTO_EINVAL);
+			break;
+		}
+		memcpy(&shutter, payload, 2);
+		if (ADNS_set_FPS_bounds(sensor, shutter, NULL) < 1) {
+			respond_status(client, req, PROTO_EIO);
+			break;
+		}
+		ADNS_read_all(sensor);
+		respond_status(client, req, PROTO_OK);
+		break;
+	}
+
+	case PROTO_STATS: {
+		proto_resp_t r;
+		size_t len;
+		char *text = stats_text(&len);
+
+		if ((text == NULL) || (len > SOCKET_SERVER_TXQ - sizeof(r))) {
+			respond_status(client, req, PROTO_EIO);
+			free(text);
+			break;
+		}
+		proto_resp_init(&r, req, PROTO_OK, len);
+		r.flags = PROTO_F_LAST;
+		r.t_ns = sched_now();
+		r.shutter = adns.shutter;
+		r.frame_period = adns.frame_period;
+		// both in one go, the queue takes all or nothing
+		if (socket_server_space(client) >= (int)(sizeof(r) + len)) {
+			socket_server_send(client, &r, sizeof(r));
+			socket_server_send(client, text, len);
+		} else {
+			// still an answer, the client can ask again once it has read its queue
+			respond_status(client, req, PROTO_EBUSY);
+		}
+		free(text);
+		break;
+	}
+
+	case PROTO_CANCEL:
+		for (i = 0; i < SERVER_JOBS; i++) {
+			if (c->job[i].req.cmd && (c->job[i].req.id == arg)) break;
+		}
+		if ((req->len != 4) || (i == SERVER_JOBS)) {
+			respond_status(client, req, PROTO_EINVAL);
+			break;
+		}
+		respond_status(client, &c->job[i].req, PROTO_ECANCELED);
+		c->job[i].req.cmd = 0;
+		respond_status(client, req, PROTO_OK);
+		break;
+
+	default:
+		respond_status(client, req, PROTO_EINVAL);
+	}
+}
+
+// runs inside socket_server_poll, frames and samples are sent by serve
+static void on_client(int client, char *buffer, int size) {
+	client_state_t *c = &clients[client];
+
+	if (size == 0) {
+		if (c->streaming) client_stream_report(client, c);
+		memset(c, 0, sizeof(*c));
+		return;
+	}
+
+	if (c->mode == CLIENT_NEW) {
+		c->mode = ((uint8_t)buffer[0] == (PROTO_MAGIC & 0xff)) ? CLIENT_BINARY : CLIENT_TEXT;
+	}
+
+	if (c->mode == CLIENT_TEXT) {
+		on_text(client, c, buffer, size);
+	} else if (proto_feed(&c->rx, client, (uint8_t *)buffer, size, on_request) != 0) {
+		printf("\tclient %d: protocol error\n", client);
+		socket_server_disconnect(client);
+	}
+}
+
+// frame jobs of all clients, returns the poll timeout
+static int serve_frames(void) {
+	static frame_t frame;
+	static uint8_t packed[PIXEL_PACKED_SIZE(ADNS_FRAME_PIXELS)];
+	static uint8_t coded[FRAMECODEC_MAX_SIZE];
+	static uint32_t seq;
+	int i, k, waiting = 0, ready = 0, have_packed = 0, coded_len = 0, key = 0;
+	proto_resp_t r;
+	uint64_t t;
+
+	for (i = 0; i < SOCKET_SERVER_CLIENTS; i++) {
+		client_state_t *c = &clients[i];
+		int space = socket_server_space(i);
+
+		if (c->grab) {
+			uint8_t pixel[ADNS_FRAME_PIXELS];
+			if (ADNS_read_frame_burst(sensor, pixel) >= ADNS_FRAME_PIXELS) {
+				socket_server_send(i, pixel, ADNS_FRAME_PIXELS);
+			} else {
+				// capture failed
+				if (verbose) printf("\t\traw frame capture failed\n");
+				// send only ping answer
+				socket_server_send(i, pixel, 1);
+			}
+			c->grab = 0;
+		}
+		if (c->streaming) {
+			waiting = 1;
+			if (space >= (int)sizeof(frame_t)) ready = 1;
+		}
+		for (k = 0; k < SERVER_JOBS; k++) {
+			if (c->job[k].req.cmd != PROTO_GRAB) continue;
+			waiting = 1;
+			if (space >= (int)(sizeof(proto_resp_t) + ADNS_FRAME_PIXELS)) ready = 1;
+		}
+	}
+	if (!waiting) return -1;
+	if (!ready) return 1;
+
+	// one capture serves every client waiting for a frame
+	t = sched_now();
+	frame.t_ns = t - t0;
+	frame.seq = seq++;
+	frame.frame_period = adns.frame_period;
+	frame.pixels = ADNS_FRAME_PIXELS;
+	if (ADNS_capture_frame(sensor, frame.pixel, NULL) < ADNS_FRAME_PIXELS) return 0;
+
+	for (i = 0; i < SOCKET_SERVER_CLIENTS; i++) {
+		for (k = 0; k < SERVER_JOBS; k++) {
+			job_t *j = &clients[i].job[k];
+			if ((j->req.cmd == PROTO_GRAB) && (j->req.flags & PROTO_F_DELTA) && !j->synced
+					&& (socket_server_space(i) >= (int)(sizeof(proto_resp_t) + ADNS_FRAME_PIXELS))) {
+				key = 1;
+			}
+		}
+	}
+
+	for (i = 0; i < SOCKET_SERVER_CLIENTS; i++) {
+		client_state_t *c = &clients[i];
+
+		for (k = 0; k < SERVER_JOBS; k++) {
+			job_t *j = &c->job[k];
+			const void *payload = frame.pixel;
+			uint32_t len = ADNS_FRAME_PIXELS;
+
+			if (j->req.cmd != PROTO_GRAB) continue;
+			if (socket_server_space(i) < (int)(sizeof(proto_resp_t) + ADNS_FRAME_PIXELS)) {
+				// the encoder moves on without this job
+				j->synced = 0;
+				continue;
+			}
+			if (j->req.flags & PROTO_F_DELTA) {
+				if (!coded_len) {
+					// coded once for all clients that asked for it
+					if (key) framecodec_force_key(&codec);
+					coded_len = framecodec_encode(&codec, frame.pixel, coded);
+				}
+				payload = coded;
+				len = coded_len;
+				j->synced = 1;
+			} else if (j->req.flags & PROTO_F_PACKED6) {
+				if (!have_packed) {
+					// packed once for all clients that asked for it
+					pixel_pack6(frame.pixel, packed, ADNS_FRAME_PIXELS);
+					have_packed = 1;
+				}
+				payload = packed;
+				len = sizeof(packed);
+			}
+			proto_resp_init(&r, &j->req, PROTO_OK, len);
+			r.flags = j->req.flags & ((payload == coded) ? PROTO_F_DELTA : PROTO_F_PACKED6);
+			r.t_ns = t;
+			r.shutter = adns.shutter;
+			r.frame_period = frame.frame_period;
+			r.seq = j->seq++;
+			if (--j->left == 0) {
+				r.flags |= PROTO_F_LAST;
+				j->req.cmd = 0;
+			}
+			respond(i, &r, payload);
+		}
+
+		if (!c->streaming) continue;
+		if (socket_server_send(i, &frame, sizeof(frame)) != SUCCESS) {
+			// the client may be gone by now
+			if (c->streaming) c->skipped++;
+		} else {
+			c->streamed++;
+			if (--c->stream_left == 0) client_stream_report(i, c);
+		}
+	}
+	return 0;
+}
+
+// motion subscriptions of all clients, returns the poll timeout
+static int serve_motion(void) {
+	uint64_t now = sched_now();
+	uint64_t next = UINT64_MAX;
+	int i, k, due = 0, integrate = 0;
+	proto_resp_t r;
+	proto_motion_t m;
+	proto_odo_t o;
+
+	for (i = 0; i < SOCKET_SERVER_CLIENTS; i++) {
+		for (k = 0; k < SERVER_JOBS; k++) {
+			job_t *j = &clients[i].job[k];
+			if ((j->req.cmd != PROTO_SUBSCRIBE) && (j->req.cmd != PROTO_ODOMETRY)) continue;
+			if (j->req.cmd == PROTO_ODOMETRY) integrate = 1;
+			if (j->deadline <= now) due = 1;
+			else if (j->deadline < next) next = j->deadline;
+		}
+	}
+	if (integrate) {
+		if (odo_next <= now) due = 1;
+		else if (odo_next < next) next = odo_next;
+	}
+	if (!due) return (next == UINT64_MAX) ? -1 : (int)((next - now + 999999) / 1000000);
+
+	// the burst clears the sensor counters, everyone gets the deltas
+	ADNS_read_motion_burst(sensor);
+	now = sched_now();
+	next = UINT64_MAX;
+	odo_update(&odo, now, adns.motion_val, adns.delta_X, adns.delta_Y);
+	if (integrate) {
+		odo_next += odo_period_ns;
+		if (odo_next <= now) odo_next = now + odo_period_ns;
+		next = odo_next;
+	}
+
+	for (i = 0; i < SOCKET_SERVER_CLIENTS; i++) {
+		for (k = 0; k < SERVER_JOBS; k++) {
+			job_t *j = &clients[i].job[k];
+			result_t ret;
+
+			if (j->req.cmd == PROTO_ODOMETRY) {
+				// counts before the first burst are from before the subscription
+				if (!j->started) {
+					j->base = odo;
+					j->started = 1;
+				}
+			} else if (j->req.cmd == PROTO_SUBSCRIBE) {
+				j->delta_X += adns.delta_X;
+				j->delta_Y += adns.delta_Y;
+			} else {
+				continue;
+			}
+
+			if (j->deadline <= now) {
+				if (j->req.cmd == PROTO_ODOMETRY) {
+					o.pos_X = odo.x - j->base.x;
+					o.pos_Y = odo.y - j->base.y;
+					o.vel_X = odo.vx;
+					o.vel_Y = odo.vy;
+					o.lost_X = odo.lost_x - j->base.lost_x;
+					o.lost_Y = odo.lost_y - j->base.lost_y;
+					o.overflows = odo.overflows - j->base.overflows;
+					proto_resp_init(&r, &j->req, PROTO_OK, sizeof(o));
+				} else {
+					m.delta_X = j->delta_X;
+					m.delta_Y = j->delta_Y;
+					m.squal = adns.squal;
+					m.motion = adns.motion_val;
+					m.pixel_sum = adns.pixel_sum;
+					proto_resp_init(&r, &j->req, PROTO_OK, sizeof(m));
+				}
+				r.t_ns = now;
+				r.shutter = adns.shutter;
+				r.frame_period = adns.frame_period;
+				r.seq = j->seq;
+				ret = respond(i, &r, (j->req.cmd == PROTO_ODOMETRY) ? (void *)&o : (void *)&m);
+				// a full queue keeps the deltas for the next sample
+				if (ret == SUCCESS) {
+					j->seq++;
+					j->delta_X = 0;
+					j->delta_Y = 0;
+				}
+				j->deadline += j->period_ns;
+				if (j->deadline <= now) j->deadline = now + j->period_ns;
+			}
+			if (j->deadline < next) next = j->deadline;
+		}
+	}
+	return (next == UINT64_MAX) ? -1 : (int)((next - now + 999999) / 1000000);
+}
+
+int server_run(int fd, uint16_t port, double rate, int v, volatile sig_atomic_t *stop) {
+	int timeout = -1;
+
+	sensor = fd;
+	verbose = v;
+	t0 = sched_now();
+	framecodec_init(&codec, FRAMECODEC_INTERVAL);
+	odo_init(&odo);
+	odo_period_ns = (rate > 0) ? 1E9 / rate : 0;
+
+	if (socket_server_init(port, on_client) != SUCCESS) {
+		socket_server_close();
+		return -1;
+	}
+	printf( "\tlisten on port %u\n", port);
+
+	ADNS_read_all(fd);
+	while (!*stop) {
+		int tf, tm;
+
+		if (socket_server_poll(timeout) < 0) break;
+		lat_poll(stdout);
+		trace_poll(stderr);
+		tf = serve_frames();
+		tm = serve_motion();
+		timeout = (tf < 0) ? tm : ((tm < 0) || (tf < tm)) ? tf : tm;
+	}
+	socket_server_close();
+	return 0;
+}
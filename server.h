@@ -0,0 +1,17 @@
+/*
+ * server.h
+ *
+ * sensor access for socket clients (adns-connect -k)
+ */
+
+#ifndef SERVER_H_
+#define SERVER_H_
+#include <stdint.h>
+#include <signal.h>
+
+#define SERVER_JOBS		8	// grabs and subscriptions in flight per client
+
+// rate: Hz the sensor is integrated at while odometry is subscribed
+int server_run(int fd, uint16_t port, double rate, int verbose, volatile sig_atomic_t *stop);
+
+#endif /* SERVER_H_ */
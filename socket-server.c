@@ -1,25 +1,137 @@
+/*
+ * socket-server.c
+ *
+ * Non-blocking TCP server on epoll. Every client has a fixed receive
+ * buffer and a bounded send queue, all allocated in socket_server_init,
+ * so serving clients does not touch the heap. A message either fits into
+ * the queue completely or is dropped; a client that does not take any
+ * data for SOCKET_SERVER_STALL_MS while its queue is full is disconnected.
+ */
+
+#define _GNU_SOURCE		// accept4()
 #include <sys/types.h>
 #include <sys/socket.h>	// socket(), connect(), send(), recv()
+#include <sys/epoll.h>
 #include <netinet/in.h>	// sockaddr_in
+#include <netinet/tcp.h>	// TCP_NODELAY
 #include <arpa/inet.h>	// htons(), inet_aton()
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
+#include "latency.h"
 #include "socket-server.h"
 
-#define BUF 1024
+#define LISTENER	SOCKET_SERVER_CLIENTS	// epoll tag of the listening socket
+
+typedef struct {
+	int fd;					// -1: free slot
+	struct sockaddr_in address;
+	char rx[SOCKET_SERVER_RX + 1];
+	uint8_t *txq;			// SOCKET_SERVER_TXQ bytes
+	uint32_t head;			// queued bytes, free running
+	uint32_t tail;			// sent bytes, free running
+	uint8_t want_out;		// EPOLLOUT registered
+	uint8_t dead;			// send failed, disconnect after this round
+	uint64_t t_progress;	// last time the queue drained a bit
+	uint64_t dropped;		// messages that did not fit
+} client_t;
+
+static int created_socket = -1;
+static int epoll_fd = -1;
+static client_t clients[SOCKET_SERVER_CLIENTS];
+static uint8_t *txq_mem;
+static socket_server_handler_t handler;
+
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void set_out(client_t *c, int on) {
+	struct epoll_event ev = {0};
+
+	if (c->want_out == on) return;
+	ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+	ev.data.u32 = c - clients;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->want_out = on;
+}
+
+// hand as much of the queue to the kernel as it takes
+static int flush(client_t *c) {
+	while (c->head != c->tail) {
+		uint32_t off = c->tail % SOCKET_SERVER_TXQ;
+		uint32_t len = c->head - c->tail;
+		ssize_t n;
+
+		if (off + len > SOCKET_SERVER_TXQ) len = SOCKET_SERVER_TXQ - off;
+		n = send(c->fd, c->txq + off, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+			return -1;
+		}
+		c->tail += n;
+		c->t_progress = now_ms();
+	}
+	set_out(c, c->head != c->tail);
+	return 0;
+}
+
+static void accept_clients(void) {
+	struct sockaddr_in address;
+	socklen_t addrlen;
+	int fd, i;
+
+	while (1) {
+		addrlen = sizeof(address);
+		fd = accept4(created_socket, (struct sockaddr *) &address, &addrlen, SOCK_NONBLOCK);
+		if (fd < 0) return;
 
-int created_socket;
-int new_socket;
-struct sockaddr_in address = {0};
-socklen_t addrlen;
-char *buffer;
+		for (i = 0; i < SOCKET_SERVER_CLIENTS; i++) {
+			if (clients[i].fd < 0) break;
+		}
+		if (i == SOCKET_SERVER_CLIENTS) {
+			printf("\tclient(%s) rejected, too many clients\n", inet_ntoa(address.sin_addr));
+			close(fd);
+			continue;
+		}
+
+		// small replies must not wait for more data
+		const int y = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &y, sizeof(int));
+
+		client_t *c = &clients[i];
+		struct epoll_event ev = {0};
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->address = address;
+		c->head = c->tail = 0;
+		c->want_out = 0;
+		c->dead = 0;
+		c->t_progress = now_ms();
+		c->dropped = 0;
+		printf ("\tclient(%s) connected...\n", inet_ntoa(address.sin_addr));
+	}
+}
+
+result_t socket_server_init(uint16_t port, socket_server_handler_t h) {
+	struct sockaddr_in address = {0};
+	struct epoll_event ev = {0};
+	int i;
 
-result_t socket_server_init(void) {
 	// create socket
-	if ((created_socket = socket(AF_INET, SOCK_STREAM, 0)) > 0)
+	if ((created_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) > 0)
 		printf ("\tsocket successfully created\n");
 
 	const int y = 1;
@@ -27,61 +139,165 @@ result_t socket_server_init(void) {
 	
 	// bind socket to port
 	address.sin_family = AF_INET;
-	address.sin_port = htons(15000);
+	address.sin_port = htons(port);
 	address.sin_addr.s_addr = INADDR_ANY;	
 	if (bind(created_socket, (struct sockaddr *) &address, sizeof (address)) != 0) {
-		printf( "\tport is blocked!\n");
+		printf( "\tport %u is blocked!\n", port);
 		return FAIL;
 	}  
 	
 	// listen
-	listen(created_socket, 3);
-	
-	addrlen = sizeof(struct sockaddr_in);
-	buffer = malloc(BUF);
+	listen(created_socket, SOMAXCONN);
+
+	// everything a client needs is allocated here, once
+	txq_mem = malloc((size_t)SOCKET_SERVER_CLIENTS * SOCKET_SERVER_TXQ);
+	epoll_fd = epoll_create1(0);
+	if ((txq_mem == NULL) || (epoll_fd < 0)) return FAIL;
+
+	for (i = 0; i < SOCKET_SERVER_CLIENTS; i++) {
+		clients[i].fd = -1;
+		clients[i].txq = txq_mem + (size_t)i * SOCKET_SERVER_TXQ;
+	}
+	handler = h;
+
+	ev.events = EPOLLIN;
+	ev.data.u32 = LISTENER;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, created_socket, &ev) != 0) return FAIL;
 	
 	return SUCCESS;
 }	
 
-result_t socket_server_wait_for_client(void) {
-	new_socket = accept(created_socket, (struct sockaddr *) &address, &addrlen);
-	if (new_socket > 0) {
-		printf ("\tclient(%s) connected...\n", inet_ntoa(address.sin_addr));
-		return SUCCESS;
-	} else return FAIL;
+/*
+ * wait up to timeout_ms (-1: forever) for socket activity and handle it
+ *
+ * returns the number of events, -1 on error
+ */
+int socket_server_poll(int timeout_ms) {
+	struct epoll_event ev[SOCKET_SERVER_CLIENTS + 1];
+	uint64_t t;
+	int n, i;
+
+	n = epoll_wait(epoll_fd, ev, SOCKET_SERVER_CLIENTS + 1, timeout_ms);
+	if (n < 0) return (errno == EINTR) ? 0 : -1;
+
+	for (i = 0; i < n; i++) {
+		uint32_t k = ev[i].data.u32;
+		client_t *c;
+
+		if (k == LISTENER) {
+			accept_clients();
+			continue;
+		}
+		c = &clients[k];
+		// may have been closed by an earlier event handler
+		if (c->fd < 0) continue;
+
+		if (ev[i].events & EPOLLOUT) {
+			if (flush(c) != 0) {
+				socket_server_disconnect(k);
+				continue;
+			}
+		}
+		if (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+			ssize_t size = recv(c->fd, c->rx, SOCKET_SERVER_RX, 0);
+			if (size > 0) {
+				c->rx[size] = '\0';
+				handler(k, c->rx, size);
+			} else if ((size == 0) || ((errno != EAGAIN) && (errno != EINTR))) {
+				socket_server_disconnect(k);
+			}
+		}
+	}
+
+	// slow consumers must not hold the queue forever
+	t = now_ms();
+	for (i = 0; i < SOCKET_SERVER_CLIENTS; i++) {
+		client_t *c = &clients[i];
+		if (c->dead) {
+			socket_server_disconnect(i);
+		} else if ((c->fd >= 0) && (c->head != c->tail) && (t - c->t_progress > SOCKET_SERVER_STALL_MS)) {
+			printf("\tclient(%s) stalled\n", inet_ntoa(c->address.sin_addr));
+			socket_server_disconnect(i);
+		}
+	}
+
+	return n;
 }
 
-result_t socket_server_receive(char **val, int *len) {			
-	ssize_t size;
-	size = recv(new_socket, buffer, BUF-1, 0);
-	if( size > 0) {
-		buffer[size] = '\0';
-		printf ("message received: %s(%d)\n", buffer,size);
+/*
+ * queue a message, FAIL if it does not fit completely
+ */
+result_t socket_server_send(int client, const void *val, int len) {
+	client_t *c = &clients[client];
+	uint64_t t_lat = lat_start();
+	uint32_t off, first;
+	int ret;
+
+	if ((c->fd < 0) || c->dead) return FAIL;
+	if ((uint32_t)len > SOCKET_SERVER_TXQ - (c->head - c->tail)) {
+		c->dropped++;
+		return FAIL;
+	}
+
+	off = c->head % SOCKET_SERVER_TXQ;
+	first = (off + len > SOCKET_SERVER_TXQ) ? SOCKET_SERVER_TXQ - off : len;
+	memcpy(c->txq + off, val, first);
+	memcpy(c->txq, (const uint8_t *)val + first, len - first);
+	c->head += len;
+
+	ret = flush(c);
+	lat_end(LAT_SOCKET_SEND, t_lat);
+	// the caller may be a handler of this client, close it later
+	if (ret != 0) {
+		c->dead = 1;
+		return FAIL;
 	}
-	
-	*len = size;
-	*val = malloc(size);
-	memcpy(*val, buffer, size);
 	return SUCCESS;
 }
 
-result_t socket_server_send(char *val, int len) {			
-	//~ printf("send message: ");
-	//~ fgets(buffer, BUF, stdin);
-	send(new_socket, val, len, 0);
+// free space in the send queue of a client
+int socket_server_space(int client) {
+	client_t *c = &clients[client];
 
-	return SUCCESS;
+	if ((c->fd < 0) || c->dead) return 0;
+	return SOCKET_SERVER_TXQ - (c->head - c->tail);
 }
 
-result_t socket_server_close(void) {
-	if (new_socket) close(new_socket);
-	if (created_socket) close(created_socket);
-		
-	return SUCCESS;
+int socket_server_clients(void) {
+	int i, n = 0;
+
+	for (i = 0; i < SOCKET_SERVER_CLIENTS; i++) {
+		if (clients[i].fd >= 0) n++;
+	}
+	return n;
 }
 
-result_t client_socket_close(void) {
-	if (new_socket) close(new_socket);
+void socket_server_disconnect(int client) {
+	client_t *c = &clients[client];
+
+	if (c->fd < 0) return;
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	c->dead = 0;
+
+	printf("\tclient(%s) disconnected", inet_ntoa(c->address.sin_addr));
+	if (c->dropped) printf(", %llu messages dropped", (unsigned long long)c->dropped);
+	printf("\n");
+
+	handler(client, NULL, 0);
+}
+
+result_t socket_server_close(void) {
+	int i;
+
+	if (txq_mem != NULL) {
+		for (i = 0; i < SOCKET_SERVER_CLIENTS; i++) socket_server_disconnect(i);
+	}
+	if (epoll_fd >= 0) close(epoll_fd);
+	if (created_socket >= 0) close(created_socket);
+	free(txq_mem);
+	txq_mem = NULL;
 		
 	return SUCCESS;
 }
@@ -6,16 +6,26 @@
 #define SOCKET_SERVER_H_
 #include <stdint.h>
 
+#define SOCKET_SERVER_PORT		15000
+#define SOCKET_SERVER_CLIENTS	16				// concurrent clients
+#define SOCKET_SERVER_RX		1024			// receive buffer per client
+#define SOCKET_SERVER_TXQ		(64 * 1024)		// send queue per client
+#define SOCKET_SERVER_STALL_MS	5000			// full queue without progress drops the client
+
 typedef enum {
 	SUCCESS,
 	FAIL
 } result_t;	
 
-result_t socket_server_wait_for_client(void);
+// called with received data, with len 0 when the client is gone
+typedef void (*socket_server_handler_t)(int client, char *val, int len);
+
+result_t socket_server_init(uint16_t port, socket_server_handler_t handler);
+int socket_server_poll(int timeout_ms);
+result_t socket_server_send(int client, const void *val, int len);
+int socket_server_space(int client);
+int socket_server_clients(void);
+void socket_server_disconnect(int client);
 result_t socket_server_close(void);
-result_t client_socket_close(void);
-result_t socket_server_init(void);
-result_t socket_server_receive(char **val, int *len);
-result_t socket_server_send(char *val, int len);
 
 #endif /* SOCKET_SERVER_H_ */
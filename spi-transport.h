@@ -0,0 +1,30 @@
+/*
+ * spi-transport.h
+ *
+ * backend interface below the SPI/ADNS access functions
+ */
+
+#ifndef SPI_TRANSPORT_H_
+#define SPI_TRANSPORT_H_
+#include <stdint.h>
+#include <linux/spi/spidev.h>
+
+typedef struct {
+	const char *name;
+	// returns a file descriptor identifying the opened bus, < 0 on error
+	int (*open)(const char *device, uint8_t *mode, uint8_t *bits, uint32_t *speed);
+	// same semantics as ioctl(fd, SPI_IOC_MESSAGE(n), tr)
+	int (*message)(int fd, struct spi_ioc_transfer *tr, unsigned int n);
+	void (*close)(int fd);
+} spi_transport_t;
+
+// real hardware using the spidev driver
+extern const spi_transport_t spi_transport_spidev;
+// in-process ADNS-3080 register emulator (adns-emu.c)
+extern const spi_transport_t spi_transport_emu;
+
+int SPI_message(int fd, struct spi_ioc_transfer *tr, unsigned int n);
+const spi_transport_t *SPI_get_transport(void);
+void SPI_set_transport(const spi_transport_t *t);
+
+#endif /* SPI_TRANSPORT_H_ */
@@ -0,0 +1,245 @@
+/*
+ * sweep.c
+ *
+ * Runs the speed sweeps of testing.sh and longterm.sh in one process. A
+ * plan has one setting per line, '#' starts a comment:
+ *	servo_max 6000				servo travel, written once
+ *	speeds 0x00 0x04 0x08		servo speeds
+ *	shutters 9100 60000			maximum shutter bounds
+ *	time 10						s recorded per point
+ *	repeat 10					repetitions, 0 until stopped
+ *	pause 30					s between repetitions
+ *	log split					a log per point, or single
+ *
+ * Every point is recorded as soon as its settings are read back from the
+ * sensor and the servo board instead of after fixed sleeps.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "adns.h"
+#include "i2c.h"
+#include "latency.h"
+#include "recorder.h"
+#include "sched.h"
+#include "sweep.h"
+#include "trace.h"
+
+#define SERVO_TOLERANCE		16		// position counts taken as home
+#define SERVO_TIMEOUT_MS	3000	// to get home
+#define SERVO_POLL_US		5000
+
+static int parse_values(char *s, long *val, int max, long lo, long hi) {
+	char *tok, *end;
+	int n = 0;
+
+	while ((tok = strtok(s, " \t")) != NULL) {
+		s = NULL;
+		if (n == max) return -1;
+		val[n] = strtol(tok, &end, 0);
+		if (*end || (val[n] < lo) || (val[n] > hi)) return -1;
+		n++;
+	}
+	return n;
+}
+
+int sweep_load(sweep_plan_t *plan, const char *path) {
+	char line[512], *key, *arg;
+	long val[SWEEP_MAX_VALUES];
+	int n, i, nr = 0;
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL) {
+		printf("can't open sweep plan %s\n", path);
+		return -1;
+	}
+	memset(plan, 0, sizeof(*plan));
+	plan->time = 10;
+	plan->repeat = 1;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		nr++;
+		if ((arg = strchr(line, '#')) != NULL) *arg = 0;
+		line[strcspn(line, "\r\n")] = 0;
+		key = strtok(line, " \t");
+		if (key == NULL) continue;
+		arg = strtok(NULL, "");
+		if (arg == NULL) arg = "";
+
+		n = 0;
+		if (strcmp(key, "servo_max") == 0) {
+			n = parse_values(arg, val, 1, 1, 0xffff);
+			if (n == 1) plan->servo_max = val[0];
+		} else if (strcmp(key, "speeds") == 0) {
+			n = parse_values(arg, val, SWEEP_MAX_VALUES, 0, 0xff);
+			for (i = 0; i < n; i++) plan->speeds[i] = val[i];
+			plan->n_speeds = n;
+		} else if (strcmp(key, "shutters") == 0) {
+			n = parse_values(arg, val, SWEEP_MAX_VALUES, 1, 0xffff - 0x0e7e);
+			for (i = 0; i < n; i++) plan->shutters[i] = val[i];
+			plan->n_shutters = n;
+		} else if (strcmp(key, "repeat") == 0) {
+			n = parse_values(arg, val, 1, 0, 1000000);
+			if (n == 1) plan->repeat = val[0];
+		} else if ((strcmp(key, "time") == 0) || (strcmp(key, "pause") == 0)) {
+			double *d = (key[0] == 't') ? &plan->time : &plan->pause;
+			*d = strtod(arg, &key);
+			n = ((key != arg) && (*d >= 0)) ? 1 : -1;
+		} else if (strcmp(key, "log") == 0) {
+			key = strtok(arg, " \t");
+			n = -1;
+			if (key != NULL) {
+				if (strcmp(key, "split") == 0) n = 1, plan->single = 0;
+				else if (strcmp(key, "single") == 0) n = 1, plan->single = 1;
+			}
+		} else {
+			n = -1;
+		}
+		if (n < 1) {
+			printf("%s:%d: invalid line\n", path, nr);
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+
+	if ((plan->n_speeds == 0) || (plan->n_shutters == 0) || (plan->time <= 0)) {
+		printf("%s: needs speeds, shutters and a run time\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static uint64_t elapsed_us(uint64_t t0) {
+	return (sched_now() - t0) / 1000;
+}
+
+// the speed is the last setting, the servo moves from home as soon as it is written
+static int servo_home(uint8_t speed, uint32_t *t_us) {
+	uint64_t t0 = sched_now();
+
+	if (i2cWriteB(SERVO_SPEED, 0) || i2cWriteW(SERVO_POSITION, 0)) return -1;
+	while (i2cReadW(SERVO_POSITION) > SERVO_TOLERANCE) {
+		if (elapsed_us(t0) > SERVO_TIMEOUT_MS * 1000) return -1;
+		usleep(SERVO_POLL_US);
+	}
+	if (i2cWriteB(SERVO_SPEED, speed) || (i2cReadB(SERVO_SPEED) != speed)) return -1;
+	*t_us = elapsed_us(t0);
+	return 0;
+}
+
+static void pause_for(double s, volatile sig_atomic_t *stop) {
+	uint64_t t0 = sched_now();
+
+	while (!*stop && ((sched_now() - t0) / 1E9 < s)) {
+		usleep(100000);
+		lat_poll(stdout);
+		trace_poll(stderr);
+	}
+}
+
+int sweep_run(int fd, const sweep_plan_t *plan, const char *dest, double rate,
+	const recorder_conf_t *c, int servo, volatile sig_atomic_t *stop) {
+	char path[1024], name[128];
+	recorder_conf_t conf = *c;
+	recorder_t rec;
+	sched_t sched;
+	adns_apply_t a;
+	FILE *idx;
+	unsigned run, point = 0;
+	int sp, sh;
+
+	if (plan->single) {
+		conf.binary = 1;
+		snprintf(path, sizeof(path), "%s.idx", dest);
+	} else {
+		if ((mkdir(dest, 0755) != 0) && (errno != EEXIST)) {
+			printf("can't create sweep directory %s\n", dest);
+			return -1;
+		}
+		snprintf(path, sizeof(path), "%s/index.tsv", dest);
+	}
+	idx = fopen(path, "w");
+	if (idx == NULL) {
+		printf("can't open sweep index %s\n", path);
+		return -1;
+	}
+	fprintf(idx, "point\trun\tspeed\tshutter\t%s\tt0_realtime\tapply_ms\tservo_ms\tsamples\toverruns\n",
+		plan->single ? "segment" : "file");
+
+	if (!servo) {
+		printf("\twarning: no servo board, sweeping the shutter only\n");
+	} else if (plan->servo_max && (i2cWriteW(SERVO_MAX, plan->servo_max) || (i2cReadW(SERVO_MAX) != plan->servo_max))) {
+		printf("servo maximum %u not set\n", plan->servo_max);
+		fclose(idx);
+		return -1;
+	}
+
+	for (run = 1; (!plan->repeat || (run <= plan->repeat)) && !*stop; run++) {
+		printf("\trun %u\n", run);
+		for (sp = 0; (sp < plan->n_speeds) && !*stop; sp++) {
+			for (sh = 0; (sh < plan->n_shutters) && !*stop; sh++) {
+				uint8_t speed = plan->speeds[sp];
+				uint16_t shutter = plan->shutters[sh];
+				uint32_t servo_us = 0;
+				uint64_t samples = 0;
+
+				if (ADNS_set_FPS_bounds(fd, shutter, &a) < 1) {
+					printf("\tpoint %u: shutter %u not applied, skipped\n", point, shutter);
+					continue;
+				}
+				if (servo && (servo_home(speed, &servo_us) != 0)) {
+					printf("\tpoint %u: servo speed 0x%02x not set, skipped\n", point, speed);
+					continue;
+				}
+
+				if (plan->single) {
+					snprintf(name, sizeof(name), "%u", point);
+					conf.append = (point > 0) || c->append;
+				} else {
+					snprintf(name, sizeof(name), "r%03u_speed0x%02x_shutter%u.%s", run, speed, shutter,
+						conf.binary ? "bin" : "dat");
+					snprintf(path, sizeof(path), "%s/%s", dest, name);
+				}
+				if (sched_init(&sched, rate) != 0) {
+					printf("invalid sample rate %f\n", rate);
+					break;
+				}
+				if (recorder_start(&rec, fd, plan->single ? dest : path, &conf) != 0) break;
+				do {
+					if (recorder_sample(&rec)) samples++;
+					lat_poll(stdout);
+					trace_poll(stderr);
+					sched_wait(&sched);
+				} while ((rec.t_ns / 1E9 < plan->time) && !*stop);
+				recorder_stop(&rec);
+
+				printf("\tpoint %u: speed 0x%02x shutter %u, %.3f s, %llu samples to %s\n", point, speed, shutter,
+					rec.t_ns / 1E9, (unsigned long long)samples, name);
+				fprintf(idx, "%u\t%u\t0x%02x\t%u\t%s\t%lld.%09lld\t%.1f\t%.1f\t%llu\t%llu\n", point, run, speed,
+					shutter, name, (long long)(rec.t0_realtime / 1000000000), (long long)(rec.t0_realtime % 1000000000),
+					a.t_us / 1E3, servo_us / 1E3, (unsigned long long)samples,
+					(unsigned long long)rec.writer.overruns);
+				fflush(idx);
+				point++;
+			}
+			// a failed log or rate won't work for the next point either
+			if (sh < plan->n_shutters) break;
+		}
+		if (sp < plan->n_speeds) break;
+
+		if (servo) i2cWriteB(SERVO_SPEED, 0);
+		if ((!plan->repeat || (run < plan->repeat)) && (plan->pause > 0)) pause_for(plan->pause, stop);
+	}
+
+	if (servo) i2cWriteB(SERVO_SPEED, 0);
+	fclose(idx);
+	printf("\tsweep: %u points\n", point);
+	return (point > 0) ? 0 : -1;
+}
@@ -0,0 +1,42 @@
+/*
+ * sweep.h
+ *
+ * in-process experiment sweeps over servo speeds and shutter bounds
+ */
+
+#ifndef SWEEP_H_
+#define SWEEP_H_
+#include <signal.h>
+#include <stdint.h>
+
+#include "recorder.h"
+
+#define SWEEP_MAX_VALUES	64
+
+// servo board registers at I2C_SLAVE_ADDRESS
+#define SERVO_POSITION		0x32	// w
+#define SERVO_MAX			0x36	// w
+#define SERVO_SPEED			0x39	// b
+
+typedef struct {
+	uint16_t servo_max;
+	uint8_t speeds[SWEEP_MAX_VALUES];
+	int n_speeds;
+	uint16_t shutters[SWEEP_MAX_VALUES];
+	int n_shutters;
+	double time;			// s per point
+	unsigned repeat;		// 0: until stopped
+	double pause;			// s between repetitions, servo stopped
+	int single;				// one binary log with a segment per point
+} sweep_plan_t;
+
+// returns 0 or -1 with the offending line printed
+int sweep_load(sweep_plan_t *plan, const char *path);
+/*
+ * dest is a directory for a log per point or the log file of a single
+ * log, both get an index; servo 0 runs without the servo board
+ */
+int sweep_run(int fd, const sweep_plan_t *plan, const char *dest, double rate,
+	const recorder_conf_t *conf, int servo, volatile sig_atomic_t *stop);
+
+#endif /* SWEEP_H_ */
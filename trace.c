@@ -0,0 +1,128 @@
+/*
+ * trace.c
+ *
+ * Recording takes a slot with one atomic add and stores the timestamp
+ * and raw arguments, nothing is formatted until the ring is dumped. The
+ * ring keeps the last TRACE_RING events, older ones are overwritten.
+ * Dumps are meant to run in the thread that records (trace_poll in the
+ * main loop); events recorded concurrently may show up torn.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+
+int trace_level = TRACE_OFF;
+
+static trace_event_t ring[TRACE_RING];
+static _Atomic uint64_t head;
+static uint64_t dumped;
+static volatile sig_atomic_t requested;
+
+void trace_record(int id, int32_t a, int32_t b, int32_t c, int32_t d) {
+	trace_event_t *e = &ring[atomic_fetch_add_explicit(&head, 1, memory_order_relaxed) & (TRACE_RING - 1)];
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	e->t_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	e->id = id;
+	e->arg[0] = a;
+	e->arg[1] = b;
+	e->arg[2] = c;
+	e->arg[3] = d;
+}
+
+void trace_set_level(int level) {
+	trace_level = level;
+	if (level > TRACE_LEVEL) {
+		fprintf(stderr, "warning: trace level %d requested, built with %d\n", level, TRACE_LEVEL);
+	}
+}
+
+static void format(FILE *f, const trace_event_t *e) {
+	const int32_t *a = e->arg;
+
+	switch (e->id) {
+	case TRACE_SPI_READ:
+		fprintf(f, "spi read byte at address: %.2x = %.2x\n", a[0], a[1]);
+		break;
+	case TRACE_SPI_WRITE:
+		fprintf(f, "spi write byte %.2x to address %.2x\n", a[1], a[0]);
+		break;
+	case TRACE_PLAN:
+		fprintf(f, "spi planned message: %d accesses, %d transfers, %d bytes\n", a[0], a[1], a[2]);
+		break;
+	case TRACE_MOTION:
+		fprintf(f, "motion burst: MOT %d OVF %d RES %d delta_x %d delta_y %d SQUAL %d maximum_pixel %d shutter %d\n",
+			(a[0] >> 7) & 1, (a[0] >> 4) & 1, a[0] & 1, a[1], a[2], a[3] & 0xffff, (a[0] >> 8) & 0xff,
+			(a[3] >> 16) & 0xffff);
+		break;
+	case TRACE_FRAME:
+		fprintf(f, "frame burst: %d bytes, start of frame at %d, pixel min %d, max %d, mean %.1f\n",
+			a[0], a[1], a[2] & 0xff, (a[2] >> 8) & 0xff, a[0] ? (double)a[3] / a[0] : 0.0);
+		break;
+	case TRACE_REGISTERS:
+		fprintf(f, "registers: product_ID 0x%x inverse 0x%x revision 0x%x pixel_sum %d frame_period %d - %.1f Hz\n",
+			a[0] & 0xff, (a[0] >> 8) & 0xff, (a[0] >> 16) & 0xff, a[1], a[2], a[2] ? 24E6 / a[2] : 0.0);
+		break;
+	case TRACE_FPS_BOUNDS:
+		fprintf(f, "frame_period_max %d frame_period_min %d shutter_max %d\n", a[0], a[1], a[2]);
+		break;
+	case TRACE_FPS_SET:
+		fprintf(f, "set frame period bounds for max shutter of %d: %d write(s), %d readback(s), applied in %.3f ms\n",
+			a[0], a[1], a[2], a[3] / 1E3);
+		break;
+	case TRACE_EXT_CONF:
+		fprintf(f, "extended configuration: busy %d NPU %d NAGC %d fixed FR %d\n",
+			(a[0] >> 7) & 1, (a[0] >> 2) & 1, (a[0] >> 1) & 1, a[0] & 1);
+		break;
+	case TRACE_SET_EXT_CONF:
+		fprintf(f, "set extended configuration byte: %.2x\n", a[0]);
+		break;
+	case TRACE_SET_CONF:
+		fprintf(f, "set configuration byte: %.2x\n", a[0]);
+		break;
+	default:
+		fprintf(f, "event %u: %d %d %d %d\n", e->id, a[0], a[1], a[2], a[3]);
+	}
+}
+
+void trace_dump(FILE *f) {
+	uint64_t end = atomic_load(&head), i, t0, t = 0;
+
+	if (end == dumped) return;
+	if (end - dumped > TRACE_RING) {
+		fprintf(f, "\ttrace: %llu events overwritten\n", (unsigned long long)(end - dumped - TRACE_RING));
+		dumped = end - TRACE_RING;
+	}
+	t0 = ring[dumped & (TRACE_RING - 1)].t_ns;
+	for (i = dumped; i < end; i++) {
+		const trace_event_t *e = &ring[i & (TRACE_RING - 1)];
+		// ms since the first event of the dump, us since the one before
+		fprintf(f, "\t%10.3f %+9.1f  ", (e->t_ns - t0) / 1E6, t ? ((int64_t)(e->t_ns - t)) / 1E3 : 0.0);
+		format(f, e);
+		t = e->t_ns;
+	}
+	dumped = end;
+	fflush(f);
+}
+
+static void on_signal(int sig) {
+	requested = 1;
+}
+
+void trace_signal_init(void) {
+	struct sigaction sa = {0};
+
+	sa.sa_handler = on_signal;
+	sigaction(SIGUSR2, &sa, NULL);
+}
+
+void trace_poll(FILE *f) {
+	if (!requested) return;
+	requested = 0;
+	trace_dump(f);
+}
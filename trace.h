@@ -0,0 +1,63 @@
+/*
+ * trace.h
+ *
+ * diagnostic trace points recorded into a binary ring, formatted on dump
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// levels, -v and -w at runtime
+#define TRACE_OFF		0
+#define TRACE_INFO		1
+#define TRACE_DEBUG		2
+
+// trace points above this level are not compiled in, see the Makefile
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL		TRACE_DEBUG
+#endif
+
+#define TRACE_RING		4096	// events kept, power of two
+
+// events, arguments as noted
+enum {
+	TRACE_SPI_READ,			// addr, value
+	TRACE_SPI_WRITE,		// addr, value
+	TRACE_PLAN,				// accesses, transfers, bytes
+	TRACE_MOTION,			// motion | maximum_pixel << 8, delta_X, delta_Y, squal | shutter << 16
+	TRACE_FRAME,			// bytes, start of frame, min | max << 8, pixel sum
+	TRACE_REGISTERS,		// product_ID | inv_product_ID << 8 | revision << 16, pixel_sum, frame_period
+	TRACE_FPS_BOUNDS,		// frame_period_max, frame_period_min, shutter_max
+	TRACE_FPS_SET,			// shutter wanted, writes, readbacks, time to apply (us)
+	TRACE_EXT_CONF,			// value
+	TRACE_SET_EXT_CONF,		// value
+	TRACE_SET_CONF,			// value
+	TRACE_EVENTS
+};
+
+typedef struct {
+	uint64_t t_ns;			// CLOCK_MONOTONIC
+	uint16_t id;
+	int32_t arg[4];
+} trace_event_t;
+
+extern int trace_level;
+
+void trace_record(int id, int32_t a, int32_t b, int32_t c, int32_t d);
+
+// compiles to nothing above TRACE_LEVEL, to a branch while not enabled
+#define TRACE(level, id, a, b, c, d) do { \
+		if (((level) <= TRACE_LEVEL) && ((level) <= trace_level)) trace_record(id, a, b, c, d); \
+	} while (0)
+
+void trace_set_level(int level);
+// formats the events recorded since the last dump, oldest first
+void trace_dump(FILE *f);
+// SIGUSR2 asks for a dump, done by trace_poll outside the handler
+void trace_signal_init(void);
+void trace_poll(FILE *f);
+
+#endif /* TRACE_H_ */